@@ -14,5 +14,6 @@ rm -f "${HAM_UFILES_DIR}/available-notifications"
 rm -f "${HAM_UFILES_DIR}/boot"
 rm -f "${HAM_UFILES_DIR}/update-notifier"
 rm -f "${HAM_UFILES_DIR}/last-update"
+rm -f "${HAM_UFILES_DIR}/package-list"
 
 exit 0
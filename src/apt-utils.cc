@@ -21,6 +21,8 @@
  *
  */
 
+#include <string.h>
+
 #include <apt-pkg/debversion.h>
 
 #include "apt-utils.h"
@@ -35,3 +37,97 @@ compare_deb_versions (const gchar *a, const gchar *b)
 
   return debVS.CmpVersion (a,b);
 }
+
+/* The sort key is built from the same parts that dpkg compares: the
+   epoch, the upstream version and the revision, each of them split
+   into alternating runs of non-digits and digits.  Characters of a
+   non-digit run are mapped so that '~' sorts before the end of the
+   run, which sorts before letters, which sort before everything else.
+   Digit runs are stored without leading zeros, prefixed by their
+   length, so that they compare numerically.  No byte of the key is
+   zero.
+*/
+
+#define KEY_TILDE    0x01
+#define KEY_RUN_END  0x02
+
+static void
+append_number_key (GString *key, const gchar *digits, size_t len)
+{
+  while (len > 0 && *digits == '0')
+    {
+      digits++;
+      len--;
+    }
+
+  if (len > 254)
+    len = 254;
+
+  g_string_append_c (key, (gchar) (len + 1));
+  g_string_append_len (key, digits, len);
+}
+
+static void
+append_part_key (GString *key, const gchar *str, const gchar *end)
+{
+  /* There is always at least one pair of runs, so that an empty part
+     gets the same key as "0".
+   */
+  do
+    {
+      while (str < end && !g_ascii_isdigit (*str))
+        {
+          guchar c = *str++;
+
+          if (c == '~')
+            g_string_append_c (key, KEY_TILDE);
+          else if (g_ascii_isalpha (c))
+            g_string_append_c (key, c);
+          else if (c < 0x80)
+            g_string_append_c (key, c | 0x80);
+          else
+            g_string_append_c (key, (gchar) 0xff);
+        }
+      g_string_append_c (key, KEY_RUN_END);
+
+      const gchar *digits = str;
+      while (str < end && g_ascii_isdigit (*str))
+        str++;
+      append_number_key (key, digits, str - digits);
+    }
+  while (str < end);
+
+  /* The end of a part compares like the end of a non-digit run.
+   */
+  g_string_append_c (key, KEY_RUN_END);
+}
+
+gchar *
+deb_version_sort_key (const gchar *version)
+{
+  if (version == NULL)
+    return g_strdup ("\xff");
+
+  GString *key = g_string_new (NULL);
+
+  const gchar *upstream = version;
+  const gchar *colon = strchr (version, ':');
+  if (colon)
+    {
+      append_number_key (key, version, colon - version);
+      upstream = colon + 1;
+    }
+  else
+    append_number_key (key, "", 0);
+
+  const gchar *end = upstream + strlen (upstream);
+  const gchar *hyphen = strrchr (upstream, '-');
+
+  append_part_key (key, upstream, hyphen ? hyphen : end);
+  if (hyphen)
+    append_part_key (key, hyphen + 1, end);
+  else
+    append_part_key (key, end, end);
+
+  return g_string_free (key, FALSE);
+}
@@ -35,4 +35,11 @@
 
 gint compare_deb_versions (const gchar *a, const gchar *b);
 
+/* DEB_VERSION_SORT_KEY returns a newly allocated string such that
+   comparing two keys with strcmp orders the versions like
+   compare_deb_versions does.  A NULL version gets a key that sorts
+   after all others, just as compare_deb_versions treats it.
+*/
+gchar *deb_version_sort_key (const gchar *version);
+
 #endif /* !APT_UTILS_H */
@@ -0,0 +1,824 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* apt-worker-bench -- measure apt-worker against a synthetic system
+
+   Usage: apt-worker-bench [-n PACKAGES] [-r ROUNDS] [-s SEED]
+                           [-w APT-WORKER] [-k]
+
+   This program creates a temporary root directory with a
+   configuration for libapt-pkg, a local file:// repository with
+   PACKAGES packages (1000 by default), and a dpkg status file that
+   has about a third of them installed, most of them in an older
+   version.  The packages have the fields that the Application
+   Manager looks at, such as Maemo-Display-Name and Maemo-Icon-26, and
+   depend on each other.
+
+   It then starts APT-WORKER (./apt-worker by default) in sandbox mode
+   on that root, talks to it over its fifos just like the frontend
+   does, and runs these flows ROUNDS times (5 by default):
+
+   - GET_PACKAGE_LIST for the user packages
+   - GET_PACKAGE_INFO for every package in that list, one by one
+   - GET_PACKAGE_INFOS for the same packages, in batches
+   - a search, i.e. GET_PACKAGE_LIST with a pattern
+   - INSTALL_CHECK for the package with the most dependencies
+   - CHECK_UPDATES from the local repository, including the
+     reconstruction of the cache that it triggers
+
+   The latencies are written to stdout as JSON, with percentiles for
+   each flow, together with the statistics that apt-worker keeps
+   itself (see APTCMD_GET_STATS).  The output of apt-worker goes to
+   worker.log in the temporary root, which is removed afterwards
+   unless -k is given.
+
+   Since the packages are generated from SEED, runs with the same
+   parameters measure the same work and can be compared with each
+   other.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include "apt-worker-proto.h"
+
+#define DEFAULT_PACKAGES 1000
+#define DEFAULT_ROUNDS   5
+#define DEFAULT_SEED     1
+#define DEFAULT_WORKER   "./apt-worker"
+
+#define MIN_PACKAGES     1
+#define MAX_PACKAGES     50000
+
+/* The frontend asks for package infos in batches of this size, see
+   gpiib_trigger in main.cc.
+*/
+#define INFOS_BATCH_SIZE 32
+
+#define BENCH_DIST "bench"
+#define BENCH_ARCH "armel"
+
+static char *root;
+static pid_t worker_pid = -1;
+static int to_fd = -1, from_fd = -1, status_fd = -1, cancel_fd = -1;
+static int seq;
+
+static apt_proto_encoder request;
+static apt_proto_decoder response;
+static char *response_buf;
+
+static void
+fail (const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start (ap, fmt);
+  fprintf (stderr, "apt-worker-bench: ");
+  vfprintf (stderr, fmt, ap);
+  fprintf (stderr, "\n");
+  va_end (ap);
+
+  if (worker_pid > 0)
+    kill (worker_pid, SIGTERM);
+  exit (1);
+}
+
+static double
+now_ms ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/** SYNTHETIC SYSTEM
+ */
+
+static char *
+root_path (const char *rel)
+{
+  return g_build_filename (root, rel, NULL);
+}
+
+static void
+make_dir (const char *rel)
+{
+  char *path = root_path (rel);
+  if (g_mkdir_with_parents (path, 0755) < 0)
+    fail ("can't create %s: %s", path, strerror (errno));
+  g_free (path);
+}
+
+static void
+write_file (const char *rel, const char *contents, gssize len)
+{
+  GError *error = NULL;
+  char *path = root_path (rel);
+
+  if (!g_file_set_contents (path, contents, len, &error))
+    fail ("%s", error->message);
+  g_free (path);
+}
+
+/* About 1.5k of base64, which is what a typical 26x26 icon takes.
+ */
+static char *
+fake_icon (GRand *rand)
+{
+  GString *icon = g_string_new (NULL);
+  static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  for (int line = 0; line < 20; line++)
+    {
+      g_string_append_c (icon, ' ');
+      for (int i = 0; i < 76; i++)
+	g_string_append_c (icon, b64[g_rand_int_range (rand, 0, 64)]);
+      g_string_append_c (icon, '\n');
+    }
+
+  return g_string_free (icon, FALSE);
+}
+
+static const char *
+package_section (int i)
+{
+  /* Most packages are for the user, some are libraries that the user
+     packages depend on.
+  */
+  if (i % 10 == 0)
+    return "libs";
+  else if (i % 3 == 0)
+    return "user/games";
+  else
+    return "user/utilities";
+}
+
+static void
+append_package (GString *str, GRand *rand, int i, const char *version,
+		const char *status)
+{
+  char *icon = fake_icon (rand);
+
+  g_string_append_printf (str, "Package: bench-pkg-%05d\n", i);
+  if (status)
+    g_string_append_printf (str, "Status: %s\n", status);
+  g_string_append_printf (str,
+			  "Priority: optional\n"
+			  "Section: %s\n"
+			  "Installed-Size: %d\n"
+			  "Maintainer: Bench <bench@example.com>\n"
+			  "Architecture: all\n"
+			  "Version: %s\n",
+			  package_section (i),
+			  g_rand_int_range (rand, 10, 5000),
+			  version);
+
+  /* Each package depends on up to three earlier ones, so that
+     installing one of the last packages pulls in a good part of the
+     repository.
+  */
+  if (i > 0)
+    {
+      int n_deps = g_rand_int_range (rand, 0, MIN (i, 3) + 1);
+      for (int d = 0; d < n_deps; d++)
+	g_string_append_printf (str, "%s bench-pkg-%05d",
+				d == 0 ? "Depends:" : ",",
+				g_rand_int_range (rand, MAX (0, i - 50), i));
+      if (n_deps > 0)
+	g_string_append_c (str, '\n');
+    }
+
+  if (status == NULL)
+    g_string_append_printf (str,
+			    "Filename: pool/main/b/bench-pkg-%05d_%s_all.deb\n"
+			    "Size: %d\n"
+			    "MD5sum: %08x%08x%08x%08x\n",
+			    i, version,
+			    g_rand_int_range (rand, 1000, 1000000),
+			    g_rand_int (rand), g_rand_int (rand),
+			    g_rand_int (rand), g_rand_int (rand));
+
+  g_string_append_printf (str,
+			  "Description: Synthetic package number %d\n"
+			  " This package has been generated by apt-worker-bench.\n"
+			  " It does not contain anything.\n"
+			  "Maemo-Display-Name: Bench Package %d\n"
+			  "Maemo-Icon-26:\n%s"
+			  "\n",
+			  i, i, icon);
+  g_free (icon);
+}
+
+static void
+make_repository (int n_packages, guint32 seed)
+{
+  GRand *rand = g_rand_new_with_seed (seed);
+  GString *packages = g_string_new (NULL);
+  GString *status = g_string_new (NULL);
+
+  for (int i = 0; i < n_packages; i++)
+    {
+      append_package (packages, rand, i, "1.0-1", NULL);
+
+      /* Every third package is installed, and two out of three of
+	 those can be updated.
+      */
+      if (i % 3 == 0)
+	append_package (status, rand, i, (i % 9 == 0) ? "1.0-1" : "0.9-1",
+			"install ok installed");
+    }
+
+  const char *packages_rel =
+    "repo/dists/" BENCH_DIST "/main/binary-" BENCH_ARCH "/Packages";
+  write_file (packages_rel, packages->str, packages->len);
+  write_file ("var/lib/dpkg/status", status->str, status->len);
+
+  char *md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5,
+					     packages->str, packages->len);
+  char *sha1 = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+					      packages->str, packages->len);
+  char *release =
+    g_strdup_printf ("Origin: bench\n"
+		     "Label: bench\n"
+		     "Suite: " BENCH_DIST "\n"
+		     "Codename: " BENCH_DIST "\n"
+		     "Architectures: " BENCH_ARCH "\n"
+		     "Components: main\n"
+		     "Description: apt-worker-bench repository\n"
+		     "MD5Sum:\n"
+		     " %s %lu main/binary-" BENCH_ARCH "/Packages\n"
+		     "SHA1:\n"
+		     " %s %lu main/binary-" BENCH_ARCH "/Packages\n",
+		     md5, (unsigned long) packages->len,
+		     sha1, (unsigned long) packages->len);
+  write_file ("repo/dists/" BENCH_DIST "/Release", release, -1);
+
+  g_free (release);
+  g_free (md5);
+  g_free (sha1);
+  g_string_free (packages, TRUE);
+  g_string_free (status, TRUE);
+  g_rand_free (rand);
+}
+
+static void
+make_root (int n_packages, guint32 seed)
+{
+  root = g_strdup ("/tmp/apt-worker-bench.XXXXXX");
+  if (mkdtemp (root) == NULL)
+    fail ("can't create temporary directory: %s", strerror (errno));
+
+  make_dir ("etc/apt/apt.conf.d");
+  make_dir ("etc/apt/sources.list.d");
+  make_dir ("etc/apt/preferences.d");
+  make_dir ("var/lib/apt/lists/partial");
+  make_dir ("var/cache/apt/archives/partial");
+  make_dir ("var/lib/dpkg/updates");
+  make_dir ("var/lib/dpkg/info");
+  make_dir ("repo/dists/" BENCH_DIST "/main/binary-" BENCH_ARCH);
+
+  char *conf =
+    g_strdup_printf ("Dir \"%s/\";\n"
+		     "Dir::State \"var/lib/apt/\";\n"
+		     "Dir::State::status \"%s/var/lib/dpkg/status\";\n"
+		     "Dir::Cache \"var/cache/apt/\";\n"
+		     "Dir::Etc \"etc/apt/\";\n"
+		     "Dir::Bin::Methods \"/usr/lib/apt/methods\";\n"
+		     "Dir::Bin::dpkg \"/bin/false\";\n"
+		     "APT::Architecture \"" BENCH_ARCH "\";\n"
+		     "Debug::NoLocking \"true\";\n",
+		     root, root);
+  write_file ("etc/apt/apt.conf", conf, -1);
+  g_free (conf);
+
+  char *sources = g_strdup_printf ("deb file://%s/repo " BENCH_DIST " main\n",
+				   root);
+  write_file ("etc/apt/sources.list", sources, -1);
+  g_free (sources);
+
+  make_repository (n_packages, seed);
+}
+
+static int
+remove_root_1 (const char *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name (dir)))
+	{
+	  char *child = g_build_filename (path, name, NULL);
+	  remove_root_1 (child);
+	  g_free (child);
+	}
+      g_dir_close (dir);
+    }
+
+  return remove (path);
+}
+
+static void
+remove_root ()
+{
+  if (root)
+    remove_root_1 (root);
+}
+
+/** TALKING TO APT-WORKER
+ */
+
+static void
+write_all (int fd, const void *buf, size_t n)
+{
+  while (n > 0)
+    {
+      ssize_t r = write (fd, buf, n);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	fail ("can't write to apt-worker: %s", strerror (errno));
+      buf = (const char *) buf + r;
+      n -= r;
+    }
+}
+
+static void
+read_all (int fd, void *buf, size_t n)
+{
+  while (n > 0)
+    {
+      ssize_t r = read (fd, buf, n);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r < 0)
+	fail ("can't read from apt-worker: %s", strerror (errno));
+      if (r == 0)
+	fail ("apt-worker has exited, see %s/worker.log", root);
+      buf = (char *) buf + r;
+      n -= r;
+    }
+}
+
+static char *
+make_fifo (const char *rel)
+{
+  char *path = root_path (rel);
+  if (mkfifo (path, 0600) < 0)
+    fail ("can't create %s: %s", path, strerror (errno));
+  return path;
+}
+
+/* Send the request in REQUEST and wait for the response to it, which
+   is then available in RESPONSE.  Status reports that arrive in the
+   meantime are skipped.
+*/
+static void
+call (int cmd)
+{
+  apt_request_header req = { cmd, ++seq, request.get_len () };
+  apt_response_header res;
+
+  write_all (to_fd, &req, sizeof (req));
+  write_all (to_fd, request.get_buf (), request.get_len ());
+
+  while (true)
+    {
+      read_all (from_fd, &res, sizeof (res));
+      response_buf = (char *) g_realloc (response_buf, MAX (res.len, 1));
+      read_all (from_fd, response_buf, res.len);
+
+      if (res.cmd == APTCMD_STATUS)
+	continue;
+      if (res.seq != seq || res.cmd != cmd)
+	fail ("unexpected response %d/%d to %d/%d",
+	      res.cmd, res.seq, cmd, seq);
+
+      response.reset (response_buf, res.len);
+      return;
+    }
+}
+
+static void
+start_worker (const char *worker)
+{
+  char *to = make_fifo ("apt-worker.to");
+  char *from = make_fifo ("apt-worker.from");
+  char *status = make_fifo ("apt-worker.status");
+  char *cancel = make_fifo ("apt-worker.cancel");
+  char *log = root_path ("worker.log");
+  char *apt_config = root_path ("etc/apt/apt.conf");
+
+  worker_pid = fork ();
+  if (worker_pid < 0)
+    fail ("can't fork: %s", strerror (errno));
+
+  if (worker_pid == 0)
+    {
+      int log_fd = open (log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (log_fd >= 0)
+	{
+	  dup2 (log_fd, 1);
+	  dup2 (log_fd, 2);
+	  close (log_fd);
+	}
+      setenv ("APT_CONFIG", apt_config, 1);
+      execl (worker, worker, "backend", to, from, status, cancel, "S",
+	     NULL);
+      fprintf (stderr, "can't run %s: %s\n", worker, strerror (errno));
+      _exit (127);
+    }
+
+  /* Same order as in the frontend: apt-worker opens its input fifos
+     without blocking and then waits for us to open the other ends of
+     its output fifos.
+  */
+  from_fd = open (from, O_RDONLY);
+  status_fd = open (status, O_RDONLY);
+  to_fd = open (to, O_WRONLY);
+  cancel_fd = open (cancel, O_WRONLY);
+  if (from_fd < 0 || status_fd < 0 || to_fd < 0 || cancel_fd < 0)
+    fail ("can't open fifos: %s", strerror (errno));
+
+  g_free (to);
+  g_free (from);
+  g_free (status);
+  g_free (cancel);
+  g_free (log);
+  g_free (apt_config);
+}
+
+static void
+stop_worker ()
+{
+  apt_request_header req = { APTCMD_EXIT, ++seq, 0 };
+  int status;
+
+  /* There is no response to APTCMD_EXIT.
+   */
+  write_all (to_fd, &req, sizeof (req));
+  close (to_fd);
+  close (cancel_fd);
+  waitpid (worker_pid, &status, 0);
+  close (from_fd);
+  close (status_fd);
+  worker_pid = -1;
+}
+
+/** MEASUREMENTS
+ */
+
+struct flow {
+  const char *name;
+  GArray *samples;
+};
+
+static flow flows[] = {
+  { "startup" },
+  { "get_package_list" },
+  { "get_package_info" },
+  { "get_package_info_all" },
+  { "get_package_infos_all" },
+  { "search" },
+  { "install_check" },
+  { "check_updates" },
+};
+
+enum {
+  FLOW_STARTUP,
+  FLOW_GET_PACKAGE_LIST,
+  FLOW_GET_PACKAGE_INFO,
+  FLOW_GET_PACKAGE_INFO_ALL,
+  FLOW_GET_PACKAGE_INFOS_ALL,
+  FLOW_SEARCH,
+  FLOW_INSTALL_CHECK,
+  FLOW_CHECK_UPDATES,
+  N_FLOWS
+};
+
+static void
+record (int flow, double start_ms)
+{
+  double ms = now_ms () - start_ms;
+  g_array_append_val (flows[flow].samples, ms);
+}
+
+static int
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+  double da = *(const double *) a, db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+static double
+percentile (GArray *sorted, double p)
+{
+  int i = (int) (p * (sorted->len - 1) + 0.5);
+  return g_array_index (sorted, double, i);
+}
+
+/** FLOWS
+ */
+
+static GPtrArray *
+get_package_list (int flow, const char *pattern)
+{
+  GPtrArray *names = g_ptr_array_new ();
+  double start = now_ms ();
+
+  request.reset ();
+  request.encode_int (1);        // only_user
+  request.encode_int (0);        // only_installed
+  request.encode_int (0);        // only_available
+  request.encode_string (pattern);
+  request.encode_int (0);        // show_magic_sys
+  call (APTCMD_GET_PACKAGE_LIST);
+  record (flow, start);
+
+  if (!response.decode_int ())
+    fail ("GET_PACKAGE_LIST failed, see %s/worker.log", root);
+
+  while (!response.at_end () && !response.corrupted ())
+    {
+      g_ptr_array_add (names, response.decode_string_dup ());
+      response.decode_int ();             // broken
+      response.decode_string_in_place (); // installed version
+      response.decode_int64 ();           // installed size
+      for (int i = 0; i < 4; i++)         // section, name, desc, icon
+	response.decode_string_in_place ();
+      for (int i = 0; i < 5; i++)         // version, section, name, ...
+	response.decode_string_in_place ();
+      response.decode_int ();             // flags
+    }
+
+  return names;
+}
+
+static void
+free_names (GPtrArray *names)
+{
+  for (guint i = 0; i < names->len; i++)
+    g_free (g_ptr_array_index (names, i));
+  g_ptr_array_free (names, TRUE);
+}
+
+static void
+get_package_infos (GPtrArray *names)
+{
+  double all_start = now_ms ();
+
+  for (guint i = 0; i < names->len; i++)
+    {
+      double start = now_ms ();
+      request.reset ();
+      request.encode_string ((const char *) g_ptr_array_index (names, i));
+      request.encode_int (0);
+      call (APTCMD_GET_PACKAGE_INFO);
+      record (FLOW_GET_PACKAGE_INFO, start);
+    }
+  record (FLOW_GET_PACKAGE_INFO_ALL, all_start);
+
+  all_start = now_ms ();
+  for (guint i = 0; i < names->len; i += INFOS_BATCH_SIZE)
+    {
+      request.reset ();
+      request.encode_int (0);
+      for (guint j = i; j < names->len && j < i + INFOS_BATCH_SIZE; j++)
+	request.encode_string ((const char *) g_ptr_array_index (names, j));
+      request.encode_string (NULL);
+      call (APTCMD_GET_PACKAGE_INFOS);
+    }
+  record (FLOW_GET_PACKAGE_INFOS_ALL, all_start);
+}
+
+static void
+install_check (const char *name)
+{
+  double start = now_ms ();
+
+  request.reset ();
+  request.encode_string (name);
+  call (APTCMD_INSTALL_CHECK);
+  record (FLOW_INSTALL_CHECK, start);
+}
+
+static void
+check_updates ()
+{
+  double start = now_ms ();
+
+  request.reset ();
+  call (APTCMD_CHECK_UPDATES);
+
+  /* The cache is reconstructed after the response has been sent, and
+     the next command has to wait for that.
+  */
+  request.reset ();
+  call (APTCMD_NOOP);
+  record (FLOW_CHECK_UPDATES, start);
+}
+
+static void
+run_round (int n_packages)
+{
+  GPtrArray *names = get_package_list (FLOW_GET_PACKAGE_LIST, NULL);
+  get_package_infos (names);
+  free_names (names);
+
+  names = get_package_list (FLOW_SEARCH, "Package 1");
+  free_names (names);
+
+  char *last = g_strdup_printf ("bench-pkg-%05d", n_packages - 1);
+  install_check (last);
+  g_free (last);
+
+  check_updates ();
+}
+
+/** REPORT
+ */
+
+static void
+print_worker_stats (xexp *stats)
+{
+  bool first = true;
+
+  printf ("  \"worker_stats\": {");
+  for (xexp *c = stats ? xexp_first (stats) : NULL; c; c = xexp_rest (c))
+    {
+      /* The "memory" and "cache" lists have no name.
+       */
+      const char *name = xexp_aref_text (c, "name");
+      printf ("%s\n    \"%s\": {", first ? "" : ",",
+	      name ? name : xexp_tag (c));
+      first = false;
+
+      bool first_field = true;
+      for (xexp *f = xexp_first (c); f; f = xexp_rest (f))
+	{
+	  if (xexp_is (f, "name"))
+	    continue;
+	  printf ("%s \"%s\": ", first_field ? "" : ",", xexp_tag (f));
+	  first_field = false;
+	  if (xexp_is_list (f) && !xexp_is_empty (f))
+	    {
+	      printf ("[");
+	      for (xexp *b = xexp_first (f); b; b = xexp_rest (b))
+		printf ("%s%s", b == xexp_first (f) ? "" : ", ",
+			xexp_text (b));
+	      printf ("]");
+	    }
+	  else
+	    printf ("%s", xexp_text (f));
+	}
+      printf (" }");
+    }
+  printf ("\n  }\n");
+}
+
+static void
+print_report (int n_packages, int rounds, xexp *stats)
+{
+  printf ("{\n");
+  printf ("  \"packages\": %d,\n", n_packages);
+  printf ("  \"rounds\": %d,\n", rounds);
+  printf ("  \"flows\": {");
+
+  for (int f = 0; f < N_FLOWS; f++)
+    {
+      GArray *s = flows[f].samples;
+      double sum = 0;
+
+      g_array_sort (s, compare_doubles);
+      for (guint i = 0; i < s->len; i++)
+	sum += g_array_index (s, double, i);
+
+      printf ("%s\n    \"%s\": { \"count\": %u", f ? "," : "",
+	      flows[f].name, s->len);
+      if (s->len > 0)
+	printf (", \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f,"
+		" \"p99_ms\": %.3f, \"max_ms\": %.3f",
+		sum / s->len, percentile (s, 0.5), percentile (s, 0.9),
+		percentile (s, 0.99), g_array_index (s, double, s->len - 1));
+      printf (" }");
+    }
+  printf ("\n  },\n");
+
+  print_worker_stats (stats);
+  printf ("}\n");
+}
+
+static void
+usage ()
+{
+  fprintf (stderr,
+	   "usage: apt-worker-bench [-n PACKAGES] [-r ROUNDS] [-s SEED]\n"
+	   "                        [-w APT-WORKER] [-k]\n");
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_packages = DEFAULT_PACKAGES;
+  int rounds = DEFAULT_ROUNDS;
+  guint32 seed = DEFAULT_SEED;
+  const char *worker = DEFAULT_WORKER;
+  bool keep = false;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "n:r:s:w:k")) != -1)
+    {
+      switch (opt)
+	{
+	case 'n':
+	  n_packages = atoi (optarg);
+	  break;
+	case 'r':
+	  rounds = atoi (optarg);
+	  break;
+	case 's':
+	  seed = strtoul (optarg, NULL, 10);
+	  break;
+	case 'w':
+	  worker = optarg;
+	  break;
+	case 'k':
+	  keep = true;
+	  break;
+	default:
+	  usage ();
+	}
+    }
+
+  if (optind != argc
+      || n_packages < MIN_PACKAGES || n_packages > MAX_PACKAGES
+      || rounds < 1)
+    usage ();
+
+  signal (SIGPIPE, SIG_IGN);
+
+  for (int f = 0; f < N_FLOWS; f++)
+    flows[f].samples = g_array_new (FALSE, FALSE, sizeof (double));
+
+  make_root (n_packages, seed);
+
+  /* apt-worker builds the cache before it handles the first request.
+   */
+  double start = now_ms ();
+  start_worker (worker);
+  request.reset ();
+  call (APTCMD_NOOP);
+  record (FLOW_STARTUP, start);
+
+  for (int r = 0; r < rounds; r++)
+    run_round (n_packages);
+
+  request.reset ();
+  call (APTCMD_GET_STATS);
+  xexp *stats = response.decode_xexp ();
+
+  stop_worker ();
+
+  print_report (n_packages, rounds, stats);
+  xexp_free (stats);
+
+  if (keep)
+    fprintf (stderr, "apt-worker-bench: root kept in %s\n", root);
+  else
+    remove_root ();
+
+  return 0;
+}
@@ -40,6 +40,7 @@
 #include "settings.h"
 #include "apt-worker-client.h"
 #include "apt-worker-proto.h"
+#include "trace.h"
 
 #define _(x) gettext (x)
 
@@ -232,6 +233,69 @@ set_apt_worker_cmd (const char *cmd)
   apt_worker_cmd = g_strdup (cmd);
 }
 
+/* Talk to the apt-worker daemon, starting it when it isn't running
+   yet.  The daemon keeps its cache when we exit, and the status bar
+   uses it for its update checks, too.  See "DAEMON MODE" in
+   apt-worker.cc.
+*/
+static bool
+start_apt_worker_daemon (const char *sudo, const char *prog,
+			 const char *options)
+{
+  int fds[APT_FD_MAX];
+
+  if (!apt_proto_connect_daemon (APT_WORKER_SOCKET, options, fds))
+    {
+      /* A daemon of another version is running, or it is stuck.  A
+	 backend will terminate it.
+      */
+      if (errno == EPROTO || errno == ETIMEDOUT)
+	{
+	  add_log ("can't use apt-worker daemon: %s\n", strerror (errno));
+	  return false;
+	}
+
+      /* This returns when the daemon is ready to be connected to.
+       */
+      const char *args[] = {
+	sudo, prog, "daemon", APT_WORKER_SOCKET, options, NULL
+      };
+      GError *error = NULL;
+      int status;
+
+      if (!g_spawn_sync (NULL, (gchar **)args, NULL,
+			 GSpawnFlags (G_SPAWN_STDOUT_TO_DEV_NULL
+				      | G_SPAWN_STDERR_TO_DEV_NULL),
+			 NULL, NULL, NULL, NULL, &status, &error))
+	{
+	  add_log ("can't spawn %s: %s\n", prog, error->message);
+	  g_error_free (error);
+	  return false;
+	}
+
+      if (status != 0
+	  || !apt_proto_connect_daemon (APT_WORKER_SOCKET, options, fds))
+	return false;
+    }
+
+  apt_worker_out_fd = fds[APT_FD_INPUT];
+  apt_worker_in_fd = fds[APT_FD_OUTPUT];
+  apt_worker_status_fd = fds[APT_FD_STATUS];
+  apt_worker_cancel_fd = fds[APT_FD_CANCEL];
+
+  log_from_fd (fds[APT_FD_LOG]);
+  setup_pmstatus_from_fd (apt_worker_status_fd);
+  add_apt_worker_handler ();
+
+  /* There are no fifos to open, so we can send requests right away.
+     The daemon reads them when it is ready.
+  */
+  apt_worker_started = TRUE;
+  apt_worker_ready = TRUE;
+
+  return true;
+}
+
 static bool
 start_apt_worker (void)
 {
@@ -240,15 +304,6 @@ start_apt_worker (void)
   const char *sudo = NULL;
   const char *prog = NULL;
 
-  // XXX - be more careful with the /tmp files by putting them in a
-  //       temporary directory, maybe.
-
-  if (!must_mkfifo ("/tmp/apt-worker.to", 0600)
-      || !must_mkfifo ("/tmp/apt-worker.from", 0600)
-      || !must_mkfifo ("/tmp/apt-worker.status", 0600)
-      || !must_mkfifo ("/tmp/apt-worker.cancel", 0600))
-    return false;
-
   if (!running_in_scratchbox ())
     sudo = "/usr/bin/sudo";
   else
@@ -258,6 +313,23 @@ start_apt_worker (void)
 
   const char *options = backend_options ();
 
+  /* A apt-worker given on the command line is always started as a
+     backend of its own, and fakeroot can't give a daemon the
+     privileges it needs.  Otherwise, the backend is only a fallback.
+  */
+  if (apt_worker_cmd == NULL && !running_in_scratchbox ()
+      && start_apt_worker_daemon (sudo, prog, options))
+    return true;
+
+  // XXX - be more careful with the /tmp files by putting them in a
+  //       temporary directory, maybe.
+
+  if (!must_mkfifo ("/tmp/apt-worker.to", 0600)
+      || !must_mkfifo ("/tmp/apt-worker.from", 0600)
+      || !must_mkfifo ("/tmp/apt-worker.status", 0600)
+      || !must_mkfifo ("/tmp/apt-worker.cancel", 0600))
+    return false;
+
   const char *args[] = {
     sudo, prog, "backend",
     "/tmp/apt-worker.to", "/tmp/apt-worker.from",
@@ -480,6 +552,12 @@ get_next_pending_worker_call ()
 static void
 cancel_worker_call (worker_call *c)
 {
+  const char *name = apt_proto_command_name (c->cmd);
+
+  if (c == active_call)
+    trace_end ("apt-worker", "in worker", GINT_TO_POINTER (c->seq));
+  trace_end ("apt-worker", name, GINT_TO_POINTER (c->seq), "cancelled");
+
   if (c->done_callback)
     c->done_callback (c->cmd, NULL, c->done_data);
 
@@ -509,6 +587,7 @@ maybe_send_one_worker_call ()
           g_free (c->data);
           c->data = NULL;
           active_call = c;
+          trace_begin ("apt-worker", "in worker", GINT_TO_POINTER (c->seq));
         }
     }
 }
@@ -539,6 +618,9 @@ call_apt_worker (int cmd, char *data, int len,
   c->done_callback = done_callback;
   c->done_data = done_data;
 
+  trace_begin ("apt-worker", apt_proto_command_name (cmd),
+	       GINT_TO_POINTER (c->seq));
+
   /* XXX - If we can send the request immediately, we don't need to
            copy DATA.
   */
@@ -631,7 +713,17 @@ handle_one_apt_worker_response ()
   running = true;
   worker_call *c = active_call;
   active_call = NULL;
+
+  /* The time spent in the callback is part of the request, since
+     the next one can't be sent before it returns.
+  */
+  const char *name = apt_proto_command_name (c->cmd);
+  trace_end ("apt-worker", "in worker", GINT_TO_POINTER (c->seq));
+  trace_enter (name);
   c->done_callback (res.cmd, &dec, c->done_data);
+  trace_leave (name);
+  trace_end ("apt-worker", name, GINT_TO_POINTER (c->seq));
+
   delete c;
   running = false;
 
@@ -754,6 +846,21 @@ apt_worker_get_package_info (const char *package,
                    callback, data);
 }
 
+void
+apt_worker_get_package_infos (const char **packages,
+			      bool only_installable_info,
+			      apt_worker_callback *callback, void *data)
+{
+  request.reset ();
+  request.encode_int (only_installable_info);
+  for (int i = 0; packages[i]; i++)
+    request.encode_string (packages[i]);
+  request.encode_string (NULL);
+  call_apt_worker (APTCMD_GET_PACKAGE_INFOS, 
+                   request.get_buf (), request.get_len (),
+                   callback, data);
+}
+
 void
 apt_worker_get_package_details (const char *package,
 				const char *version,
@@ -996,6 +1103,17 @@ apt_worker_autoremove (apt_worker_callback *callback,
                    callback, data);
 }
 
+void
+apt_worker_get_stats (apt_worker_callback *callback,
+                      void *data)
+{
+  request.reset ();
+
+  call_apt_worker (APTCMD_GET_STATS,
+                   request.get_buf (), request.get_len (),
+                   callback, data);
+}
+
 static void exit_apt_worker_callback(int cmd, apt_proto_decoder *dec, void *data)
 {
 }
@@ -93,6 +93,13 @@ void apt_worker_get_package_info (const char *package,
 				  apt_worker_callback *callback,
 				  void *data);
 
+/* PACKAGES is a NULL terminated array of package names.
+ */
+void apt_worker_get_package_infos (const char **packages,
+				   bool only_installable_info,
+				   apt_worker_callback *callback,
+				   void *data);
+
 void apt_worker_get_package_details (const char *package,
 				     const char *version,
 				     int summary_kind,
@@ -158,6 +165,9 @@ void apt_worker_third_party_policy_check (const char *package,
 void apt_worker_autoremove (apt_worker_callback *callback,
                             void *data);
 
+void apt_worker_get_stats (apt_worker_callback *callback,
+                           void *data);
+
 void exit_apt_worker ();
 
 #endif /* !APT_WORKER_CLIENT_H */
@@ -24,6 +24,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 
 #include <glib.h>
 
@@ -47,6 +53,39 @@ apt_proto_encoder::reset ()
   len = 0;
 }
 
+static int
+roundup (int val, int factor)
+{
+  return ((val + factor - 1) / factor) * factor;
+}
+
+/* Give back the memory that is not needed for the current contents.
+ */
+void
+apt_proto_encoder::compact ()
+{
+  int new_len = roundup (len, 4096);
+
+  if (new_len >= buf_len)
+    return;
+
+  if (new_len == 0)
+    {
+      free (buf);
+      buf = NULL;
+      buf_len = 0;
+    }
+  else
+    {
+      char *new_buf = (char *)realloc (buf, new_len);
+      if (new_buf)
+	{
+	  buf = new_buf;
+	  buf_len = new_len;
+	}
+    }
+}
+
 char *
 apt_proto_encoder::get_buf ()
 {
@@ -59,12 +98,6 @@ apt_proto_encoder::get_len ()
   return len;
 }
 
-static int
-roundup (int val, int factor)
-{
-  return ((val + factor - 1) / factor) * factor;
-}
-
 void
 apt_proto_encoder::grow (int delta)
 {
@@ -271,7 +304,7 @@ apt_proto_decoder::decode_string_dup ()
 }
 
 xexp *
-apt_proto_decoder::decode_xexp ()
+apt_proto_decoder::decode_xexp_1 (xexp_pool *pool)
 {
   const char *tag;
   int len;
@@ -282,15 +315,244 @@ apt_proto_decoder::decode_xexp ()
   len = decode_int ();
   if (len >= 0)
     {
-      xexp *x = xexp_list_new (tag);
+      xexp *x = xexp_pool_list_new (pool, tag);
       while (!corrupted () && len > 0)
 	{
-	  xexp_cons (x, decode_xexp ());
+	  xexp *y = decode_xexp_1 (pool);
+	  if (y)
+	    xexp_append_1 (x, y);
 	  len--;
 	}
-      xexp_reverse (x);
       return x;
     }
   else
-    return xexp_text_new (tag, decode_string_in_place ());
+    return xexp_pool_text_new (pool, tag, decode_string_in_place ());
+}
+
+xexp *
+apt_proto_decoder::decode_xexp ()
+{
+  /* The whole xexp is allocated from one pool.
+   */
+  xexp_pool *pool = xexp_pool_new ();
+  xexp *x = decode_xexp_1 (pool);
+  xexp_pool_unref (pool);
+  return x;
+}
+
+static const char *command_names[] = {
+  "NOOP",
+  "STATUS",
+  "GET_PACKAGE_LIST",
+  "GET_PACKAGE_INFO",
+  "GET_PACKAGE_DETAILS",
+  "CHECK_UPDATES",
+  "GET_CATALOGUES",
+  "SET_CATALOGUES",
+  "ADD_TEMP_CATALOGUES",
+  "RM_TEMP_CATALOGUES",
+  "GET_FREE_SPACE",
+  "INSTALL_CHECK",
+  "DOWNLOAD_PACKAGE",
+  "INSTALL_PACKAGE",
+  "REMOVE_CHECK",
+  "REMOVE_PACKAGE",
+  "GET_FILE_DETAILS",
+  "INSTALL_FILE",
+  "CLEAN",
+  "SAVE_BACKUP_DATA",
+  "GET_SYSTEM_UPDATE_PACKAGES",
+  "REBOOT",
+  "SET_OPTIONS",
+  "SET_ENV",
+  "THIRD_PARTY_POLICY_CHECK",
+  "AUTOREMOVE",
+  "GET_STATS",
+  "GET_PACKAGE_INFOS",
+  "EXIT"
+};
+
+const char *
+apt_proto_command_name (int cmd)
+{
+  if (cmd < 0 || cmd >= APTCMD_MAX)
+    return "UNKNOWN";
+  return command_names[cmd];
+}
+
+bool
+apt_proto_send_fds (int sock, const int *fds, const char *options)
+{
+  struct msghdr msg;
+  struct iovec iov[2];
+  char control[CMSG_SPACE (APT_FD_MAX * sizeof (int))];
+  int version = APT_PROTO_VERSION;
+
+  /* The options are sent with their terminating nul.
+   */
+  iov[0].iov_base = &version;
+  iov[0].iov_len = sizeof (version);
+  iov[1].iov_base = (void *) options;
+  iov[1].iov_len = strlen (options) + 1;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof (control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (APT_FD_MAX * sizeof (int));
+  memcpy (CMSG_DATA (cmsg), fds, APT_FD_MAX * sizeof (int));
+
+  return (sendmsg (sock, &msg, 0)
+	  == (ssize_t) (iov[0].iov_len + iov[1].iov_len));
+}
+
+bool
+apt_proto_receive_fds (int sock, int *fds, int *version,
+		       char *options, int options_len)
+{
+  struct msghdr msg;
+  struct iovec iov[2];
+  char control[CMSG_SPACE (APT_FD_MAX * sizeof (int))];
+  ssize_t n;
+  bool got_fds = false;
+
+  iov[0].iov_base = version;
+  iov[0].iov_len = sizeof (*version);
+  iov[1].iov_base = options;
+  iov[1].iov_len = options_len - 1;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof (control);
+
+  n = recvmsg (sock, &msg, 0);
+  if (n < 0)
+    return false;
+
+  /* Older clients send only the options.
+   */
+  if (n < (ssize_t) sizeof (*version))
+    n = sizeof (*version);
+  options[n - sizeof (*version)] = '\0';
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+       cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	continue;
+
+      int n_fds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+      int *received = (int *) CMSG_DATA (cmsg);
+
+      if (n_fds == APT_FD_MAX && !got_fds)
+	{
+	  memcpy (fds, received, APT_FD_MAX * sizeof (int));
+	  got_fds = true;
+	}
+      else
+	{
+	  for (int i = 0; i < n_fds; i++)
+	    close (received[i]);
+	}
+    }
+
+  if (got_fds && (n <= (ssize_t) sizeof (*version)
+		  || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))))
+    {
+      for (int i = 0; i < APT_FD_MAX; i++)
+	close (fds[i]);
+      got_fds = false;
+    }
+
+  if (!got_fds)
+    errno = EPROTO;
+  return got_fds;
+}
+
+bool
+apt_proto_connect_daemon (const char *socket_name, const char *options,
+			  int *fds)
+{
+  struct sockaddr_un addr;
+  int sock, pipes[APT_FD_MAX][2], far[APT_FD_MAX];
+  int i, n_pipes = 0, saved_errno;
+  bool success = false;
+
+  if (strlen (socket_name) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+
+  sock = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    return false;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_name);
+
+  if (connect (sock, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    goto out;
+
+  for (n_pipes = 0; n_pipes < APT_FD_MAX; n_pipes++)
+    if (pipe (pipes[n_pipes]) < 0)
+      goto out;
+
+  /* The daemon reads requests and cancel bytes and writes everything
+     else.
+  */
+  for (i = 0; i < APT_FD_MAX; i++)
+    {
+      bool daemon_reads = (i == APT_FD_INPUT || i == APT_FD_CANCEL);
+      far[i] = pipes[i][daemon_reads ? 0 : 1];
+      fds[i] = pipes[i][daemon_reads ? 1 : 0];
+    }
+
+  success = apt_proto_send_fds (sock, far, options);
+
+  if (success)
+    {
+      /* Wait for the daemon to tell us its version.  Older daemons
+	 just close the socket.
+      */
+      struct pollfd pfd = { sock, POLLIN, 0 };
+      int version = 0;
+
+      success = false;
+      int res = poll (&pfd, 1, APT_PROTO_HANDSHAKE_TIMEOUT);
+      if (res == 0)
+	errno = ETIMEDOUT;
+      else if (res > 0)
+	{
+	  if (read (sock, &version, sizeof (version)) == sizeof (version)
+	      && version == APT_PROTO_VERSION)
+	    success = true;
+	  else
+	    errno = EPROTO;
+	}
+    }
+
+ out:
+  saved_errno = errno;
+  for (i = 0; i < n_pipes; i++)
+    {
+      if (success)
+	close (far[i]);
+      else
+	{
+	  close (pipes[i][0]);
+	  close (pipes[i][1]);
+	}
+    }
+  close (sock);
+  errno = saved_errno;
+  return success;
 }
@@ -70,11 +70,78 @@ enum apt_command {
 
   APTCMD_AUTOREMOVE,
 
+  APTCMD_GET_STATS,
+
+  APTCMD_GET_PACKAGE_INFOS,
+
   APTCMD_EXIT,
 
   APTCMD_MAX
 };
 
+/* Return the name of CMD without the APTCMD_ prefix, for logging.
+ */
+const char *apt_proto_command_name (int cmd);
+
+/* Instead of being started over fifos as a "backend", apt-worker can
+   also run as a "daemon" that serves several clients at the same time.
+   A client connects to the local socket APT_WORKER_SOCKET and passes
+   the file descriptors of its end of the conversation, in the order
+   given by apt_proto_client_fd, together with the options that would
+   otherwise be given on the command line of the backend.  After that,
+   the conversation proceeds exactly as with the fifos, and the socket
+   is no longer used.
+
+   The client also sends APT_PROTO_VERSION, and the daemon answers
+   with its own before closing the socket.  When they differ, the
+   daemon doesn't take the client, and the client should use a
+   backend instead.  APT_PROTO_VERSION must be increased whenever the
+   requests or responses change incompatibly, such as when the
+   numbers of the commands change.
+*/
+
+#define APT_WORKER_SOCKET "/var/run/apt-worker.socket"
+
+#define APT_PROTO_VERSION 2
+
+/* How long a client waits for the answer of a daemon, in
+   milliseconds.  The daemon might be busy rebuilding its cache.
+*/
+#define APT_PROTO_HANDSHAKE_TIMEOUT 30000
+
+enum apt_proto_client_fd {
+  APT_FD_INPUT,      // requests, read by apt-worker
+  APT_FD_OUTPUT,     // responses, written by apt-worker
+  APT_FD_STATUS,     // "pmstatus:" lines, written by apt-worker
+  APT_FD_CANCEL,     // cancel bytes, read by apt-worker
+  APT_FD_LOG,        // stdout and stderr of apt-worker and dpkg
+  APT_FD_MAX
+};
+
+/* Send APT_PROTO_VERSION, the APT_FD_MAX file descriptors FDS and
+   the string OPTIONS over the connected local socket SOCK.  Return
+   false on error, with errno set.
+*/
+bool apt_proto_send_fds (int sock, const int *fds, const char *options);
+
+/* Receive what apt_proto_send_fds has sent.  VERSION is set to the
+   APT_PROTO_VERSION of the sender.  OPTIONS must have room for
+   OPTIONS_LEN bytes and will be nul-terminated.  Return false on
+   error, in which case no file descriptors remain open.
+*/
+bool apt_proto_receive_fds (int sock, int *fds, int *version,
+			    char *options, int options_len);
+
+/* Connect to the daemon listening on SOCKET_NAME and pass it the far
+   ends of a new set of pipes.  On success, FDS contains our ends:
+   requests are written to FDS[APT_FD_INPUT] and cancel bytes to
+   FDS[APT_FD_CANCEL], the others are for reading.  Return false with
+   errno set when there is no daemon or it can't be reached, and with
+   errno set to EPROTO when it speaks a different APT_PROTO_VERSION.
+*/
+bool apt_proto_connect_daemon (const char *socket_name,
+			       const char *options, int *fds);
+
 struct apt_request_header {
   int cmd;
   int seq;
@@ -109,6 +176,7 @@ struct apt_proto_encoder {
   ~apt_proto_encoder ();
   
   void reset ();
+  void compact ();
 
   void encode_mem (const void *, int);
   void encode_int (int);
@@ -151,6 +219,8 @@ private:
   const char *buf, *ptr;
   int len;
   bool corrupted_flag, at_end_flag;
+
+  xexp *decode_xexp_1 (xexp_pool *pool);
 };
 
 // NOOP - do nothing, no parameters, no results
@@ -513,4 +583,28 @@ enum third_party_policy_status {
   third_party_incompatible
 };
 
+// GET_STATS - report how the commands handled so far have performed.
+//
+// Parameters: none.
+//
+// Response:
+//
+// - stats (xexp).  A "stats" list with one "command" list for every
+//   command that has been handled at least once.  Each of them has
+//   the following texts: "name", "count", "wall-usec",
+//   "wall-max-usec", "cpu-usec", "cache-usec", "record-lookups" and
+//   "bytes-encoded".  The "latency" list has one "bucket" text per
+//   power of two; bucket N counts the commands that took less than
+//   2^N milliseconds, and the last bucket counts all slower ones.
+//
+//   The "stats" list also has a "memory" list with the text
+//   "peak-rss-kb", the largest resident set size of apt-worker so
+//   far.
+//
+//   Once the package cache has been built, the "stats" list has
+//   a "cache" list with the texts "size-chosen", the size in bytes
+//   of the memory map for the last build, "size-used", how much of
+//   it was used, and "size-retries", how often a build had to be
+//   repeated because the map was too small.
+
 #endif /* !APT_WORKER_PROTO_H */
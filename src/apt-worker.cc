@@ -57,7 +57,13 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <sys/fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <malloc.h>
 #include <errno.h>
 #include <dirent.h>
 #include <signal.h>
@@ -160,6 +166,22 @@ static xexp *read_operation_record ();
  */
 #define RESCUE_RESULT_FILE "/var/lib/hildon-application-manager/rescue-result"
 
+/* Where the command statistics are written when apt-worker exits
+ */
+#define STATS_FILE "/var/lib/hildon-application-manager/apt-worker-stats"
+
+/* After this many seconds without a request, apt-worker gives back
+   the memory that it can easily get again, see cache_shrink.
+*/
+#define IDLE_SHRINK_SECONDS 120
+
+/* The memory map for the package cache, see cache_size_estimate.
+   The size is rounded up to CACHE_SIZE_GROW.
+*/
+#define CACHE_SIZE_DEFAULT ( 4 * 1024 * 1024)
+#define CACHE_SIZE_GROW    ( 1 * 1024 * 1024)
+#define CACHE_SIZE_MAX     (32 * 1024 * 1024)
+
 
 /* You know what this means.
  */
@@ -190,6 +212,27 @@ bool flag_allow_wrong_domains = false;
 */
 bool flag_use_apt_algorithms = false;
 
+/* Setting this to true lets apt-worker run against a private APT
+   configuration, given with APT_CONFIG, without disturbing the
+   Application Manager of the system: the apt-worker lock is not
+   taken and the state files of the Application Manager are left
+   alone.  This is used by apt-worker-bench and can only be requested
+   with the 'S' option when starting the backend, see set_sandbox.
+*/
+bool flag_sandbox = false;
+
+/* This is true when running as "apt-worker daemon", see DAEMON MODE.
+ */
+bool flag_daemon = false;
+
+/* This is true in a writer of the daemon.
+ */
+bool flag_daemon_writer = false;
+
+/* This is set in a writer when it has downloaded new package lists.
+ */
+bool daemon_lists_downloaded = false;
+
 /* Setting this to false will not use MMC to save the packages when
    downloading them.
 */
@@ -426,25 +469,371 @@ public:
   virtual pkgCache::VerIterator GetCandidateVer(pkgCache::PkgIterator Pkg);
 };
 
+/* myDepCache can take a snapshot of the complete 'desired' state of
+   the dependency cache and restore it later with a bulk copy.  This
+   is much cheaper than calling MarkKeep for every package, which is
+   what we would otherwise have to do after each simulated operation.
+*/
+class myDepCache : public pkgDepCache {
+
+public:
+  myDepCache (pkgCache *Cache, Policy *Plcy)
+    : pkgDepCache (Cache, Plcy), saved_pkg_state (NULL), saved_dep_state (NULL),
+      reached (NULL)
+  {
+  }
+
+  ~myDepCache ()
+  {
+    forget_state ();
+  }
+
+  void save_state ();
+  bool restore_state ();
+  void forget_state ();
+
+  /* A delta lists the packages and dependencies whose state differs
+     from the saved state.  Applying it after restore_state brings
+     the cache back to the state it had when the delta was taken.
+  */
+  struct pkg_state_entry {
+    unsigned long id;
+    StateCache state;
+  };
+
+  struct dep_state_entry {
+    unsigned long id;
+    unsigned char state;
+  };
+
+  struct delta {
+    GArray *pkgs;
+    GArray *deps;
+    double usr_size;
+    double download_size;
+    unsigned long inst_count;
+    unsigned long del_count;
+    unsigned long keep_count;
+    unsigned long broken_count;
+    unsigned long bad_count;
+  };
+
+  /* DIFF_STATE returns NULL when there is no saved state to compare
+     with.  When CHANGED is not NULL, it holds the packages (as
+     indices into pkgCache::PkgP) whose marks have been changed since
+     the state was saved, and only the packages and dependencies that
+     libapt-pkg updates after such a change are compared.  Otherwise,
+     all of them are.
+  */
+  delta *diff_state (GArray *changed);
+  void apply_delta (delta *d);
+  static void free_delta (delta *d);
+
+private:
+  void reach (GArray *pkgs, const pkgCache::PkgIterator &pkg);
+  void reach_rev_depends (GArray *pkgs, const pkgCache::PkgIterator &pkg);
+
+  StateCache *saved_pkg_state;
+  unsigned char *saved_dep_state;
+  unsigned char *reached;
+  double saved_usr_size;
+  double saved_download_size;
+  unsigned long saved_inst_count;
+  unsigned long saved_del_count;
+  unsigned long saved_keep_count;
+  unsigned long saved_broken_count;
+  unsigned long saved_bad_count;
+};
+
+void
+myDepCache::save_state ()
+{
+  unsigned long pkg_count = Head().PackageCount;
+  unsigned long dep_count = Head().DependsCount;
+
+  if (saved_pkg_state == NULL)
+    {
+      saved_pkg_state = new StateCache[pkg_count];
+      saved_dep_state = new unsigned char[dep_count];
+      reached = new unsigned char[pkg_count];
+      memset (reached, 0, pkg_count);
+    }
+
+  memcpy (saved_pkg_state, PkgState, pkg_count * sizeof (StateCache));
+  memcpy (saved_dep_state, DepState, dep_count * sizeof (unsigned char));
+
+  saved_usr_size = iUsrSize;
+  saved_download_size = iDownloadSize;
+  saved_inst_count = iInstCount;
+  saved_del_count = iDelCount;
+  saved_keep_count = iKeepCount;
+  saved_broken_count = iBrokenCount;
+  saved_bad_count = iBadCount;
+}
+
+/* Return false when there is no saved state to restore.
+ */
+bool
+myDepCache::restore_state ()
+{
+  if (saved_pkg_state == NULL)
+    return false;
+
+  memcpy (PkgState, saved_pkg_state,
+	  Head().PackageCount * sizeof (StateCache));
+  memcpy (DepState, saved_dep_state,
+	  Head().DependsCount * sizeof (unsigned char));
+
+  iUsrSize = saved_usr_size;
+  iDownloadSize = saved_download_size;
+  iInstCount = saved_inst_count;
+  iDelCount = saved_del_count;
+  iKeepCount = saved_keep_count;
+  iBrokenCount = saved_broken_count;
+  iBadCount = saved_bad_count;
+
+  return true;
+}
+
+void
+myDepCache::forget_state ()
+{
+  delete[] saved_pkg_state;
+  delete[] saved_dep_state;
+  delete[] reached;
+  saved_pkg_state = NULL;
+  saved_dep_state = NULL;
+  reached = NULL;
+}
+
+void
+myDepCache::reach (GArray *pkgs, const pkgCache::PkgIterator &pkg)
+{
+  if (!reached[pkg->ID])
+    {
+      unsigned long index = pkg.Index ();
+      reached[pkg->ID] = 1;
+      g_array_append_val (pkgs, index);
+    }
+}
+
+void
+myDepCache::reach_rev_depends (GArray *pkgs, const pkgCache::PkgIterator &pkg)
+{
+  for (pkgCache::DepIterator D = pkg.RevDependsList(); D.end() == false; D++)
+    reach (pkgs, D.ParentPkg());
+}
+
+myDepCache::delta *
+myDepCache::diff_state (GArray *changed)
+{
+  if (saved_pkg_state == NULL)
+    return NULL;
+
+  delta *d = new delta;
+  d->pkgs = g_array_new (FALSE, FALSE, sizeof (pkg_state_entry));
+  d->deps = g_array_new (FALSE, FALSE, sizeof (dep_state_entry));
+
+  if (changed)
+    {
+      /* Changing the mark of a package updates the dependencies of
+	 all its versions and the dependencies that refer to it or to
+	 a package that it provides, together with the packages that
+	 have these dependencies.  Thus, we collect the changed
+	 packages and the parents of their reverse dependencies, and
+	 compare them and the dependencies of all their versions.
+      */
+      GArray *pkgs = g_array_new (FALSE, FALSE, sizeof (unsigned long));
+
+      for (guint i = 0; i < changed->len; i++)
+	{
+	  unsigned long index = g_array_index (changed, unsigned long, i);
+	  pkgCache::PkgIterator pkg (*Cache, Cache->PkgP + index);
+	  reach (pkgs, pkg);
+	  reach_rev_depends (pkgs, pkg);
+	  for (pkgCache::VerIterator V = pkg.VersionList(); V.end() == false;
+	       V++)
+	    for (pkgCache::PrvIterator P = V.ProvidesList(); P.end() == false;
+		 P++)
+	      reach_rev_depends (pkgs, P.ParentPkg());
+	}
+
+      for (guint i = 0; i < pkgs->len; i++)
+	{
+	  unsigned long index = g_array_index (pkgs, unsigned long, i);
+	  pkgCache::PkgIterator pkg (*Cache, Cache->PkgP + index);
+	  unsigned long id = pkg->ID;
+	  reached[id] = 0;
+
+	  if (memcmp (&PkgState[id], &saved_pkg_state[id], sizeof (StateCache)))
+	    {
+	      pkg_state_entry e = { id, PkgState[id] };
+	      g_array_append_val (d->pkgs, e);
+	    }
+
+	  for (pkgCache::VerIterator V = pkg.VersionList(); V.end() == false;
+	       V++)
+	    for (pkgCache::DepIterator D = V.DependsList(); D.end() == false;
+		 D++)
+	      if (DepState[D->ID] != saved_dep_state[D->ID])
+		{
+		  dep_state_entry e = { D->ID, DepState[D->ID] };
+		  g_array_append_val (d->deps, e);
+		}
+	}
+
+      g_array_free (pkgs, TRUE);
+    }
+  else
+    {
+      unsigned long pkg_count = Head().PackageCount;
+      for (unsigned long i = 0; i < pkg_count; i++)
+	if (memcmp (&PkgState[i], &saved_pkg_state[i], sizeof (StateCache)))
+	  {
+	    pkg_state_entry e = { i, PkgState[i] };
+	    g_array_append_val (d->pkgs, e);
+	  }
+
+      unsigned long dep_count = Head().DependsCount;
+      for (unsigned long i = 0; i < dep_count; i++)
+	if (DepState[i] != saved_dep_state[i])
+	  {
+	    dep_state_entry e = { i, DepState[i] };
+	    g_array_append_val (d->deps, e);
+	  }
+    }
+
+  d->usr_size = iUsrSize;
+  d->download_size = iDownloadSize;
+  d->inst_count = iInstCount;
+  d->del_count = iDelCount;
+  d->keep_count = iKeepCount;
+  d->broken_count = iBrokenCount;
+  d->bad_count = iBadCount;
+
+  return d;
+}
+
+void
+myDepCache::apply_delta (delta *d)
+{
+  for (guint i = 0; i < d->pkgs->len; i++)
+    {
+      pkg_state_entry &e = g_array_index (d->pkgs, pkg_state_entry, i);
+      PkgState[e.id] = e.state;
+    }
+
+  for (guint i = 0; i < d->deps->len; i++)
+    {
+      dep_state_entry &e = g_array_index (d->deps, dep_state_entry, i);
+      DepState[e.id] = e.state;
+    }
+
+  iUsrSize = d->usr_size;
+  iDownloadSize = d->download_size;
+  iInstCount = d->inst_count;
+  iDelCount = d->del_count;
+  iKeepCount = d->keep_count;
+  iBrokenCount = d->broken_count;
+  iBadCount = d->bad_count;
+}
+
+void
+myDepCache::free_delta (delta *d)
+{
+  if (d)
+    {
+      g_array_free (d->pkgs, TRUE);
+      g_array_free (d->deps, TRUE);
+      delete d;
+    }
+}
+
 class myCacheFile : public pkgCacheFile {
 
 public:
   bool Open (OpProgress &Progress, bool WithLock = true);
+  bool OpenWithoutDepCache (OpProgress &Progress, bool WithLock = true);
+
+  /* CLOSE_DEP_CACHE gives back the memory of the dependency cache and
+     of the checkpoint, but keeps the mapped package cache, the policy
+     and EXTRA_INFO.  OPEN_DEP_CACHE creates the dependency cache
+     again, and CACHE_RESET must be called after it.
+  */
+  bool open_dep_cache (OpProgress &Progress);
+  void close_dep_cache ();
+  bool dep_cache_closed () { return DCache == NULL; }
 
   void load_extra_info ();
   void save_extra_info ();
 
+  /* A checkpoint captures the state of the dependency cache together
+     with EXTRA_INFO.  CACHE_RESET takes one after resetting the cache
+     the hard way and restores it from then on.
+  */
+  void checkpoint ();
+  bool restore_checkpoint ();
+  void forget_checkpoint ();
+
+  /* A cache_delta records how the cache differs from the current
+     checkpoint.  Applying it restores the checkpoint and then
+     replays the differences, which is how we reuse the outcome of an
+     earlier mark_for_install or mark_for_remove.  APPLY_DELTA fails
+     when a different checkpoint has been taken in the meantime.
+  */
+  struct extra_info_entry {
+    unsigned long id;
+    extra_info_struct info;
+  };
+
+  struct cache_delta {
+    int checkpoint_serial;
+    myDepCache::delta *dep_delta;
+    GArray *extra;
+  };
+
+  cache_delta *capture_delta ();
+  bool apply_delta (cache_delta *d);
+  static void free_delta (cache_delta *d);
+
+  /* Since the checkpoint has been taken or restored, the code that
+     marks packages calls TOUCH for every package whose mark or
+     EXTRA_INFO it changes, so that CAPTURE_DELTA only needs to look
+     at those.  TOUCH_ALL is for changes that are not tracked that
+     way, such as the ones made by pkgProblemResolver, and lets
+     CAPTURE_DELTA compare all packages until the next checkpoint.
+  */
+  void touch (const pkgCache::PkgIterator &pkg);
+  void touch_all ();
+
   extra_info_struct *extra_info;
+  extra_info_struct *saved_extra_info;
+  int checkpoint_serial;
 
   myCacheFile ()
   {
     extra_info = NULL;
+    saved_extra_info = NULL;
+    checkpoint_serial = 0;
+    touched = NULL;
+    touched_map = NULL;
   }
 
   ~myCacheFile ()
   {
     delete[] extra_info;
+    delete[] saved_extra_info;
+    delete[] touched_map;
+    if (touched)
+      g_array_free (touched, TRUE);
   }
+
+private:
+  myDepCache *dep_cache () { return (myDepCache *) DCache; }
+  void track_changes ();
+
+  GArray *touched;
+  unsigned char *touched_map;
 };
 
 static void set_sources_for_get_domain (pkgSourceList *sources);
@@ -560,11 +949,128 @@ myPolicy::GetCandidateVer (pkgCache::PkgIterator Pkg)
   return Pref;
 }
 
+/* The package cache is built in a memory map whose size has to be
+   chosen in advance.  Older versions of libapt-pkg allocate all of
+   APT::Cache-Limit (APT::Small-Cache-Limit in ours) at once, newer
+   ones start with APT::Cache-Start and grow up to APT::Cache-Limit.
+
+   We take the size of the cache that has been built last, by this
+   process or as found in pkgcache.bin, and add a quarter for the
+   package lists to grow.  When building the cache fails with that
+   size, it is built again with CACHE_SIZE_MAX.  The sizes are reported
+   with APTCMD_GET_STATS.
+*/
+
+static unsigned long cache_size_chosen;
+static unsigned long cache_size_used;
+static int cache_size_retries;
+
+static unsigned long
+cache_size_estimate ()
+{
+  unsigned long size = cache_size_used;
+
+  if (size == 0)
+    {
+      struct stat buf;
+      string file = _config->FindFile ("Dir::Cache::pkgcache");
+      if (!file.empty () && stat (file.c_str (), &buf) == 0)
+	size = buf.st_size;
+    }
+
+  if (size == 0)
+    return CACHE_SIZE_DEFAULT;
+
+  size += size / 4;
+  size = (size + CACHE_SIZE_GROW - 1) / CACHE_SIZE_GROW * CACHE_SIZE_GROW;
+  return MIN (size, CACHE_SIZE_MAX);
+}
+
+static void
+cache_size_set (unsigned long size)
+{
+  cache_size_chosen = size;
+  _config->Set ("APT::Cache-Start", (int) size);
+  _config->Set ("APT::Cache-Grow", CACHE_SIZE_GROW);
+  _config->Set ("APT::Cache-Limit", (int) size);
+  _config->Set ("APT::Small-Cache-Limit", (int) size);
+}
+
+/* Take the pending errors off _error so that they can be put back
+   later with cache_errors_restore.
+*/
+static GSList *
+cache_errors_save ()
+{
+  GSList *messages = NULL;
+  string text;
+
+  while (!_error->empty ())
+    {
+      bool is_error = _error->PopMessage (text);
+      messages = g_slist_prepend (messages,
+				  g_strdup_printf ("%c%s",
+						   is_error ? 'E' : 'W',
+						   text.c_str ()));
+    }
+
+  return g_slist_reverse (messages);
+}
+
+/* Put MESSAGES back on _error when RESTORE is true, and free them.
+*/
+static void
+cache_errors_restore (GSList *messages, bool restore)
+{
+  for (GSList *m = messages; m; m = m->next)
+    {
+      const char *msg = (const char *) m->data;
+      if (restore)
+	{
+	  if (msg[0] == 'E')
+	    _error->Error ("%s", msg + 1);
+	  else
+	    _error->Warning ("%s", msg + 1);
+	}
+      g_free (m->data);
+    }
+  g_slist_free (messages);
+}
+
+/* Build the package cache, policy and extra info, but no dependency
+   cache.  This is enough to find the candidate versions of packages.
+*/
 bool
-myCacheFile::Open (OpProgress &Progress, bool WithLock)
+myCacheFile::OpenWithoutDepCache (OpProgress &Progress, bool WithLock)
 {
+  cache_size_set (cache_size_estimate ());
   if (BuildCaches(Progress,WithLock) == false)
-    return false;
+    {
+      if (cache_size_chosen >= CACHE_SIZE_MAX)
+	return false;
+
+      /* The message for a full memory map is translated, so we don't
+	 try to recognize it and retry after any failure.  When the
+	 retry fails as well, the original errors are reported.
+	 BuildCaches might have taken the lock before failing.
+       */
+      GSList *errors = cache_errors_save ();
+      if (WithLock)
+	_system->UnLock (true);
+
+      DBG ("cache of %lu bytes failed, retrying", cache_size_chosen);
+      cache_size_retries++;
+      cache_size_set (CACHE_SIZE_MAX);
+      if (BuildCaches(Progress,WithLock) == false)
+	{
+	  _error->Discard ();
+	  cache_errors_restore (errors, true);
+	  return false;
+	}
+      cache_errors_restore (errors, false);
+    }
+
+  cache_size_used = Map->Size ();
   
   // The policy engine
   myPolicy *pol = new myPolicy (Cache, this);
@@ -578,8 +1084,23 @@ myCacheFile::Open (OpProgress &Progress, bool WithLock)
   
   load_extra_info ();
 
+  return true;
+}
+
+bool
+myCacheFile::Open (OpProgress &Progress, bool WithLock)
+{
+  if (OpenWithoutDepCache (Progress, WithLock) == false)
+    return false;
+
+  return open_dep_cache (Progress);
+}
+
+bool
+myCacheFile::open_dep_cache (OpProgress &Progress)
+{
   // Create the dependency cache
-  DCache = new pkgDepCache(Cache,Policy);
+  DCache = new myDepCache(Cache,Policy);
   if (_error->PendingError() == true)
     return false;
   
@@ -591,43 +1112,224 @@ myCacheFile::Open (OpProgress &Progress, bool WithLock)
   return true;
 }
 
-/* Save the 'extra_info' of the cache.  We first make a copy of the
-   Auto flags in our own extra_info storage so that CACHE_RESET
-   will reset the Auto flags to the state last saved with this
-   function.
+void
+myCacheFile::close_dep_cache ()
+{
+  if (DCache == NULL)
+    return;
+
+  forget_checkpoint ();
+  delete DCache;
+  DCache = NULL;
+}
+
+void
+myCacheFile::checkpoint ()
+{
+  static int last_checkpoint_serial = 0;
+  int package_count = Cache->Head().PackageCount;
+
+  checkpoint_serial = ++last_checkpoint_serial;
+
+  if (saved_extra_info == NULL)
+    {
+      saved_extra_info = new extra_info_struct[package_count];
+      touched_map = new unsigned char[package_count];
+      memset (touched_map, 0, package_count);
+    }
+
+  memcpy (saved_extra_info, extra_info,
+	  package_count * sizeof (extra_info_struct));
+  dep_cache ()->save_state ();
+  track_changes ();
+}
+
+bool
+myCacheFile::restore_checkpoint ()
+{
+  if (saved_extra_info == NULL || !dep_cache ()->restore_state ())
+    return false;
+
+  memcpy (extra_info, saved_extra_info,
+	  Cache->Head().PackageCount * sizeof (extra_info_struct));
+  track_changes ();
+  return true;
+}
+
+void
+myCacheFile::forget_checkpoint ()
+{
+  touch_all ();
+  delete[] saved_extra_info;
+  delete[] touched_map;
+  saved_extra_info = NULL;
+  touched_map = NULL;
+  checkpoint_serial = 0;
+  dep_cache ()->forget_state ();
+}
+
+/* Start recording touched packages from scratch.
+ */
+void
+myCacheFile::track_changes ()
+{
+  touch_all ();
+  touched = g_array_new (FALSE, FALSE, sizeof (unsigned long));
+}
+
+/* When a large part of the packages is touched, it is cheaper to
+   compare all of them.
 */
+#define MAX_TOUCHED_FRACTION 8
 
 void
-myCacheFile::save_extra_info ()
+myCacheFile::touch (const pkgCache::PkgIterator &pkg)
 {
-  if (mkdir ("/var/lib/hildon-application-manager", 0777) < 0
-      && errno != EEXIST)
+  if (touched == NULL || touched_map[pkg->ID])
+    return;
+
+  if (touched->len >= Cache->Head().PackageCount / MAX_TOUCHED_FRACTION)
     {
-      log_stderr ("/var/lib/hildon-application-manager: %m");
+      touch_all ();
       return;
     }
 
-  FILE *f = fopen ("/var/lib/hildon-application-manager/autoinst", "w");
-  if (f)
-    {
-      pkgDepCache &cache = *DCache;
+  unsigned long index = pkg.Index ();
+  touched_map[pkg->ID] = 1;
+  g_array_append_val (touched, index);
+}
 
-      for (pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end (); pkg++)
+void
+myCacheFile::touch_all ()
+{
+  if (touched == NULL)
+    return;
+
+  for (guint i = 0; i < touched->len; i++)
+    touched_map[(Cache->PkgP
+		 + g_array_index (touched, unsigned long, i))->ID] = 0;
+  g_array_free (touched, TRUE);
+  touched = NULL;
+}
+
+myCacheFile::cache_delta *
+myCacheFile::capture_delta ()
+{
+  if (saved_extra_info == NULL)
+    return NULL;
+
+  myDepCache::delta *dep_delta = dep_cache ()->diff_state (touched);
+  if (dep_delta == NULL)
+    return NULL;
+
+  cache_delta *d = new cache_delta;
+  d->checkpoint_serial = checkpoint_serial;
+  d->dep_delta = dep_delta;
+  d->extra = g_array_new (FALSE, FALSE, sizeof (extra_info_entry));
+
+  if (touched)
+    {
+      for (guint i = 0; i < touched->len; i++)
 	{
-	  if (cache[pkg].Flags & pkgCache::Flag::Auto)
+	  unsigned long id =
+	    (Cache->PkgP + g_array_index (touched, unsigned long, i))->ID;
+	  if (memcmp (&extra_info[id], &saved_extra_info[id],
+		      sizeof (extra_info_struct)))
 	    {
-	      extra_info[pkg->ID].autoinst = true;
-	      fprintf (f, "%s\n", pkg.Name ());
+	      extra_info_entry e = { id, extra_info[id] };
+	      g_array_append_val (d->extra, e);
 	    }
-	  else
-	    extra_info[pkg->ID].autoinst = false;
 	}
-      fflush (f);
-      fsync (fileno (f));
-      fclose (f);
     }
-
-  for (domain_t i = 0; i < domains_number; i++)
+  else
+    {
+      int package_count = Cache->Head().PackageCount;
+      for (int i = 0; i < package_count; i++)
+	if (memcmp (&extra_info[i], &saved_extra_info[i],
+		    sizeof (extra_info_struct)))
+	  {
+	    extra_info_entry e = { i, extra_info[i] };
+	    g_array_append_val (d->extra, e);
+	  }
+    }
+
+  return d;
+}
+
+bool
+myCacheFile::apply_delta (cache_delta *d)
+{
+  if (d->checkpoint_serial != checkpoint_serial
+      || !restore_checkpoint ())
+    return false;
+
+  dep_cache ()->apply_delta (d->dep_delta);
+
+  for (guint i = 0; i < d->extra->len; i++)
+    {
+      extra_info_entry &e = g_array_index (d->extra, extra_info_entry, i);
+      extra_info[e.id] = e.info;
+    }
+
+  /* The delta doesn't say which packages it touches.
+   */
+  touch_all ();
+  return true;
+}
+
+void
+myCacheFile::free_delta (cache_delta *d)
+{
+  if (d)
+    {
+      myDepCache::free_delta (d->dep_delta);
+      g_array_free (d->extra, TRUE);
+      delete d;
+    }
+}
+
+/* Save the 'extra_info' of the cache.  We first make a copy of the
+   Auto flags in our own extra_info storage so that CACHE_RESET
+   will reset the Auto flags to the state last saved with this
+   function.
+*/
+
+void
+myCacheFile::save_extra_info ()
+{
+  if (mkdir ("/var/lib/hildon-application-manager", 0777) < 0
+      && errno != EEXIST)
+    {
+      log_stderr ("/var/lib/hildon-application-manager: %m");
+      return;
+    }
+
+  /* The Auto flags are about to change, so the state captured by the
+     last checkpoint is no longer what CACHE_RESET should go back to.
+  */
+  forget_checkpoint ();
+
+  FILE *f = fopen ("/var/lib/hildon-application-manager/autoinst", "w");
+  if (f)
+    {
+      pkgDepCache &cache = *DCache;
+
+      for (pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end (); pkg++)
+	{
+	  if (cache[pkg].Flags & pkgCache::Flag::Auto)
+	    {
+	      extra_info[pkg->ID].autoinst = true;
+	      fprintf (f, "%s\n", pkg.Name ());
+	    }
+	  else
+	    extra_info[pkg->ID].autoinst = false;
+	}
+      fflush (f);
+      fsync (fileno (f));
+      fclose (f);
+    }
+
+  for (domain_t i = 0; i < domains_number; i++)
     {
       char *name =
 	g_strdup_printf ("/var/lib/hildon-application-manager/domain.%s",
@@ -876,6 +1578,8 @@ ForceLock (string File, bool Errors = true)
 
 int input_fd, output_fd, status_fd, cancel_fd;
 
+static void daemon_client_failed ();
+
 /* MUST_READ and MUST_WRITE read and write blocks of raw bytes from
    INPUT_FD and to OUTPUT_FD.  If they return, they have succeeded and
    read or written the whole block.
@@ -909,6 +1613,14 @@ must_write (void *buf, ssize_t n)
 {
   if (n > 0 && write (output_fd, buf, n) != n)
     {
+      /* A daemon outlives its clients.
+       */
+      if (flag_daemon)
+	{
+	  daemon_client_failed ();
+	  return;
+	}
+
       perror ("apt-worker write");
       exit (1);
     }
@@ -981,6 +1693,7 @@ apt_proto_encoder response;
 
 void cmd_get_package_list ();
 void cmd_get_package_info ();
+void cmd_get_package_infos ();
 void cmd_get_package_details ();
 int cmd_check_updates (bool with_status = true);
 void cmd_get_catalogues ();
@@ -1003,8 +1716,11 @@ void cmd_set_options ();
 void cmd_set_env ();
 void cmd_third_party_policy_check ();
 void cmd_autoremove ();
+void cmd_get_stats ();
 
 int cmdline_check_updates (char **argv);
+int cmdline_daemon (char **argv);
+int cmdline_prestart (char **argv);
 int cmdline_rescue (char **argv);
 
 /** MANAGEMENT FOR FAILED CATALOGUES LOG FILE
@@ -1051,55 +1767,243 @@ need_cache_init ()
   awc->init_cache_after_request = true;
 }
 
-#ifdef DEBUG_COMMANDS
-static const char *cmd_names[] = {
-  "NOOP",
-  "STATUS",
-  "GET_PACKAGE_LIST",
-  "GET_PACKAGE_INFO",
-  "GET_PACKAGE_DETAILS",
-  "CHECK_UPDATES",
-  "GET_CATALOGUES",
-  "SET_CATALOGUES",
-  "ADD_TEMP_CATALOGUES",
-  "RM_TEMP_CATALOGUES",
-  "GET_FREE_SPACE",
-  "INSTALL_CHECK",
-  "INSTALL_PACKAGE",
-  "REMOVE_CHECK",
-  "REMOVE_PACKAGE",
-  "GET_FILE_DETAILS",
-  "INSTALL_FILE",
-  "CLEAN",
-  "SAVE_BACKUP_DATA",
-  "GET_SYSTEM_UPDATE_PACKAGES",
-  "FLASH_AND_REBOOT",
-  "SET_OPTIONS",
-  "SET_ENV",
-  "THIRD_PARTY_POLICY_CHECK",
-  "AUTOREMOVE"
+/* When no request has come for IDLE_SHRINK_SECONDS, CACHE_SHRINK is
+   called, and CACHE_UNSHRINK before the next request is handled.
+*/
+
+bool cache_shrunk = false;
+
+void cache_shrink ();
+void cache_unshrink ();
+
+/** INSTRUMENTATION
+
+    For every command, we count how often it has been handled, how
+    much wall clock and CPU time it took, how much of that was spent
+    (re-)building the cache, how many package records it looked up,
+    and how big its responses were.  Latencies are also counted in a
+    histogram with one bucket per power of two milliseconds.  We also
+    report how big the process has grown and how big the memory map
+    for the package cache has been made, see cache_size_estimate.
+
+    The numbers can be retrieved with APTCMD_GET_STATS, and are
+    written to STATS_FILE when apt-worker exits.
+*/
+
+#define STATS_BUCKETS 16
+
+struct command_stats {
+  int count;
+  int64_t wall_usec, wall_max_usec;
+  int64_t cpu_usec;
+  int64_t cache_usec;
+  int64_t record_lookups;
+  int64_t bytes_encoded;
+  int latency[STATS_BUCKETS];
 };
-#endif
+
+static command_stats stats[APTCMD_MAX];
+
+/* Running totals, sampled before and after each command.
+ */
+static int64_t stats_cache_usec;
+static int64_t stats_record_lookups;
+
+/* Only the process that has set up the statistics writes them when
+   exiting, not any of its children.
+*/
+static pid_t stats_pid;
+
+struct stats_sample {
+  int64_t wall_usec;
+  int64_t cpu_usec;
+  int64_t cache_usec;
+  int64_t record_lookups;
+};
+
+static int64_t
+timeval_usec (const struct timeval &tv)
+{
+  return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int64_t
+stats_wall_usec ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return timeval_usec (tv);
+}
+
+static int64_t
+stats_cpu_usec ()
+{
+  struct rusage ru;
+  if (getrusage (RUSAGE_SELF, &ru) < 0)
+    return 0;
+  return timeval_usec (ru.ru_utime) + timeval_usec (ru.ru_stime);
+}
+
+/* The kernels we run on don't fill in ru_maxrss, so we ask /proc for
+   the peak resident set size.
+*/
+static long
+stats_peak_rss_kb ()
+{
+  FILE *f = fopen ("/proc/self/status", "r");
+  char line[256];
+  long kb = 0;
+
+  if (f == NULL)
+    return 0;
+
+  while (fgets (line, sizeof (line), f))
+    if (sscanf (line, "VmHWM: %ld", &kb) == 1)
+      break;
+
+  fclose (f);
+  return kb;
+}
+
+static void
+stats_begin (stats_sample *s)
+{
+  s->wall_usec = stats_wall_usec ();
+  s->cpu_usec = stats_cpu_usec ();
+  s->cache_usec = stats_cache_usec;
+  s->record_lookups = stats_record_lookups;
+}
+
+static void
+stats_end (int cmd, stats_sample *s, int bytes_encoded)
+{
+  command_stats *c;
+  int64_t wall;
+  int bucket;
+
+  if (cmd < 0 || cmd >= APTCMD_MAX)
+    return;
+
+  c = &stats[cmd];
+  wall = stats_wall_usec () - s->wall_usec;
+
+  c->count++;
+  c->wall_usec += wall;
+  if (wall > c->wall_max_usec)
+    c->wall_max_usec = wall;
+  c->cpu_usec += stats_cpu_usec () - s->cpu_usec;
+  c->cache_usec += stats_cache_usec - s->cache_usec;
+  c->record_lookups += stats_record_lookups - s->record_lookups;
+  c->bytes_encoded += bytes_encoded;
+
+  for (bucket = 0;
+       bucket < STATS_BUCKETS - 1 && wall >= (1000LL << bucket);
+       bucket++)
+    ;
+  c->latency[bucket]++;
+}
+
+static void
+stats_append_int (xexp *x, const char *tag, int64_t val)
+{
+  char *text = g_strdup_printf ("%lld", (long long) val);
+  xexp_append_1 (x, xexp_text_new (tag, text));
+  g_free (text);
+}
+
+static xexp *
+stats_to_xexp ()
+{
+  xexp *x = xexp_list_new ("stats");
+
+  for (int cmd = 0; cmd < APTCMD_MAX; cmd++)
+    {
+      command_stats *c = &stats[cmd];
+
+      if (c->count == 0)
+	continue;
+
+      xexp *y = xexp_list_new ("command");
+      xexp_append_1 (y, xexp_text_new ("name",
+				       apt_proto_command_name (cmd)));
+      stats_append_int (y, "count", c->count);
+      stats_append_int (y, "wall-usec", c->wall_usec);
+      stats_append_int (y, "wall-max-usec", c->wall_max_usec);
+      stats_append_int (y, "cpu-usec", c->cpu_usec);
+      stats_append_int (y, "cache-usec", c->cache_usec);
+      stats_append_int (y, "record-lookups", c->record_lookups);
+      stats_append_int (y, "bytes-encoded", c->bytes_encoded);
+
+      xexp *latency = xexp_list_new ("latency");
+      for (int i = 0; i < STATS_BUCKETS; i++)
+	stats_append_int (latency, "bucket", c->latency[i]);
+      xexp_append_1 (y, latency);
+
+      xexp_append_1 (x, y);
+    }
+
+  xexp *m = xexp_list_new ("memory");
+  stats_append_int (m, "peak-rss-kb", stats_peak_rss_kb ());
+  xexp_append_1 (x, m);
+
+  if (cache_size_chosen > 0)
+    {
+      xexp *y = xexp_list_new ("cache");
+      stats_append_int (y, "size-chosen", cache_size_chosen);
+      stats_append_int (y, "size-used", cache_size_used);
+      stats_append_int (y, "size-retries", cache_size_retries);
+      xexp_append_1 (x, y);
+    }
+
+  return x;
+}
+
+static void
+stats_dump ()
+{
+  if (getpid () != stats_pid || flag_sandbox)
+    return;
+
+  xexp *x = stats_to_xexp ();
+  xexp_write_file (STATS_FILE, x);
+  xexp_free (x);
+}
+
+static void
+stats_init ()
+{
+  stats_pid = getpid ();
+  atexit (stats_dump);
+}
 
 void
-handle_request ()
+cmd_get_stats ()
+{
+  xexp *x = stats_to_xexp ();
+  response.encode_xexp (x);
+  xexp_free (x);
+}
+
+/* Carry out the request REQ, whose parameters have been read into
+   REQBUF, and send the response.
+*/
+static void
+serve_request (apt_request_header &req, char *reqbuf)
 {
-  apt_request_header req;
-  char stack_reqbuf[FIXED_REQUEST_BUF_SIZE];
-  char *reqbuf;
   AptWorkerCache * awc = 0;
   time_t last_modified = -1;
+  stats_sample sample;
+  int response_len;
 
-  must_read (&req, sizeof (req));
+  stats_begin (&sample);
 
 #ifdef DEBUG_COMMANDS
-  DBG ("got req %s/%d/%d", cmd_names[req.cmd], req.seq, req.len);
+  DBG ("got req %s/%d/%d",
+       apt_proto_command_name (req.cmd), req.seq, req.len);
 #endif
 
-  reqbuf = alloc_buf (req.len, stack_reqbuf, FIXED_REQUEST_BUF_SIZE);
-  must_read (reqbuf, req.len);
-
   drain_fd (cancel_fd);
+  cache_unshrink ();
 
   request.reset (reqbuf, req.len);
   response.reset ();
@@ -1127,6 +2031,10 @@ handle_request ()
       cmd_get_package_info ();
       break;
 
+    case APTCMD_GET_PACKAGE_INFOS:
+      cmd_get_package_infos ();
+      break;
+
     case APTCMD_GET_PACKAGE_DETAILS:
       cmd_get_package_details ();
       break;
@@ -1215,6 +2123,10 @@ handle_request ()
       cmd_autoremove ();
       break;
 
+    case APTCMD_GET_STATS:
+      cmd_get_stats ();
+      break;
+
     case APTCMD_EXIT:
       exit(0);
       break;
@@ -1226,21 +2138,60 @@ handle_request ()
 
   _error->DumpErrors ();
 
+  /* A writer of the daemon leaves the rest to the daemon.
+   */
+  if (flag_daemon_writer)
+    return;
+
   send_response_raw (req.cmd, req.seq,
 		     response.get_buf (), response.get_len ());
+  response_len = response.get_len ();
 
 #ifdef DEBUG_COMMANDS
   DBG ("sent resp %s/%d/%d",
-       cmd_names[req.cmd], req.seq, response.get_len ());
+       apt_proto_command_name (req.cmd), req.seq, response.get_len ());
 #endif
 
-  free_buf (reqbuf, stack_reqbuf);
-
   if (awc->init_cache_after_request)
     {
       cache_init (false);
       _error->DumpErrors ();
     }
+
+  stats_end (req.cmd, &sample, response_len);
+}
+
+/* Wait up to SECONDS for a request.
+ */
+static bool
+wait_for_request (int seconds)
+{
+  fd_set set;
+  struct timeval timeout = { seconds, 0 };
+
+  FD_ZERO (&set);
+  FD_SET (input_fd, &set);
+  return select (input_fd + 1, &set, NULL, NULL, &timeout) != 0;
+}
+
+void
+handle_request ()
+{
+  apt_request_header req;
+  char stack_reqbuf[FIXED_REQUEST_BUF_SIZE];
+  char *reqbuf;
+
+  if (!cache_shrunk && !wait_for_request (IDLE_SHRINK_SECONDS))
+    cache_shrink ();
+
+  must_read (&req, sizeof (req));
+
+  reqbuf = alloc_buf (req.len, stack_reqbuf, FIXED_REQUEST_BUF_SIZE);
+  must_read (reqbuf, req.len);
+
+  serve_request (req, reqbuf);
+
+  free_buf (reqbuf, stack_reqbuf);
 }
 
 static int index_trust_level_for_package (pkgIndexFile *index,
@@ -1252,6 +2203,8 @@ static void
 usage ()
 {
   fprintf (stderr, "Usage: apt-worker check-for-updates [http_proxy]\n");
+  fprintf (stderr, "       apt-worker daemon socket options\n");
+  fprintf (stderr, "       apt-worker prestart\n");
   fprintf (stderr, "       apt-worker rescue [package] [archives]\n");
   exit (1);
 }
@@ -1264,9 +2217,12 @@ usage ()
    Other kinds of failures (out of space, insufficient permissions,
    etc) will terminate this process.
 
-   The lock will be released when this process exits.
+   The lock will be released when this process exits, or when
+   release_apt_worker_lock is called.
 */
 
+static int apt_worker_lock_fd = -1;
+
 static char *
 try_lock (const char *file, const char *my_content)
 {
@@ -1325,7 +2281,8 @@ try_lock (const char *file, const char *my_content)
       log_stderr ("can't write lock %s: %m", file);
       exit (1);
     }
-     
+
+  apt_worker_lock_fd = lock_fd;
   return NULL;
 }
 
@@ -1396,13 +2353,23 @@ get_apt_worker_lock (bool weak)
     }
 }
 
+static void
+release_apt_worker_lock ()
+{
+  if (apt_worker_lock_fd >= 0)
+    {
+      close (apt_worker_lock_fd);
+      apt_worker_lock_fd = -1;
+    }
+}
+
 /* MMC default mountpoints */
 #define INTERNAL_MMC_MOUNTPOINT  "/home/user/MyDocs"
 #define REMOVABLE_MMC_MOUNTPOINT "/media/mmc1"
 #define HOME_MOUNTPOINT  "/home"
 
 static void
-misc_init ()
+misc_init (bool with_cache)
 {
   lc_messages = getenv ("LC_MESSAGES");
   DBG ("LC_MESSAGES %s", lc_messages);
@@ -1414,7 +2381,8 @@ misc_init ()
 
   AptWorkerCache::Initialize ();
 
-  cache_init (false);
+  if (with_cache)
+    cache_init (false);
 
 #ifdef HAVE_APT_TRUST_HOOK
   apt_set_index_trust_level_for_package_hook (index_trust_level_for_package);
@@ -1427,6 +2395,33 @@ misc_init ()
   setenv ("REMOVABLE_MMC_MOUNTPOINT", REMOVABLE_MMC_MOUNTPOINT, 1);
 }
 
+static void forget_cached_plans ();
+static void daemon_set_options (const char *options);
+
+/* The sandbox skips the apt-worker lock, so it is only granted to an
+   unprivileged apt-worker with its own APT_CONFIG.  Sudo drops
+   APT_CONFIG, and otherwise anybody who may run apt-worker through
+   sudo could work on the real system without the lock.  Return false
+   when the sandbox has been requested but is refused.
+*/
+static bool
+set_sandbox (const char *options)
+{
+  flag_sandbox = false;
+
+  if (strchr (options, 'S') == NULL)
+    return true;
+
+  if (geteuid () == 0 || getenv ("APT_CONFIG") == NULL)
+    {
+      log_stderr ("sandbox refused, needs APT_CONFIG and no root");
+      return false;
+    }
+
+  flag_sandbox = true;
+  return true;
+}
+
 void
 set_options (const char *options)
 {
@@ -1441,13 +2436,20 @@ set_options (const char *options)
 
   if (strchr (options, 'A'))
     flag_use_apt_algorithms = true;
+
+  /* The options influence how packages are marked.
+   */
+  forget_cached_plans ();
 }
 
 void
 cmd_set_options ()
 {
   const char *options = request.decode_string_in_place ();
-  set_options (options);
+  if (flag_daemon)
+    daemon_set_options (options);
+  else
+    set_options (options);
 }
 
 void
@@ -1574,6 +2576,8 @@ main (int argc, char **argv)
 	   options);
 
       set_options (options);
+      if (!set_sandbox (options))
+	return 1;
 
       /* Don't let our heavy lifting starve the UI.
        */
@@ -1581,8 +2585,10 @@ main (int argc, char **argv)
       if (nice (20) == -1 && errno != 0)
 	log_stderr ("nice: %m");
 
-      get_apt_worker_lock (false);
-      misc_init ();
+      if (!flag_sandbox)
+	get_apt_worker_lock (false);
+      misc_init (true);
+      stats_init ();
 
       while (true)
 	handle_request ();
@@ -1591,10 +2597,18 @@ main (int argc, char **argv)
     }
   else if (!strcmp (argv[0], "check-for-updates"))
     {
-      get_apt_worker_lock (true);
-      misc_init ();
+      /* cmdline_check_updates takes the lock itself.
+       */
       return cmdline_check_updates (argv);
     }
+  else if (!strcmp (argv[0], "daemon"))
+    {
+      return cmdline_daemon (argv);
+    }
+  else if (!strcmp (argv[0], "prestart"))
+    {
+      return cmdline_prestart (argv);
+    }
   else if (!strcmp (argv[0], "rescue"))
     {
       return cmdline_rescue (argv);
@@ -1659,6 +2673,13 @@ main (int argc, char **argv)
     This function resets the 'desired' state of the cache to be
     identical to the 'current' one.
 
+    - cache_shrink (), cache_unshrink ()
+
+    When apt-worker is idle, cache_shrink gives back the memory of
+    the dependency cache and of the response buffer.  The package
+    cache stays mapped, so cache_unshrink only has to create the
+    dependency cache again, which is much quicker than cache_init.
+
     - mark_for_install ()
 
     This function modifies the 'desired' state of the cache to reflect
@@ -1877,30 +2898,162 @@ void cache_reset ();
 static char *current_cache_package = NULL;
 static bool current_cache_is_install;
 
-static bool
-check_cache_state (const char *package, bool is_install)
-{
-  if (current_cache_package
-      && current_cache_is_install == is_install
-      && strcmp (current_cache_package, package) == 0)
-    return true;
+/* Besides the operation that the cache currently represents, we
+   remember the outcome of the last few operations as deltas against
+   the cache checkpoint.  The frontend typically asks about the same
+   package several times while going through an installation
+   (GET_PACKAGE_INFO, GET_PACKAGE_DETAILS, INSTALL_CHECK, ...),
+   interleaved with background requests for other packages, and
+   replaying a delta is much cheaper than resolving the dependencies
+   again.
+
+   Cached plans are most recently used first.  They are forgotten
+   when the cache is reconstructed, and are ignored when the
+   checkpoint they are relative to has been replaced.
+*/
 
-  if (current_cache_package)
-    cache_reset ();
+#define MAX_CACHED_PLANS 8
 
-  current_cache_package = g_strdup (package);
-  current_cache_is_install = is_install;
-  return false;
+struct cached_plan {
+  char *package;
+  bool is_install;
+  myCacheFile::cache_delta *delta;
+};
+
+static cached_plan cached_plans[MAX_CACHED_PLANS];
+static int n_cached_plans = 0;
+
+static void
+free_cached_plan (cached_plan *plan)
+{
+  g_free (plan->package);
+  myCacheFile::free_delta (plan->delta);
 }
 
-/* Initialize libapt-pkg if this has not been done already and
-   (re-)create PACKAGE_CACHE.  If the cache can not be created,
+static void
+forget_cached_plans ()
+{
+  for (int i = 0; i < n_cached_plans; i++)
+    free_cached_plan (&cached_plans[i]);
+  n_cached_plans = 0;
+}
+
+/* Move the plan at index I to the front.
+ */
+static void
+touch_cached_plan (int i)
+{
+  cached_plan plan = cached_plans[i];
+  memmove (&cached_plans[1], &cached_plans[0], i * sizeof (cached_plan));
+  cached_plans[0] = plan;
+}
+
+static void
+remove_cached_plan (int i)
+{
+  free_cached_plan (&cached_plans[i]);
+  memmove (&cached_plans[i], &cached_plans[i+1],
+	   (n_cached_plans - i - 1) * sizeof (cached_plan));
+  n_cached_plans -= 1;
+}
+
+/* Record the current state of the cache as the plan for PACKAGE.
+ */
+static void
+remember_cache_state (const char *package, bool is_install)
+{
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  myCacheFile::cache_delta *delta = awc->cache->capture_delta ();
+  if (delta == NULL)
+    return;
+
+  for (int i = 0; i < n_cached_plans; i++)
+    if (cached_plans[i].is_install == is_install
+	&& !strcmp (cached_plans[i].package, package))
+      {
+	remove_cached_plan (i);
+	break;
+      }
+
+  if (n_cached_plans == MAX_CACHED_PLANS)
+    remove_cached_plan (n_cached_plans - 1);
+
+  cached_plans[n_cached_plans].package = g_strdup (package);
+  cached_plans[n_cached_plans].is_install = is_install;
+  cached_plans[n_cached_plans].delta = delta;
+  n_cached_plans += 1;
+  touch_cached_plan (n_cached_plans - 1);
+}
+
+/* Put the cache into the state recorded for PACKAGE, if there is
+   one.  Returns false if that isn't possible.
+*/
+static bool
+restore_cache_state (const char *package, bool is_install)
+{
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+
+  for (int i = 0; i < n_cached_plans; i++)
+    if (cached_plans[i].is_install == is_install
+	&& !strcmp (cached_plans[i].package, package))
+      {
+	if (!awc->cache->apply_delta (cached_plans[i].delta))
+	  {
+	    remove_cached_plan (i);
+	    return false;
+	  }
+
+	touch_cached_plan (i);
+	return true;
+      }
+
+  return false;
+}
+
+/* Return true if the cache already represents the given operation,
+   either because it was the last one or because it could be
+   restored from the cached plans.  Otherwise, reset the cache and
+   return false; the caller is then expected to mark the packages and
+   call remember_cache_state.
+*/
+static bool
+check_cache_state (const char *package, bool is_install)
+{
+  if (current_cache_package
+      && current_cache_is_install == is_install
+      && strcmp (current_cache_package, package) == 0)
+    return true;
+
+  if (current_cache_package)
+    cache_reset ();
+
+  if (restore_cache_state (package, is_install))
+    {
+      current_cache_package = g_strdup (package);
+      current_cache_is_install = is_install;
+      return true;
+    }
+
+  current_cache_package = g_strdup (package);
+  current_cache_is_install = is_install;
+  return false;
+}
+
+/* Initialize libapt-pkg if this has not been done already and
+   (re-)create PACKAGE_CACHE.  If the cache can not be created,
    PACKAGE_CACHE is set to NULL and an appropriate message is output.
    */
+/* How often the cache has been initialized, see DAEMON MODE.
+ */
+static int cache_init_count;
+
 void
 cache_init (bool with_status)
 {
   AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  int64_t start = stats_wall_usec ();
+
+  cache_init_count++;
 
   /* Closes the cache, to prevent getting blocked by other locks in
    * dpkg structures. If we don't do it, changing the apt worker state
@@ -1922,6 +3075,8 @@ cache_init (bool with_status)
   */
   _error->DumpErrors ();
 
+  forget_cached_plans ();
+
   /* Clear out the dpkg journal before construction the cache.
    */
   clear_dpkg_updates ();
@@ -1953,6 +3108,8 @@ cache_init (bool with_status)
 
   if (awc->cache)
     write_available_updates_file ();
+
+  stats_cache_usec += stats_wall_usec () - start;
 }
 
 bool
@@ -1967,6 +3124,62 @@ ensure_cache (bool with_status)
   return awc->cache != NULL;
 }
 
+void
+cache_shrink ()
+{
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+
+  if (cache_shrunk)
+    return;
+
+  if (awc->cache)
+    {
+      forget_cached_plans ();
+      delete awc->action_group;
+      awc->action_group = NULL;
+      awc->cache->close_dep_cache ();
+    }
+
+  response.reset ();
+  response.compact ();
+
+  /* Freed memory is usually not given back to the system by itself.
+   */
+  malloc_trim (0);
+
+  cache_shrunk = true;
+  DBG ("shrunk");
+}
+
+void
+cache_unshrink ()
+{
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+
+  if (!cache_shrunk)
+    return;
+  cache_shrunk = false;
+
+  if (awc->cache == NULL || !awc->cache->dep_cache_closed ())
+    return;
+
+  int64_t start = stats_wall_usec ();
+  UpdateProgress progress (false);
+
+  if (awc->cache->open_dep_cache (progress))
+    {
+      pkgDepCache &cache = *awc->cache;
+      awc->action_group = new pkgDepCache::ActionGroup (cache);
+      cache_reset ();
+      stats_cache_usec += stats_wall_usec () - start;
+    }
+  else
+    {
+      _error->DumpErrors ();
+      cache_init (false);
+    }
+}
+
 /* Determine whether a package was installed automatically to satisfy
    a dependency.
 */
@@ -1997,6 +3210,7 @@ mark_related (const pkgCache::VerIterator &ver)
   if (awc->cache->extra_info[pkg->ID].related)
     return;
 
+  awc->cache->touch (pkg);
   awc->cache->extra_info[pkg->ID].related = true;
 
   pkgDepCache &cache = *awc->cache;
@@ -2032,6 +3246,7 @@ cache_reset_package (pkgCache::PkgIterator &pkg)
   AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
   pkgDepCache &cache = *(awc->cache);
 
+  awc->cache->touch (pkg);
   cache.MarkKeep (pkg);
 
   if (awc->cache->extra_info[pkg->ID].autoinst)
@@ -2067,10 +3282,19 @@ cache_reset ()
   if (awc->cache == NULL)
     return;
 
-  pkgDepCache &cache = *(awc->cache);
+  /* The first reset after cache_init (or after the Auto flags have
+     been saved) walks all packages and then takes a checkpoint.  All
+     following resets just restore that checkpoint.
+  */
+  if (!awc->cache->restore_checkpoint ())
+    {
+      pkgDepCache &cache = *(awc->cache);
 
-  for (pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end (); pkg++)
-    cache_reset_package (pkg);
+      for (pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end (); pkg++)
+	cache_reset_package (pkg);
+
+      awc->cache->checkpoint ();
+    }
 
   g_free (current_cache_package);
   current_cache_package = NULL;
@@ -2252,6 +3476,7 @@ mark_for_install_1 (pkgCache::PkgIterator &pkg, int level)
   /* Now mark it and return if that fails.  Both ModeInstall and
      ModeKeep are fine.  ModeKeep only happens for broken packages.
    */
+  awc->cache->touch (pkg);
   cache.MarkInstall (pkg, false);
   if (cache[pkg].Mode != pkgDepCache::ModeInstall
       && cache[pkg].Mode != pkgDepCache::ModeKeep)
@@ -2346,7 +3571,10 @@ mark_for_install_1 (pkgCache::PkgIterator &pkg, int level)
 	      // Set the autoflag, after MarkInstall because
 	      // MarkInstall unsets it
 	      if (P->CurrentVer == 0)
-		cache[InstPkg].Flags |= pkgCache::Flag::Auto;
+		{
+		  awc->cache->touch (InstPkg);
+		  cache[InstPkg].Flags |= pkgCache::Flag::Auto;
+		}
 	    }
 
 	  continue;
@@ -2386,6 +3614,7 @@ mark_for_install (pkgCache::PkgIterator &pkg)
 
       pkgProblemResolver Fix(&Cache);
 
+      awc->cache->touch_all ();
       Fix.Clear(pkg);
       Fix.Protect(pkg);   
 
@@ -2446,6 +3675,7 @@ mark_named_package_for_install (const char *package)
   if (!strcmp (package, "magic:sys"))
     {
       mark_sys_upgrades ();
+      remember_cache_state (package, true);
       return true;
     }
   else
@@ -2455,6 +3685,7 @@ mark_named_package_for_install (const char *package)
       if (!pkg.end())
 	{
 	  mark_for_install (pkg);
+	  remember_cache_state (package, true);
 	  return true;
 	}
       else
@@ -2476,6 +3707,7 @@ mark_for_remove_1 (pkgCache::PkgIterator &pkg, bool soft)
 
   DBG ("- %s%s", pkg.Name(), soft? " (soft)" : "");
 
+  awc->cache->touch (pkg);
   cache.MarkDelete (pkg);
   cache[pkg].Flags &= ~pkgCache::Flag::Auto;
   awc->cache->extra_info[pkg->ID].soft = soft;
@@ -2521,6 +3753,7 @@ mark_for_remove (pkgCache::PkgIterator &pkg)
 
       pkgProblemResolver Fix(&Cache);
 
+      awc->cache->touch_all ();
       Fix.Clear(pkg);
       Fix.Protect(pkg);   
 
@@ -2536,6 +3769,8 @@ mark_for_remove (pkgCache::PkgIterator &pkg)
       mark_for_remove_1 (pkg, false);
       fix_soft_packages ();
     }
+
+  remember_cache_state (pkg.Name (), false);
 }
 
 /* Getting the package record in a nicely parsable form.
@@ -2559,6 +3794,7 @@ struct package_record {
   void lookup(const pkgCache::VerIterator &ver)
     {
   const char *start, *stop;
+      stats_record_lookups++;
       P = &Recs.Lookup (ver.FileList ());
 
       P->GetRec (start, stop);
@@ -2575,7 +3811,7 @@ struct package_record {
 };
 
 package_record::package_record ()
-  : Recs (*(AptWorkerCache::GetCurrent ()->cache)),
+  : Recs ((pkgCache &) *(AptWorkerCache::GetCurrent ()->cache)),
     P(NULL),
     valid(false)
 {
@@ -3187,14 +4423,9 @@ removable_status ()
   return status_unable;
 }
 
-void
-cmd_get_package_info ()
+static void
+clear_package_info (apt_proto_package_info &info)
 {
-  const char *package = request.decode_string_in_place ();
-  bool only_installable_info = request.decode_int ();
-
-  apt_proto_package_info info;
-
   info.installable_status = status_unknown;
   info.download_size = 0;
   info.install_user_size_delta = 0;
@@ -3202,155 +4433,383 @@ cmd_get_package_info ()
   info.install_flags = 0;
   info.removable_status = status_unknown;
   info.remove_user_size_delta = 0;
+}
 
-  if (ensure_cache (true))
-    {
-      AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
-      pkgDepCache &cache = *(awc->cache);
-      pkgCache::PkgIterator pkg = cache.FindPkg (package);
-      package_record rec;
+/* Fill INFO for PACKAGE.  The cache must be valid.
+ */
+static void
+get_package_info_1 (const char *package, bool only_installable_info,
+		    apt_proto_package_info &info)
+{
+  clear_package_info (info);
+
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  pkgDepCache &cache = *(awc->cache);
+  pkgCache::PkgIterator pkg = cache.FindPkg (package);
+  package_record rec;
 
-      // simulate install
+  // simulate install
 
-      mark_named_package_for_install (package);
-      if (any_newly_or_related_broken ())
-	info.installable_status = installable_status ();
-      else
-	info.installable_status = status_able;
-      info.download_size = (int64_t) cache.DebSize ();
-      info.install_user_size_delta = (int64_t) cache.UsrSize ();
+  mark_named_package_for_install (package);
+  if (any_newly_or_related_broken ())
+    info.installable_status = installable_status ();
+  else
+    info.installable_status = status_able;
+  info.download_size = (int64_t) cache.DebSize ();
+  info.install_user_size_delta = (int64_t) cache.UsrSize ();
 
-      for (pkgCache::PkgIterator pkg = cache.PkgBegin();
-	   pkg.end() != true;
-	   pkg++)
+  for (pkgCache::PkgIterator pkg = cache.PkgBegin();
+       pkg.end() != true;
+       pkg++)
+    {
+      if (is_related (pkg)
+	  && (cache[pkg].Upgrade()
+	      || pkg.State() != pkgCache::PkgIterator::NeedsNothing))
 	{
-	  if (is_related (pkg)
-	      && (cache[pkg].Upgrade()
-		  || pkg.State() != pkgCache::PkgIterator::NeedsNothing))
-	    {
-	      pkgCache::VerIterator ver = cache[pkg].CandidateVerIter(cache);
+	  pkgCache::VerIterator ver = cache[pkg].CandidateVerIter(cache);
 
-	      rec.lookup(ver);
-	      info.install_flags |= get_flags (rec);
-	      info.required_free_space += get_required_free_space (rec);
-	    }
+	  rec.lookup(ver);
+	  info.install_flags |= get_flags (rec);
+	  info.required_free_space += get_required_free_space (rec);
 	}
+    }
+
+  if (!only_installable_info)
+    {
+      // simulate remove
 
-      if (!only_installable_info)
+      if (!strcmp (package, "magic:sys"))
+	{
+	  info.removable_status = status_system_update_unremovable;
+	}
+      else
 	{
-	  // simulate remove
+	  if (!pkg.end())
+	    mark_for_remove (pkg);
 
-	  if (!strcmp (package, "magic:sys"))
-	    {
-	      info.removable_status = status_system_update_unremovable;
-	    }
-	  else
+	  for (pkgCache::PkgIterator pkg = cache.PkgBegin();
+	       pkg.end() != true;
+	       pkg++)
 	    {
-	      if (!pkg.end())
-		mark_for_remove (pkg);
-
-	      for (pkgCache::PkgIterator pkg = cache.PkgBegin();
-		   pkg.end() != true;
-		   pkg++)
+	      if (cache[pkg].Delete())
 		{
-		  if (cache[pkg].Delete())
-		    {
-		      pkgCache::VerIterator ver = pkg.CurrentVer ();
+		  pkgCache::VerIterator ver = pkg.CurrentVer ();
 
-		      rec.lookup(ver);
-		      int flags = get_flags (rec);
-		      if (flags & pkgflag_system_update)
-			{
-			  info.removable_status =
-			    status_system_update_unremovable;
-			  break;
-			}
+		  rec.lookup(ver);
+		  int flags = get_flags (rec);
+		  if (flags & pkgflag_system_update)
+		    {
+		      info.removable_status =
+			status_system_update_unremovable;
+		      break;
 		    }
 		}
+	    }
 
-	      if (info.removable_status == status_unknown)
-		{
-		  if (any_newly_or_related_broken ())
-		    info.removable_status = removable_status ();
-		  else
-		    info.removable_status = status_able;
-		}
-	      info.remove_user_size_delta = (int64_t) cache.UsrSize ();
+	  if (info.removable_status == status_unknown)
+	    {
+	      if (any_newly_or_related_broken ())
+		info.removable_status = removable_status ();
+	      else
+		info.removable_status = status_able;
 	    }
+	  info.remove_user_size_delta = (int64_t) cache.UsrSize ();
 	}
     }
+}
+
+void
+cmd_get_package_info ()
+{
+  const char *package = request.decode_string_in_place ();
+  bool only_installable_info = request.decode_int ();
+
+  apt_proto_package_info info;
+
+  if (ensure_cache (true))
+    get_package_info_1 (package, only_installable_info, info);
+  else
+    clear_package_info (info);
 
   response.encode_mem (&info, sizeof (apt_proto_package_info));
 }
 
-/* APTCMD_GET_PACKAGE_DETAILS
-   
-   Like APTCMD_GET_PACKAGE_INFO, this command performs a simulated
-   install or removal (as requested), but it gathers a lot more
-   information about the package and what is happening.
+/* APTCMD_GET_PACKAGE_INFOS
+
+   Like APTCMD_GET_PACKAGE_INFO, but for a list of packages.  The
+   response contains one apt_proto_package_info for each requested
+   package, in the same order.
+
+   When the machine has more than one processor and the list is long
+   enough, the simulations are spread over forked children.  The
+   children share the fully constructed cache with us copy-on-write,
+   each take a slice of the list, and write their results to a pipe.
+   We do the first slice ourselves and redo the slice of any child
+   that fails.  Nothing that a child does to its cache is seen by us.
 */
 
-static void
-append_display_name (GString *str, const pkgCache::PkgIterator &pkg)
+#define MIN_SIMULATIONS_PER_PROCESS 8
+#define MAX_SIMULATION_PROCESSES    8
+
+struct simulation_child {
+  pid_t pid;
+  int fd;
+  int first, last;
+};
+
+static int
+simulation_processes (int n_packages)
 {
-  pkgCache::VerIterator ver = pkg.CurrentVer();
-  if (!ver.end())
-    {
-      package_record rec;
-      rec.lookup(ver);
-      string pretty_name = get_pretty_name (rec);
-      if (!pretty_name.empty())
-	{
-	  g_string_append (str, pretty_name.c_str());
-	  return;
-	}
-    }
-  
-  g_string_append (str, pkg.Name());
+  long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  int n = n_packages / MIN_SIMULATIONS_PER_PROCESS;
+
+  if (n_cpus < n)
+    n = n_cpus;
+  if (n > MAX_SIMULATION_PROCESSES)
+    n = MAX_SIMULATION_PROCESSES;
+  if (n < 1)
+    n = 1;
+
+  return n;
 }
 
-void
-encode_dependencies (pkgCache::VerIterator &ver)
+static bool
+write_all (int fd, const void *buf, size_t n)
 {
-  for (pkgCache::DepIterator dep = ver.DependsList(); !dep.end(); )
+  while (n > 0)
     {
-      GString *str;
-      apt_proto_deptype type;
-      pkgCache::DepIterator start;
-      pkgCache::DepIterator end;
-      dep.GlobOr(start, end);
-
-      if (start->Type == pkgCache::Dep::PreDepends ||
-	  start->Type == pkgCache::Dep::Depends)
-	type = deptype_depends;
-      else if (start->Type == pkgCache::Dep::Conflicts)
-	type = deptype_conflicts;
-      else 
+      ssize_t r = write (fd, buf, n);
+      if (r < 0 && errno == EINTR)
 	continue;
-
-      str = g_string_new ("");
-      while (1)
-	{
-	  g_string_append_printf (str, " %s", start.TargetPkg().Name());
-	  if (start.TargetVer() != 0)
-	    g_string_append_printf (str, " (%s %s)",
-				    start.CompType(), start.TargetVer());
-	  
-	  if (start == end)
-	    break;
-	  g_string_append_printf (str, " |");
-	  start++;
-	}
-
-      response.encode_int (type);
-      response.encode_string (str->str);
-      g_string_free (str, 1);
+      if (r <= 0)
+	return false;
+      n -= r;
+      buf = ((const char *)buf) + r;
     }
-
-  response.encode_int (deptype_end);
+  return true;
 }
 
-void
+static bool
+read_all (int fd, void *buf, size_t n)
+{
+  while (n > 0)
+    {
+      ssize_t r = read (fd, buf, n);
+      if (r < 0 && errno == EINTR)
+	continue;
+      if (r <= 0)
+	return false;
+      n -= r;
+      buf = ((char *)buf) + r;
+    }
+  return true;
+}
+
+static void
+get_package_infos_slice (const char **packages, int first, int last,
+			 bool only_installable_info,
+			 apt_proto_package_info *infos)
+{
+  for (int i = first; i < last; i++)
+    get_package_info_1 (packages[i], only_installable_info, infos[i]);
+}
+
+static bool
+fork_simulation_child (simulation_child &child,
+		       const char **packages, bool only_installable_info)
+{
+  int fds[2];
+
+  if (pipe (fds) < 0)
+    {
+      perror ("pipe");
+      return false;
+    }
+
+  child.pid = fork ();
+  if (child.pid < 0)
+    {
+      perror ("fork");
+      close (fds[0]);
+      close (fds[1]);
+      return false;
+    }
+
+  if (child.pid == 0)
+    {
+      /* Don't let the child touch any of our own file descriptors
+	 and don't run any exit handlers.
+      */
+      close (fds[0]);
+      for (int i = child.first; i < child.last; i++)
+	{
+	  apt_proto_package_info info;
+	  get_package_info_1 (packages[i], only_installable_info, info);
+	  if (!write_all (fds[1], &info, sizeof (info)))
+	    _exit (1);
+	}
+      _exit (0);
+    }
+
+  close (fds[1]);
+  child.fd = fds[0];
+  return true;
+}
+
+static void
+get_package_infos (const char **packages, int n_packages,
+		   bool only_installable_info,
+		   apt_proto_package_info *infos)
+{
+  int n_processes = simulation_processes (n_packages);
+  simulation_child *children = new simulation_child[n_processes];
+  int n_children = 0;
+
+  /* Slice 0 is ours.
+   */
+  for (int k = 1; k < n_processes; k++)
+    {
+      simulation_child &child = children[n_children];
+      child.first = (k * n_packages) / n_processes;
+      child.last = ((k + 1) * n_packages) / n_processes;
+      if (fork_simulation_child (child, packages, only_installable_info))
+	n_children++;
+      else
+	break;
+    }
+
+  int our_last = (n_children > 0
+		  ? children[0].first
+		  : n_packages);
+  if (n_children > 0 && n_children < n_processes - 1)
+    {
+      /* Forking failed at some point; do the rest ourselves too.
+       */
+      get_package_infos_slice (packages, children[n_children-1].last,
+			       n_packages, only_installable_info, infos);
+    }
+  get_package_infos_slice (packages, 0, our_last,
+			   only_installable_info, infos);
+
+  for (int k = 0; k < n_children; k++)
+    {
+      simulation_child &child = children[k];
+      int n = child.last - child.first;
+      bool success = read_all (child.fd, infos + child.first,
+			       n * sizeof (apt_proto_package_info));
+      int status;
+
+      close (child.fd);
+      if (waitpid (child.pid, &status, 0) < 0
+	  || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+	success = false;
+
+      if (!success)
+	{
+	  log_stderr ("simulation child %d failed", child.pid);
+	  get_package_infos_slice (packages, child.first, child.last,
+				   only_installable_info, infos);
+	}
+    }
+
+  delete[] children;
+}
+
+void
+cmd_get_package_infos ()
+{
+  bool only_installable_info = request.decode_int ();
+  GPtrArray *packages = g_ptr_array_new ();
+  const char *package;
+
+  while ((package = request.decode_string_in_place ()) != NULL)
+    g_ptr_array_add (packages, (gpointer) package);
+
+  int n_packages = packages->len;
+  apt_proto_package_info *infos = new apt_proto_package_info[n_packages];
+
+  if (ensure_cache (true))
+    get_package_infos ((const char **) packages->pdata, n_packages,
+		       only_installable_info, infos);
+  else
+    for (int i = 0; i < n_packages; i++)
+      clear_package_info (infos[i]);
+
+  for (int i = 0; i < n_packages; i++)
+    response.encode_mem (&infos[i], sizeof (apt_proto_package_info));
+
+  delete[] infos;
+  g_ptr_array_free (packages, TRUE);
+}
+
+/* APTCMD_GET_PACKAGE_DETAILS
+   
+   Like APTCMD_GET_PACKAGE_INFO, this command performs a simulated
+   install or removal (as requested), but it gathers a lot more
+   information about the package and what is happening.
+*/
+
+static void
+append_display_name (GString *str, const pkgCache::PkgIterator &pkg)
+{
+  pkgCache::VerIterator ver = pkg.CurrentVer();
+  if (!ver.end())
+    {
+      package_record rec;
+      rec.lookup(ver);
+      string pretty_name = get_pretty_name (rec);
+      if (!pretty_name.empty())
+	{
+	  g_string_append (str, pretty_name.c_str());
+	  return;
+	}
+    }
+  
+  g_string_append (str, pkg.Name());
+}
+
+void
+encode_dependencies (pkgCache::VerIterator &ver)
+{
+  for (pkgCache::DepIterator dep = ver.DependsList(); !dep.end(); )
+    {
+      GString *str;
+      apt_proto_deptype type;
+      pkgCache::DepIterator start;
+      pkgCache::DepIterator end;
+      dep.GlobOr(start, end);
+
+      if (start->Type == pkgCache::Dep::PreDepends ||
+	  start->Type == pkgCache::Dep::Depends)
+	type = deptype_depends;
+      else if (start->Type == pkgCache::Dep::Conflicts)
+	type = deptype_conflicts;
+      else 
+	continue;
+
+      str = g_string_new ("");
+      while (1)
+	{
+	  g_string_append_printf (str, " %s", start.TargetPkg().Name());
+	  if (start.TargetVer() != 0)
+	    g_string_append_printf (str, " (%s %s)",
+				    start.CompType(), start.TargetVer());
+	  
+	  if (start == end)
+	    break;
+	  g_string_append_printf (str, " |");
+	  start++;
+	}
+
+      response.encode_int (type);
+      response.encode_string (str->str);
+      g_string_free (str, 1);
+    }
+
+  response.encode_int (deptype_end);
+}
+
+void
 encode_broken (pkgCache::PkgIterator &pkg,
 	       const char *want)
 {
@@ -4137,172 +5596,1359 @@ duplink_file_tree (const char *old_tree, const char *new_tree)
 int
 unlink_callback (const char *name, const struct stat *, int m, struct FTW *f)
 {
-  // fprintf (stderr, "- %s\n", name);
+  // fprintf (stderr, "- %s\n", name);
+
+  if (m == FTW_DP)
+    {
+      if (rmdir (name))
+	perror (name);
+    }
+  else if (m == FTW_F)
+    {
+      if (unlink (name))
+	perror (name);
+    }
+
+  return 0;
+}
+
+int
+unlink_file_tree (const char *tree)
+{
+  return nftw (tree, unlink_callback, 10, FTW_DEPTH);
+}
+
+/* Return the directory of the package lists, without a trailing
+   slash.
+*/
+static string
+lists_dir_name ()
+{
+  string lists_dir = _config->FindDir("Dir::State::Lists");
+  if (lists_dir.length() > 0 && lists_dir[lists_dir.length()-1] == '/')
+    lists_dir.erase(lists_dir.length()-1, 1);
+  return lists_dir;
+}
+
+/* Download the package lists next to the current ones, into
+   "lists.new".  Returns true when all of them could be downloaded, in
+   which case COMMIT_PACKAGE_LISTS must be called to put them into
+   place.  RESULT is set to the result code for the frontend.
+
+   The current lists are not touched, so the cache can still be used
+   while this runs in a different process, see DAEMON MODE.
+*/
+static bool
+download_package_lists (xexp *catalogues_for_report,
+			bool with_status, int *result)
+{
+  /* XXX - We do the downloading in a 'transaction'.  If we get
+           interrupted half-way through, all the old files are kept in
+           place.  Libapt-pkg is careful not to leave partial files on
+           disk, but when more than one file needs to be downloaded
+           for a repository, we can still end up with an inconsistent
+           state.  Worse, the cleanup will remove the "Packages" files
+           when the corresponding "Release" has not been downloaded
+           yet.
+
+     Libapt-pkg should take care of this itself, but I am too much of
+     a chicken to make that change now.
+  */
+
+  bool complete;
+
+  *result = rescode_failure;
+
+  string lists_val = _config->Find("Dir::State::Lists");
+  string lists_dir = lists_dir_name ();
+  string lists_dir_new = lists_dir + ".new";
+
+  unlink_file_tree (lists_dir_new.c_str());
+  duplink_file_tree (lists_dir.c_str(), lists_dir_new.c_str());
+  _config->Set ("Dir::State::Lists", lists_dir_new);
+
+  complete = download_lists (catalogues_for_report, with_status, result);
+
+  _config->Set ("Dir::State::Lists", lists_val);
+  if (!complete)
+    {
+      /* cleanup */
+      unlink_file_tree (lists_dir_new.c_str());
+    }
+
+  return complete;
+}
+
+/* Complete the transaction started by DOWNLOAD_PACKAGE_LISTS.
+ */
+static void
+commit_package_lists ()
+{
+  string lists_dir = lists_dir_name ();
+  string lists_dir_new = lists_dir + ".new";
+  string lists_dir_old = lists_dir + ".old";
+
+  unlink_file_tree (lists_dir_old.c_str());
+  rename (lists_dir.c_str(), lists_dir_old.c_str());
+  rename (lists_dir_new.c_str(), lists_dir.c_str());
+  unlink_file_tree (lists_dir_old.c_str());
+}
+
+/* Download the package lists into place.  Returns true when the
+   lists have been replaced, in which case the cache needs to be
+   reconstructed.  RESULT is set to the result code for the
+   frontend.
+*/
+static bool
+update_package_lists (xexp *catalogues_for_report,
+		      bool with_status, int *result)
+{
+  if (!download_package_lists (catalogues_for_report, with_status, result))
+    return false;
+
+  /* A writer of the daemon leaves this to the daemon, together with
+     rebuilding the cache.
+  */
+  if (flag_daemon_writer)
+    {
+      daemon_lists_downloaded = true;
+      return false;
+    }
+
+  commit_package_lists ();
+  return true;
+}
+
+int
+update_package_cache (xexp *catalogues_for_report,
+		      bool with_status)
+{
+  int result;
+
+  if (update_package_lists (catalogues_for_report, with_status, &result))
+    cache_init (with_status);
+
+  return result;
+}
+
+static void
+reset_catalogue_errors (xexp *catalogues)
+{
+  /* Clean the catalogues errors */
+  clean_failed_catalogues ();
+
+  if (catalogues == NULL)
+    return;
+
+  for (xexp *c = xexp_first (catalogues); c; c = xexp_rest (c))
+    xexp_adel (c, "errors");
+}
+
+static gboolean
+update_sources_list (xexp *catalogues)
+{
+  gboolean success = FALSE;
+
+  /* Write the new sources list to disk */
+  success = (write_user_catalogues (catalogues)
+	     && write_sources_list (CATALOGUE_APT_SOURCE, catalogues));
+
+  return success;
+}
+
+static gboolean
+add_temp_sources_list (xexp *tempcat)
+{
+  gboolean success;
+
+  success = (xexp_write_file (TEMP_CATALOGUE_CONF, tempcat) &&
+             write_sources_list (TEMP_APT_SOURCE_LIST, tempcat));
+
+  return success;
+}
+
+int
+cmd_check_updates (bool with_status)
+{
+  xexp *catalogues = read_catalogues ();
+
+  reset_catalogue_errors (catalogues);
+
+  /* Update sources.list file before refreshing */
+  if (!flag_sandbox)
+    update_sources_list (catalogues);
+
+  int result_code = update_package_cache (catalogues, with_status);
+
+  if ((result_code == rescode_success)
+      || (result_code == rescode_partial_success))
+    {
+      /* Some packages with the 'system-update' could
+         appear / disappear under this conditions */
+      ssu_packages_needs_refresh = true;
+    }
+
+  /* Save potential errors to disk */
+  save_failed_catalogues (catalogues);
+
+  response.encode_xexp (catalogues);
+  response.encode_int (result_code);
+
+  if (catalogues)
+    xexp_free (catalogues);
+
+  return result_code;
+}
+
+/* "apt-worker check-for-updates" is run periodically by the status
+   bar plugin, usually on an idle device, so it takes a cheaper route
+   than APTCMD_CHECK_UPDATES.  The worker lock is only held while the
+   package lists are downloaded and the binary package cache is
+   rebuilt from them; the frontend may start while we compute the
+   available updates.  That computation uses the package cache and
+   our policy directly, without a dependency cache.
+
+   When an apt-worker daemon is running, it is asked to do the check
+   instead, see DAEMON MODE.
+*/
+
+static void write_available_updates_file_1 (myCacheFile *cache_file,
+					    pkgDepCache *dep_cache);
+
+static int daemon_check_for_updates (const char *http_proxy);
+
+int
+cmdline_check_updates (char **argv)
+{
+  /* A daemon does it without anybody waiting for the lock.
+   */
+  int daemon_result = daemon_check_for_updates (argv[1]);
+  if (daemon_result >= 0)
+    return daemon_result;
+
+  if (argv[1])
+    {
+      DBG ("http_proxy: %s", argv[1]);
+      setenv ("http_proxy", argv[1], 1);
+    }
+
+  get_apt_worker_lock (true);
+  misc_init (false);
+
+  response.reset ();
+  request.reset (NULL, 0);
+
+  xexp *catalogues = read_catalogues ();
+  reset_catalogue_errors (catalogues);
+  update_sources_list (catalogues);
+
+  int result_code;
+  update_package_lists (catalogues, false, &result_code);
+
+  save_failed_catalogues (catalogues);
+  if (catalogues)
+    xexp_free (catalogues);
+
+  _error->DumpErrors ();
+
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  OpProgress progress;
+  awc->cache = new myCacheFile;
+  if (!awc->cache->OpenWithoutDepCache (progress))
+    {
+      _error->DumpErrors ();
+      return 2;
+    }
+
+  _system->UnLock ();
+  release_apt_worker_lock ();
+
+  write_available_updates_file_1 (awc->cache, NULL);
+  _error->DumpErrors ();
+
+  if (result_code == rescode_success
+      || result_code == rescode_partial_success)
+    return 0;
+  else
+    return 1;
+}
+
+/** DAEMON MODE
+
+   "apt-worker daemon SOCKET OPTIONS" serves any number of clients at
+   the same time from a single cache, which stays loaded between them.
+   The clients connect to the local socket SOCKET, usually
+   APT_WORKER_SOCKET, and pass their ends of the conversation over it,
+   as explained in <apt-worker-proto.h>.  From then on, a client talks
+   to the daemon exactly like to a backend.
+
+   Requests are carried out one after the other, and the clients are
+   served in turn.  Thus, reads of the cache are serialized against
+   changes to it.  While a request is carried out, INPUT_FD,
+   OUTPUT_FD, STATUS_FD and CANCEL_FD are those of its client, stdout
+   and stderr go to its log, and the options of the client are in
+   effect.  The environment is shared by all clients, but the
+   Application Manager sets it before each operation that needs it.
+
+   Requests that only read, such as APTCMD_GET_PACKAGE_LIST, are
+   carried out by the daemon itself.  All others are given to a
+   "writer": a child process that works on its own copy of the cache
+   and holds the dpkg lock while it runs.  The cache of the daemon
+   stays as it was and the daemon continues to serve the requests that
+   only read from it, even those of other clients while the writer
+   downloads and installs packages for one of them.  There is only
+   one writer at a time, the other requests that need one have to
+   wait.
+
+   A client sends its requests one at a time and the writer sends
+   status reports on the OUTPUT_FD of its client, so only other
+   clients are served while a writer runs.  The Application Manager
+   still waits for its own downloads and installations, which it
+   shows in a modal progress dialog anyway, but its requests are no
+   longer held up by the update checks of the status bar, and vice
+   versa.
+
+   When the writer is done, it hands its response and what it has
+   changed back to the daemon.  New package lists are only put into
+   place by the daemon, so that the cache of the daemon and the lists
+   never disagree.  Then the daemon rebuilds its cache if needed, and
+   only then sends the response.  Thus, the periodic update check of
+   the status bar doesn't block the Application Manager, and the next
+   request of a client always sees what its last one has done.
+
+   This uses processes instead of threads since libapt-pkg keeps much
+   of its state in globals.
+
+   Like a backend, the daemon shrinks its cache when it has had no
+   requests for IDLE_SHRINK_SECONDS, see cache_shrink.
+
+   The daemon takes the weak apt-worker lock so that a backend can
+   still get it.  While it has no clients, it doesn't hold the dpkg
+   lock either, so that it doesn't get in the way of apt-get and dpkg.
+   When the first client connects again, the cache is rebuilt if the
+   dpkg status or the package lists have changed meanwhile.  The
+   daemon exits after having had no clients for DAEMON_IDLE_TIMEOUT
+   seconds.
+
+   "apt-worker prestart" starts a daemon on APT_WORKER_SOCKET, if
+   there isn't one already, which loads its cache right away and
+   waits for its first client for DAEMON_PRESTART_IDLE_TIMEOUT
+   seconds.  This is done by ham-after-boot when the session starts,
+   so that the Application Manager usually finds a warm daemon and
+   can show its first list without waiting for the cache.
+
+   When a request has replaced the executable of the daemon, such as
+   when the Application Manager upgrades itself, the daemon exits as
+   soon as it has no clients, so that the next one starts the new
+   version.  Clients with a different APT_PROTO_VERSION are refused.
+
+   Instead of creating SOCKET itself, the daemon can also be given a
+   listening socket by a service manager that starts it on the first
+   connection, according to the LISTEN_PID and LISTEN_FDS convention.
+   Then the permissions of that socket decide who can connect, and
+   the daemon doesn't fork.
+*/
+
+#define DAEMON_IDLE_TIMEOUT          (15*60)
+#define DAEMON_PRESTART_IDLE_TIMEOUT (60*60)
+
+/* Longer requests are taken as a sign of a confused client.
+ */
+#define DAEMON_MAX_REQUEST_LEN (4*1024*1024)
+
+/* The first inherited socket, see sd_listen_fds(3).
+ */
+#define DAEMON_LISTEN_FDS_START 3
+
+struct daemon_client {
+  daemon_client *next;
+
+  int fds[APT_FD_MAX];
+  char *options;
+  bool failed;
+
+  /* The request that is being read from this client, or that has
+     been read but not been carried out yet.  REQ_READ counts the
+     bytes of the header and of REQBUF that we have so far.
+  */
+  bool has_request;
+  apt_request_header req;
+  char *reqbuf;
+  int req_read;
+};
+
+static daemon_client *daemon_clients;
+static daemon_client *daemon_current;
+
+/* Only root and the user that has started the daemon can connect,
+   unless the socket has been inherited.
+*/
+static uid_t daemon_owner;
+static bool daemon_socket_inherited;
+
+/* How long the daemon stays without clients, longer when it has been
+   prestarted.
+*/
+static int daemon_idle_timeout = DAEMON_IDLE_TIMEOUT;
+
+/* Our executable and its inode and modification time when we
+   started, see daemon_check_binary.  When it has changed, the daemon
+   is stale and exits as soon as it has no clients.
+*/
+static char *daemon_binary;
+static ino_t daemon_binary_ino;
+static time_t daemon_binary_mtime;
+static bool daemon_stale;
+
+/* While the daemon has no clients, this is how often it had taken
+   the dpkg lock, and the times at which the dpkg status and the
+   package lists have last been changed.  Otherwise, it is -1.
+*/
+static int daemon_idle_locks = -1;
+static time_t daemon_idle_status_mtime;
+static time_t daemon_idle_lists_mtime;
+
+/* Stdout and stderr point here between requests.
+ */
+static int daemon_null_fd = -1;
+
+/* The options that are currently in effect.
+ */
+static char *daemon_options;
+
+/* The writer, the pipe on which it reports back, and the client
+   whose request it carries out.
+*/
+static pid_t writer_pid = -1;
+static int writer_fd = -1;
+static daemon_client *writer_client;
+static stats_sample writer_sample;
+
+/* How often the daemon had taken the dpkg lock before giving it to
+   the writer.
+*/
+static int writer_locks;
+
+/* This is what a writer reports back, followed by its response.
+ */
+struct writer_report {
+  int lists_downloaded;    // commit_package_lists is needed
+  int cache_changed;       // cache_init is needed
+  int ssu_refresh;         // ssu_packages_needs_refresh
+  int response_len;
+};
+
+/* Write failures are noticed via EPIPE.  We don't ignore SIGPIPE since
+   that would be inherited by dpkg and the maintainer scripts.
+*/
+static void
+daemon_sigpipe (int sig)
+{
+}
+
+static void
+daemon_apply_options (const char *options)
+{
+  if (daemon_options && !strcmp (daemon_options, options))
+    return;
+
+  g_free (daemon_options);
+  daemon_options = g_strdup (options);
+
+  flag_break_locks = false;
+  flag_allow_wrong_domains = false;
+  flag_download_packages_to_mmc = false;
+  flag_use_apt_algorithms = false;
+  set_options (options);
+}
+
+/* Called for APTCMD_SET_OPTIONS.
+ */
+static void
+daemon_set_options (const char *options)
+{
+  if (daemon_current)
+    {
+      g_free (daemon_current->options);
+      daemon_current->options = g_strdup (options);
+    }
+  daemon_apply_options (options);
+}
+
+/* Make C the client that the following requests and responses are
+   for, or none when C is NULL.
+*/
+static void
+daemon_select (daemon_client *c)
+{
+  fflush (stdout);
+  fflush (stderr);
+
+  daemon_current = c;
+  if (c)
+    {
+      input_fd = c->fds[APT_FD_INPUT];
+      output_fd = c->fds[APT_FD_OUTPUT];
+      status_fd = c->fds[APT_FD_STATUS];
+      cancel_fd = c->fds[APT_FD_CANCEL];
+      dup2 (c->fds[APT_FD_LOG], 1);
+      dup2 (c->fds[APT_FD_LOG], 2);
+      daemon_apply_options (c->options);
+    }
+  else
+    {
+      input_fd = output_fd = status_fd = cancel_fd = -1;
+      dup2 (daemon_null_fd, 1);
+      dup2 (daemon_null_fd, 2);
+    }
+}
+
+static void
+daemon_client_failed ()
+{
+  if (daemon_current)
+    daemon_current->failed = true;
+}
+
+/* Give up the dpkg lock and return how often it had been taken.
+ */
+static int
+daemon_unlock_dpkg ()
+{
+  int n_locks = 0;
+
+  while (_system->UnLock (true))
+    n_locks++;
+  return n_locks;
+}
+
+static bool
+daemon_lock_dpkg (int n_locks)
+{
+  for (int i = 0; i < n_locks; i++)
+    if (!_system->Lock ())
+      return false;
+  return true;
+}
+
+static time_t
+daemon_mtime (const char *file)
+{
+  struct stat buf;
+
+  if (stat (file, &buf) < 0)
+    return 0;
+  return buf.st_mtime;
+}
+
+static void
+daemon_init_binary ()
+{
+  struct stat buf;
+
+  daemon_binary = g_file_read_link ("/proc/self/exe", NULL);
+  if (daemon_binary && stat (daemon_binary, &buf) == 0)
+    {
+      daemon_binary_ino = buf.st_ino;
+      daemon_binary_mtime = buf.st_mtime;
+    }
+  else
+    {
+      g_free (daemon_binary);
+      daemon_binary = NULL;
+    }
+}
+
+/* Called after requests that might have upgraded us.
+ */
+static void
+daemon_check_binary ()
+{
+  struct stat buf;
+
+  if (daemon_binary == NULL || daemon_stale)
+    return;
+
+  if (stat (daemon_binary, &buf) < 0
+      || buf.st_ino != daemon_binary_ino
+      || buf.st_mtime != daemon_binary_mtime)
+    {
+      log_stderr ("%s has changed, exiting when idle", daemon_binary);
+      daemon_stale = true;
+    }
+}
+
+static void
+daemon_exit (const char *socket_name)
+{
+  if (!daemon_socket_inherited)
+    unlink (socket_name);
+  exit (0);
+}
+
+/* Called when the last client is gone.
+ */
+static void
+daemon_sleep ()
+{
+  if (daemon_idle_locks >= 0)
+    return;
+
+  daemon_idle_locks = daemon_unlock_dpkg ();
+  daemon_idle_status_mtime =
+    daemon_mtime (_config->FindFile ("Dir::State::status").c_str ());
+  daemon_idle_lists_mtime = daemon_mtime (lists_dir_name ().c_str ());
+  DBG ("idle, %d dpkg locks released", daemon_idle_locks);
+}
+
+/* Called when a client connects to a daemon that has no others.
+ */
+static void
+daemon_wake ()
+{
+  int n_locks = daemon_idle_locks;
+
+  if (n_locks < 0)
+    return;
+  daemon_idle_locks = -1;
+
+  if (!daemon_lock_dpkg (n_locks)
+      || (daemon_mtime (_config->FindFile ("Dir::State::status").c_str ())
+	  != daemon_idle_status_mtime)
+      || daemon_mtime (lists_dir_name ().c_str ()) != daemon_idle_lists_mtime)
+    {
+      /* Someone else has been here.
+       */
+      cache_init (false);
+      ssu_packages_needs_refresh = true;
+    }
+  _error->DumpErrors ();
+}
+
+static void
+daemon_accept (int listen_fd)
+{
+  int sock, fds[APT_FD_MAX], version;
+  int my_version = APT_PROTO_VERSION;
+  char options[16];
+  struct ucred cred;
+  socklen_t cred_len = sizeof (cred);
+  struct timeval timeout = { 5, 0 };
+
+  sock = accept (listen_fd, NULL, NULL);
+  if (sock < 0)
+    return;
+
+  if (getsockopt (sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0
+      || (cred.uid != 0 && cred.uid != daemon_owner
+	  && !daemon_socket_inherited))
+    {
+      close (sock);
+      return;
+    }
+
+  /* Don't let a client that doesn't complete the handshake block
+     everybody else.
+  */
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+  bool success = apt_proto_receive_fds (sock, fds, &version,
+					options, sizeof (options));
+  if (success)
+    write_all (sock, &my_version, sizeof (my_version));
+  close (sock);
+  if (!success)
+    return;
+
+  if (version != APT_PROTO_VERSION)
+    {
+      /* The client is probably newer than us.
+       */
+      log_stderr ("refusing client with protocol version %d", version);
+      for (int i = 0; i < APT_FD_MAX; i++)
+	close (fds[i]);
+      daemon_check_binary ();
+      return;
+    }
+
+  daemon_client *c = new daemon_client;
+  for (int i = 0; i < APT_FD_MAX; i++)
+    {
+      c->fds[i] = fds[i];
+      SetCloseExec (fds[i], true);
+    }
+  must_set_flags (c->fds[APT_FD_INPUT], O_RDONLY | O_NONBLOCK);
+  must_set_flags (c->fds[APT_FD_CANCEL], O_RDONLY | O_NONBLOCK);
+  c->options = g_strdup (options);
+  c->failed = false;
+  c->has_request = false;
+  c->reqbuf = NULL;
+  c->req_read = 0;
+
+  c->next = daemon_clients;
+  daemon_clients = c;
+
+  /* This tells the client that we are ready, as for the backend.
+   */
+  daemon_select (c);
+  DBG ("new client, pid %d, options %s", cred.pid, options);
+  daemon_wake ();
+  daemon_idle_timeout = DAEMON_IDLE_TIMEOUT;
+  send_status (op_general, 0, 0, -1);
+  daemon_select (NULL);
+}
+
+static void
+daemon_remove (daemon_client *c)
+{
+  for (daemon_client **cp = &daemon_clients; *cp; cp = &(*cp)->next)
+    if (*cp == c)
+      {
+	*cp = c->next;
+	break;
+      }
+
+  for (int i = 0; i < APT_FD_MAX; i++)
+    close (c->fds[i]);
+  g_free (c->options);
+  g_free (c->reqbuf);
+  delete c;
+}
+
+/* Read what is available of the next request of C.  A client that
+   sends only part of a request doesn't block the others.
+*/
+static void
+daemon_read_request (daemon_client *c)
+{
+  int fd = c->fds[APT_FD_INPUT];
+  int header_len = sizeof (c->req);
+
+  while (!c->has_request)
+    {
+      char *buf;
+      int want;
+
+      if (c->req_read < header_len)
+	{
+	  buf = ((char *) &c->req) + c->req_read;
+	  want = header_len - c->req_read;
+	}
+      else
+	{
+	  buf = c->reqbuf + (c->req_read - header_len);
+	  want = header_len + c->req.len - c->req_read;
+	}
+
+      if (want > 0)
+	{
+	  ssize_t n = read (fd, buf, want);
+	  if (n < 0 && errno == EINTR)
+	    continue;
+	  if (n < 0 && errno == EAGAIN)
+	    return;
+	  if (n <= 0)
+	    {
+	      /* Closed.
+	       */
+	      c->failed = true;
+	      return;
+	    }
+	  c->req_read += n;
+	  if (n < want)
+	    continue;
+	}
+
+      if (c->req_read == header_len)
+	{
+	  if (c->req.len < 0 || c->req.len > DAEMON_MAX_REQUEST_LEN)
+	    {
+	      log_stderr ("bogus request length %d", c->req.len);
+	      c->failed = true;
+	      return;
+	    }
+	  c->reqbuf = (char *) g_malloc (c->req.len);
+	}
+
+      if (c->req_read == header_len + c->req.len)
+	{
+	  c->has_request = true;
+	  c->req_read = 0;
+	}
+    }
+}
+
+/* Whether CMD can be carried out from the cache of the daemon while
+   a writer is running, i.e., it neither changes the package lists,
+   the catalogues or the installed packages, nor does it use the
+   network.  Changing the marks of the cache of the daemon is fine.
+*/
+static bool
+daemon_command_only_reads (int cmd)
+{
+  switch (cmd)
+    {
+    case APTCMD_NOOP:
+    case APTCMD_GET_PACKAGE_LIST:
+    case APTCMD_GET_PACKAGE_INFO:
+    case APTCMD_GET_PACKAGE_INFOS:
+    case APTCMD_GET_PACKAGE_DETAILS:
+    case APTCMD_GET_CATALOGUES:
+    case APTCMD_GET_FREE_SPACE:
+    case APTCMD_INSTALL_CHECK:
+    case APTCMD_REMOVE_CHECK:
+    case APTCMD_GET_FILE_DETAILS:
+    case APTCMD_GET_SYSTEM_UPDATE_PACKAGES:
+    case APTCMD_SET_OPTIONS:
+    case APTCMD_SET_ENV:
+    case APTCMD_THIRD_PARTY_POLICY_CHECK:
+    case APTCMD_GET_STATS:
+    case APTCMD_EXIT:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Carry out the request of C in the writer and report to FD.
+ */
+static void
+daemon_run_writer (daemon_client *c, int fd, int n_locks)
+{
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  int cache_inits = cache_init_count;
+  writer_report report;
+
+  flag_daemon_writer = true;
+
+  daemon_lock_dpkg (n_locks);
+  serve_request (c->req, c->reqbuf);
+
+  report.lists_downloaded = daemon_lists_downloaded;
+  report.cache_changed = (awc->init_cache_after_request
+			  || cache_init_count != cache_inits);
+  report.ssu_refresh = ssu_packages_needs_refresh;
+  report.response_len = response.get_len ();
+
+  write_all (fd, &report, sizeof (report));
+  write_all (fd, response.get_buf (), response.get_len ());
+}
+
+static void
+daemon_start_writer (daemon_client *c)
+{
+  int fds[2];
+  int n_locks;
+
+  stats_begin (&writer_sample);
+
+  /* The dpkg lock is not inherited, so we give it to the writer.
+   */
+  n_locks = daemon_unlock_dpkg ();
+  writer_locks = n_locks;
+
+  fflush (stdout);
+  fflush (stderr);
+
+  if (pipe (fds) < 0)
+    writer_pid = -1;
+  else if ((writer_pid = fork ()) < 0)
+    {
+      close (fds[0]);
+      close (fds[1]);
+    }
+
+  if (writer_pid < 0)
+    {
+      /* Do it ourselves.
+       */
+      log_stderr ("can't start writer: %m");
+      daemon_lock_dpkg (n_locks);
+      serve_request (c->req, c->reqbuf);
+      daemon_check_binary ();
+      return;
+    }
+
+  if (writer_pid == 0)
+    {
+      close (fds[0]);
+      daemon_run_writer (c, fds[1], n_locks);
+      fflush (stdout);
+      fflush (stderr);
+      _exit (0);
+    }
+
+  close (fds[1]);
+  SetCloseExec (fds[0], true);
+  writer_fd = fds[0];
+  writer_client = c;
+}
+
+static void
+daemon_finish_writer ()
+{
+  daemon_client *c = writer_client;
+  writer_report report;
+  char *buf = NULL;
+  bool success;
+
+  success = (read_all (writer_fd, &report, sizeof (report))
+	     && report.response_len >= 0
+	     && (buf = (char *) g_malloc (report.response_len),
+		 read_all (writer_fd, buf, report.response_len)));
+
+  close (writer_fd);
+  waitpid (writer_pid, NULL, 0);
+  writer_fd = -1;
+  writer_pid = -1;
+  writer_client = NULL;
+
+  daemon_select (c);
+
+  if (!success)
+    {
+      /* We don't know what it has done.  The client gets an empty
+	 response, which it will treat as a failure.
+      */
+      log_stderr ("%s failed", apt_proto_command_name (c->req.cmd));
+      report.lists_downloaded = false;
+      report.cache_changed = true;
+      report.ssu_refresh = true;
+      report.response_len = 0;
+    }
+
+  if (report.lists_downloaded)
+    commit_package_lists ();
+
+  if (report.lists_downloaded || report.cache_changed)
+    cache_init (report.lists_downloaded);
+  else
+    daemon_lock_dpkg (writer_locks);
+  _error->DumpErrors ();
+
+  if (report.ssu_refresh)
+    ssu_packages_needs_refresh = true;
+
+  daemon_check_binary ();
+
+  send_response_raw (c->req.cmd, c->req.seq, buf, report.response_len);
+  stats_end (c->req.cmd, &writer_sample, report.response_len);
+
+  g_free (buf);
+  g_free (c->reqbuf);
+  c->reqbuf = NULL;
+  daemon_select (NULL);
+}
+
+static void
+daemon_serve (daemon_client *c)
+{
+  c->has_request = false;
+  daemon_select (c);
+
+  if (c->req.cmd == APTCMD_EXIT)
+    {
+      /* The client goes away, the daemon stays.
+       */
+      c->failed = true;
+    }
+  else if (!daemon_command_only_reads (c->req.cmd) && writer_client == NULL)
+    {
+      daemon_start_writer (c);
+      if (writer_client == c)
+	{
+	  /* The request buffer is freed when the writer is done.
+	   */
+	  daemon_select (NULL);
+	  return;
+	}
+    }
+  else
+    serve_request (c->req, c->reqbuf);
+
+  g_free (c->reqbuf);
+  c->reqbuf = NULL;
+  daemon_select (NULL);
+}
+
+static bool daemon_running (const char *socket_name);
+
+static int
+daemon_listen (const char *socket_name)
+{
+  struct sockaddr_un addr;
+  mode_t old_umask;
+  int fd;
+
+  if (strlen (socket_name) >= sizeof (addr.sun_path))
+    {
+      log_stderr ("socket name too long: %s", socket_name);
+      return -1;
+    }
+
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      log_stderr ("socket: %m");
+      return -1;
+    }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_name);
+
+  /* With the lock, any existing socket is stale.  A sandbox doesn't
+     take the lock, so we check that nobody is listening before
+     removing the socket.
+   */
+  if (!daemon_running (socket_name))
+    unlink (socket_name);
+
+  old_umask = umask (0077);
+  int res = bind (fd, (struct sockaddr *) &addr, sizeof (addr));
+  umask (old_umask);
+
+  if (res < 0
+      || (daemon_owner != getuid ()
+	  && chown (socket_name, daemon_owner, (gid_t) -1) < 0)
+      || listen (fd, 5) < 0)
+    {
+      log_stderr ("%s: %m", socket_name);
+      close (fd);
+      return -1;
+    }
+
+  SetCloseExec (fd, true);
+  return fd;
+}
+
+static void
+daemon_loop (int listen_fd, const char *socket_name)
+{
+  while (true)
+    {
+      fd_set set;
+      int max_fd = listen_fd;
+      struct timeval idle_timeout = { daemon_idle_timeout, 0 };
+      daemon_client *c, *next;
+
+      FD_ZERO (&set);
+      FD_SET (listen_fd, &set);
+      if (writer_fd >= 0)
+	{
+	  FD_SET (writer_fd, &set);
+	  max_fd = MAX (max_fd, writer_fd);
+	}
+      for (c = daemon_clients; c; c = c->next)
+	if (!c->has_request && c != writer_client)
+	  {
+	    FD_SET (c->fds[APT_FD_INPUT], &set);
+	    max_fd = MAX (max_fd, c->fds[APT_FD_INPUT]);
+	  }
+
+      bool idle = (daemon_clients == NULL && writer_fd < 0);
+      if (idle && daemon_stale)
+	{
+	  DBG ("stale, exiting");
+	  daemon_exit (socket_name);
+	}
+      if (idle)
+	daemon_sleep ();
+
+      /* First shrink, then exit.
+       */
+      bool shrink = (!cache_shrunk && writer_fd < 0);
+      if (shrink)
+	idle_timeout.tv_sec = IDLE_SHRINK_SECONDS;
+
+      int n = select (max_fd + 1, &set, NULL, NULL,
+		      (shrink || idle) ? &idle_timeout : NULL);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  log_stderr ("select: %m");
+	  exit (1);
+	}
+      else if (n == 0 && shrink)
+	{
+	  cache_shrink ();
+	  continue;
+	}
+      else if (n == 0)
+	{
+	  DBG ("no clients, exiting");
+	  daemon_exit (socket_name);
+	}
+
+      if (FD_ISSET (listen_fd, &set))
+	daemon_accept (listen_fd);
+
+      if (writer_fd >= 0 && FD_ISSET (writer_fd, &set))
+	daemon_finish_writer ();
+
+      for (c = daemon_clients; c; c = c->next)
+	if (!c->has_request && c != writer_client
+	    && FD_ISSET (c->fds[APT_FD_INPUT], &set))
+	  daemon_read_request (c);
+
+      /* Carry out at most one request per client, so that a busy
+	 client can't starve the others.
+      */
+      for (c = daemon_clients; c; c = c->next)
+	if (c->has_request && !c->failed
+	    && (writer_client == NULL
+		|| daemon_command_only_reads (c->req.cmd)))
+	  daemon_serve (c);
+
+      for (c = daemon_clients; c; c = next)
+	{
+	  next = c->next;
+	  if (c->failed && c != writer_client)
+	    {
+	      DBG ("client gone");
+	      daemon_remove (c);
+	    }
+	}
+    }
+}
+
+/* Return the socket that a service manager has passed to us, or -1.
+ */
+static int
+daemon_inherited_socket ()
+{
+  const char *pid = getenv ("LISTEN_PID");
+  const char *n_fds = getenv ("LISTEN_FDS");
 
-  if (m == FTW_DP)
-    {
-      if (rmdir (name))
-	perror (name);
-    }
-  else if (m == FTW_F)
-    {
-      if (unlink (name))
-	perror (name);
-    }
+  if (pid == NULL || n_fds == NULL
+      || atoi (pid) != getpid () || atoi (n_fds) < 1)
+    return -1;
 
-  return 0;
+  unsetenv ("LISTEN_PID");
+  unsetenv ("LISTEN_FDS");
+  SetCloseExec (DAEMON_LISTEN_FDS_START, true);
+  return DAEMON_LISTEN_FDS_START;
 }
 
-int
-unlink_file_tree (const char *tree)
+/* Whether a daemon is listening on SOCKET_NAME.
+ */
+static bool
+daemon_running (const char *socket_name)
 {
-  return nftw (tree, unlink_callback, 10, FTW_DEPTH);
+  struct sockaddr_un addr;
+  int fd;
+  bool running;
+
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strncpy (addr.sun_path, socket_name, sizeof (addr.sun_path) - 1);
+  running = (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0);
+  close (fd);
+  return running;
 }
 
-int
-update_package_cache (xexp *catalogues_for_report,
-		      bool with_status)
+static int
+daemon_main (const char *socket_name, const char *options, int idle_timeout)
 {
-  /* XXX - We do the downloading in a 'transaction'.  If we get
-           interrupted half-way through, all the old files are kept in
-           place.  Libapt-pkg is careful not to leave partial files on
-           disk, but when more than one file needs to be downloaded
-           for a repository, we can still end up with an inconsistent
-           state.  Worse, the cleanup will remove the "Packages" files
-           when the corresponding "Release" has not been downloaded
-           yet.
+  const char *sudo_uid = getenv ("SUDO_UID");
+  int listen_fd = daemon_inherited_socket ();
+  int ready[2] = { -1, -1 };
+  char byte = 0;
+  pid_t pid;
 
-     Libapt-pkg should take care of this itself, but I am too much of
-     a chicken to make that change now.
-  */
+  if (listen_fd >= 0)
+    {
+      /* The service manager looks after us and the socket.
+       */
+      daemon_socket_inherited = true;
+    }
+  else
+    {
+      /* The parent returns when the socket is ready, so that whoever
+	 has started us can connect right away.  The child has to take
+	 the lock since locks are not inherited.
+      */
+      if (pipe (ready) < 0 || (pid = fork ()) < 0)
+	{
+	  log_stderr ("can't start daemon: %m");
+	  return 1;
+	}
 
-  int result = rescode_failure;
+      if (pid > 0)
+	{
+	  close (ready[1]);
+	  return read_all (ready[0], &byte, 1) ? 0 : 1;
+	}
 
-  string lists_val = _config->Find("Dir::State::Lists");
-  string lists_dir = _config->FindDir("Dir::State::Lists");
-  if (lists_dir.length() > 0 && lists_dir[lists_dir.length()-1] == '/')
-    lists_dir.erase(lists_dir.length()-1, 1);
+      close (ready[0]);
+      setsid ();
+    }
 
-  string lists_dir_new = lists_dir + ".new";
-  string lists_dir_old = lists_dir + ".old";
+  flag_daemon = true;
+  if (!set_sandbox (options))
+    return 1;
+  daemon_owner = sudo_uid ? atoi (sudo_uid) : getuid ();
+  daemon_idle_timeout = idle_timeout;
+  daemon_apply_options (options);
 
-  unlink_file_tree (lists_dir_new.c_str());
-  duplink_file_tree (lists_dir.c_str(), lists_dir_new.c_str());
-  _config->Set ("Dir::State::Lists", lists_dir_new);
+  if (!flag_sandbox)
+    get_apt_worker_lock (true);
 
-  if (download_lists (catalogues_for_report, 
-		      with_status, &result))
+  if (listen_fd < 0)
     {
-      /* complete transaction */
-      unlink_file_tree (lists_dir_old.c_str());
-      rename (lists_dir.c_str(), lists_dir_old.c_str());
-      rename (lists_dir_new.c_str(), lists_dir.c_str());
-      unlink_file_tree (lists_dir_old.c_str());
-      _config->Set ("Dir::State::Lists", lists_val);
-
-      cache_init (with_status);
+      listen_fd = daemon_listen (socket_name);
+      if (listen_fd < 0)
+	return 1;
     }
-  else
+
+  signal (SIGPIPE, daemon_sigpipe);
+  daemon_null_fd = open ("/dev/null", O_RDWR);
+
+  if (ready[1] >= 0)
     {
-      /* cleanup */
-      _config->Set ("Dir::State::Lists", lists_val);
-      unlink_file_tree (lists_dir_new.c_str());
+      write_all (ready[1], &byte, 1);
+      close (ready[1]);
     }
+  dup2 (daemon_null_fd, 0);
+  daemon_select (NULL);
 
-  return result;
-}
-
-static void
-reset_catalogue_errors (xexp *catalogues)
-{
-  /* Clean the catalogues errors */
-  clean_failed_catalogues ();
+  errno = 0;
+  if (nice (20) == -1 && errno != 0)
+    log_stderr ("nice: %m");
 
-  if (catalogues == NULL)
-    return;
+  misc_init (true);
+  stats_init ();
+  daemon_init_binary ();
 
-  for (xexp *c = xexp_first (catalogues); c; c = xexp_rest (c))
-    xexp_adel (c, "errors");
+  daemon_loop (listen_fd, socket_name);
+  return 0;
 }
 
-static gboolean
-update_sources_list (xexp *catalogues)
+int
+cmdline_daemon (char **argv)
 {
-  gboolean success = FALSE;
+  const char *socket_name = argv[1];
+  const char *options = argv[2];
 
-  /* Write the new sources list to disk */
-  success = (write_user_catalogues (catalogues)
-	     && write_sources_list (CATALOGUE_APT_SOURCE, catalogues));
+  if (socket_name == NULL || options == NULL)
+    usage ();
 
-  return success;
+  return daemon_main (socket_name, options, DAEMON_IDLE_TIMEOUT);
 }
 
-static gboolean
-add_temp_sources_list (xexp *tempcat)
+int
+cmdline_prestart (char **argv)
 {
-  gboolean success;
-
-  success = (xexp_write_file (TEMP_CATALOGUE_CONF, tempcat) &&
-             write_sources_list (TEMP_APT_SOURCE_LIST, tempcat));
+  if (daemon_running (APT_WORKER_SOCKET))
+    return 0;
 
-  return success;
+  return daemon_main (APT_WORKER_SOCKET, "", DAEMON_PRESTART_IDLE_TIMEOUT);
 }
 
-int
-cmd_check_updates (bool with_status)
+/* Let a running daemon check for updates.  Returns the exit code for
+   "apt-worker check-for-updates", or -1 when there is no daemon.
+*/
+static int
+daemon_check_for_updates (const char *http_proxy)
 {
-  xexp *catalogues = read_catalogues ();
-
-  reset_catalogue_errors (catalogues);
+  int fds[APT_FD_MAX];
+  apt_proto_encoder params;
+  int result_code = rescode_failure;
+  bool log_open = true;
 
-  /* Update sources.list file before refreshing */
-  update_sources_list (catalogues);
+  if (!apt_proto_connect_daemon (APT_WORKER_SOCKET, "", fds))
+    return -1;
 
-  int result_code = update_package_cache (catalogues, with_status);
+  signal (SIGPIPE, SIG_IGN);
 
-  if ((result_code == rescode_success)
-      || (result_code == rescode_partial_success))
+  /* The environment of the daemon is shared, so we only change it
+     when we have to.
+  */
+  if (http_proxy)
     {
-      /* Some packages with the 'system-update' could
-         appear / disappear under this conditions */
-      ssu_packages_needs_refresh = true;
+      apt_request_header req = { APTCMD_SET_ENV, 0, 0 };
+      params.encode_string (http_proxy);
+      params.encode_string (getenv ("https_proxy"));
+      params.encode_string (NULL);
+      params.encode_string (NULL);
+      req.len = params.get_len ();
+      write_all (fds[APT_FD_INPUT], &req, sizeof (req));
+      write_all (fds[APT_FD_INPUT], params.get_buf (), req.len);
     }
 
-  /* Save potential errors to disk */
-  save_failed_catalogues (catalogues);
+  apt_request_header req = { APTCMD_CHECK_UPDATES, 1, 0 };
+  if (!write_all (fds[APT_FD_INPUT], &req, sizeof (req)))
+    goto out;
 
-  response.encode_xexp (catalogues);
-  response.encode_int (result_code);
+  /* Wait for the response, ignoring status reports and passing on
+     the log.
+  */
+  while (true)
+    {
+      fd_set set;
+      int max_fd = fds[APT_FD_OUTPUT];
 
-  if (catalogues)
-    xexp_free (catalogues);
+      FD_ZERO (&set);
+      FD_SET (fds[APT_FD_OUTPUT], &set);
+      if (log_open)
+	{
+	  FD_SET (fds[APT_FD_LOG], &set);
+	  max_fd = MAX (max_fd, fds[APT_FD_LOG]);
+	}
 
-  return result_code;
-}
+      if (select (max_fd + 1, &set, NULL, NULL, NULL) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  goto out;
+	}
 
-int
-cmdline_check_updates (char **argv)
-{
-  AptWorkerCache * awc = 0;
-  int result_code = -1;
+      if (log_open && FD_ISSET (fds[APT_FD_LOG], &set))
+	{
+	  char buf[256];
+	  ssize_t n = read (fds[APT_FD_LOG], buf, sizeof (buf));
+	  if (n > 0)
+	    write_all (2, buf, n);
+	  else
+	    log_open = false;
+	}
 
-  awc = AptWorkerCache::GetCurrent ();
-  awc->init_cache_after_request = false;
+      if (FD_ISSET (fds[APT_FD_OUTPUT], &set))
+	{
+	  apt_response_header res;
+	  if (!read_all (fds[APT_FD_OUTPUT], &res, sizeof (res))
+	      || res.len < 0)
+	    goto out;
 
-  if (awc->cache == NULL)
-    return 2;
+	  char *buf = (char *) g_malloc (res.len);
+	  if (!read_all (fds[APT_FD_OUTPUT], buf, res.len))
+	    {
+	      g_free (buf);
+	      goto out;
+	    }
 
-  if (argv[1])
-    {
-      DBG ("http_proxy: %s", argv[1]);
-      setenv ("http_proxy", argv[1], 1);
+	  if (res.cmd == APTCMD_CHECK_UPDATES && res.seq == req.seq)
+	    {
+	      apt_proto_decoder dec (buf, res.len);
+	      xexp_free (dec.decode_xexp ());
+	      result_code = dec.decode_int ();
+	      if (dec.corrupted ())
+		result_code = rescode_failure;
+	      g_free (buf);
+	      break;
+	    }
+	  g_free (buf);
+	}
     }
 
-  response.reset ();
-  request.reset (NULL, 0);
-  result_code = cmd_check_updates (false);
-
-  _error->DumpErrors ();
+ out:
+  for (int i = 0; i < APT_FD_MAX; i++)
+    close (fds[i]);
 
   if (result_code == rescode_success
       || result_code == rescode_partial_success)
@@ -4466,7 +7112,8 @@ cmd_set_catalogues ()
   catalogues = mapped_catalogues;
 
   /* Update sources.list file */
-  update_sources_list (catalogues);
+  if (!flag_sandbox)
+    update_sources_list (catalogues);
 
   /* We should update catalogue cache after modify catalogues */
   need_cache_init ();
@@ -4982,6 +7629,8 @@ cmd_autoremove ()
 
   int result_code = rescode_failure;
 
+  awc->cache->touch_all ();
+
   // look over the cache to see what can be removed
   for (pkgCache::PkgIterator Pkg = cache.PkgBegin (); ! Pkg.end (); ++Pkg)
     {
@@ -5598,6 +8247,10 @@ operation (bool check_only,
   pkgCacheFile &Cache = *(awc->cache);
   SPtr<myDPkgPM> Pm;
 
+  /* The purge marks and the domains are not tracked.
+   */
+  awc->cache->touch_all ();
+
   if (_config->FindB("APT::Get::Purge",false) == true)
     {
       pkgCache::PkgIterator I = Cache->PkgBegin();
@@ -6351,6 +9004,9 @@ cmd_save_backup_data ()
 static void
 save_failed_catalogues (xexp *catalogues)
 {
+  if (flag_sandbox)
+    return;
+
   xexp *failed_catalogues = xexp_list_new ("catalogues");
 
   /* Save ONLY catalogues with errors */
@@ -6364,7 +9020,7 @@ save_failed_catalogues (xexp *catalogues)
     }
 
   if (xexp_length (failed_catalogues) > 0)
-    xexp_write_file (FAILED_CATALOGUES_FILE, failed_catalogues);
+    xexp_write_file_binary (FAILED_CATALOGUES_FILE, failed_catalogues);
   else
     clean_failed_catalogues ();
 
@@ -6409,6 +9065,9 @@ clean_failed_catalogues ()
 static void
 clean_temp_catalogues ()
 {
+  if (flag_sandbox)
+    return;
+
   if (unlink (TEMP_APT_SOURCE_LIST) < 0 && errno != ENOENT)
     log_stderr ("error unlinking %s: %m", TEMP_APT_SOURCE_LIST);
 }
@@ -6419,10 +9078,133 @@ write_available_updates_file ()
   if (!ensure_cache (false))
     return;
 
+  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
+  write_available_updates_file_1 (awc->cache, (pkgDepCache *) *(awc->cache));
+}
+
+/* The classification of each package is remembered between cache
+   generations, together with the installed and candidate versions
+   and the domain that it was based on.  Only packages for which one
+   of these has changed are looked up again.  Whether a package is
+   broken depends on the whole cache and is checked every time.
+
+   The resulting list is compared with what has been written last
+   (or what is on disk, initially), and the file is only rewritten
+   when its contents change.  That avoids waking up the status bar
+   plugin, which watches it.
+*/
+
+struct available_update {
+  char *installed_version;
+  char *candidate_version;
+  domain_t domain;
+  const char *kind;          // "os", "certified", "other" or NULL
+  char *name;
+  int generation;
+};
+
+static GHashTable *available_updates = NULL;
+static int available_updates_generation = 0;
+static xexp *last_available_updates = NULL;
+
+static void
+free_available_update (gpointer data)
+{
+  available_update *u = (available_update *)data;
+  g_free (u->installed_version);
+  g_free (u->candidate_version);
+  g_free (u->name);
+  delete u;
+}
+
+static gboolean
+available_update_is_stale (gpointer key, gpointer value, gpointer data)
+{
+  available_update *u = (available_update *)value;
+  return u->generation != available_updates_generation;
+}
+
+static bool
+same_version (const char *a, const char *b)
+{
+  return (a == NULL || b == NULL) ? a == b : strcmp (a, b) == 0;
+}
+
+/* Compute the classification of PKG from scratch.
+ */
+static void
+classify_available_update (available_update *u,
+			   pkgCache::PkgIterator &pkg,
+			   pkgCache::VerIterator &installed,
+			   pkgCache::VerIterator &candidate,
+			   package_record &rec)
+{
+  g_free (u->name);
+  u->name = NULL;
+  u->kind = NULL;
+
+  if (candidate.end ()
+      || installed.CompareVer (candidate) >= 0
+      || !is_user_package (candidate))
+    return;
+
+  rec.lookup(candidate);
+  int flags = get_flags (rec);
+
+  string pretty_name = get_pretty_name (rec);
+  if (!pretty_name.empty ())
+    u->name = g_strdup (pretty_name.c_str ());
+  else
+    u->name = g_strdup (pkg.Name ());
+
+  if (flags & pkgflag_system_update)
+    u->kind = "os";
+  else if (domains[u->domain].is_certified)
+    u->kind = "certified";
+  else
+    u->kind = "other";
+}
+
+static bool
+available_updates_equal (xexp *a, xexp *b)
+{
+  xexp *x, *y;
+
+  for (x = xexp_first (a), y = xexp_first (b);
+       x && y;
+       x = xexp_rest (x), y = xexp_rest (y))
+    {
+      if (!xexp_is_text (x) || !xexp_is_text (y)
+	  || strcmp (xexp_tag (x), xexp_tag (y))
+	  || strcmp (xexp_text (x), xexp_text (y)))
+	return false;
+    }
+
+  return x == NULL && y == NULL;
+}
+
+/* DEP_CACHE may be NULL, in which case candidate versions are taken
+   directly from the policy and packages are only considered broken
+   when dpkg has left them in a bad state.  CACHE_FILE must be the
+   current cache.
+*/
+static void
+write_available_updates_file_1 (myCacheFile *cache_file,
+				pkgDepCache *dep_cache)
+{
   xexp *x_updates = xexp_list_new ("updates");
   package_record rec;
-  AptWorkerCache *awc = AptWorkerCache::GetCurrent ();
-  pkgDepCache &cache = *(awc->cache);
+  pkgCache &cache = *cache_file;
+  pkgPolicy &policy = *cache_file->Policy;
+
+  if (available_updates == NULL)
+    {
+      available_updates = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free,
+						 free_available_update);
+      last_available_updates = xexp_read_file (AVAILABLE_UPDATES_FILE);
+    }
+  available_updates_generation += 1;
 
   for (pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end (); pkg++)
     {
@@ -6446,44 +9228,87 @@ write_available_updates_file ()
       */
 
       pkgCache::VerIterator installed = pkg.CurrentVer ();
-      pkgCache::VerIterator candidate = cache[pkg].CandidateVerIter(cache);
-      bool broken = (cache[pkg].NowBroken()
-		     || (pkg.State () != pkgCache::PkgIterator::NeedsNothing));
+      if (installed.end ())
+	continue;
 
-      if (!candidate.end ()
-	  && !installed.end()
-	  && installed.CompareVer (candidate) < 0
-	  && is_user_package (candidate)
-          && !broken)
+      pkgCache::VerIterator candidate =
+	(dep_cache
+	 ? (*dep_cache)[pkg].CandidateVerIter(*dep_cache)
+	 : policy.GetCandidateVer(pkg));
+      const char *installed_version = installed.VerStr ();
+      const char *candidate_version =
+	candidate.end () ? NULL : candidate.VerStr ();
+      domain_t domain = cache_file->extra_info[pkg->ID].cur_domain;
+
+      available_update *u =
+	(available_update *) g_hash_table_lookup (available_updates,
+						  pkg.Name ());
+      if (u == NULL)
+	{
+	  u = new available_update;
+	  u->installed_version = g_strdup (installed_version);
+	  u->candidate_version = g_strdup (candidate_version);
+	  u->domain = domain;
+	  u->name = NULL;
+	  g_hash_table_insert (available_updates, g_strdup (pkg.Name ()), u);
+	  classify_available_update (u, pkg, installed, candidate, rec);
+	}
+      else if (!same_version (u->installed_version, installed_version)
+	       || !same_version (u->candidate_version, candidate_version)
+	       || u->domain != domain)
 	{
-	  xexp *x_pkg = NULL;
+	  g_free (u->installed_version);
+	  g_free (u->candidate_version);
+	  u->installed_version = g_strdup (installed_version);
+	  u->candidate_version = g_strdup (candidate_version);
+	  u->domain = domain;
+	  classify_available_update (u, pkg, installed, candidate, rec);
+	}
+      u->generation = available_updates_generation;
 
-	  rec.lookup(candidate);
-	  int flags = get_flags (rec);
-	  int domain_index = awc->cache->extra_info[pkg->ID].cur_domain;
+      bool broken = ((dep_cache && (*dep_cache)[pkg].NowBroken())
+		     || (pkg.State () != pkgCache::PkgIterator::NeedsNothing));
 
-          const char *pkg_name;
-          string pretty_name = get_pretty_name (rec);
-          if (!pretty_name.empty ())
-            pkg_name = pretty_name.c_str ();
-          else
-            pkg_name = pkg.Name ();
+      if (u->kind && !broken)
+	xexp_cons (x_updates, xexp_text_new (u->kind, u->name));
+    }
 
-	  if (flags & pkgflag_system_update)
-	    x_pkg = xexp_text_new ("os", pkg_name);
-	  else if (domains[domain_index].is_certified)
-	    x_pkg = xexp_text_new ("certified", pkg_name);
-	  else
-	    x_pkg = xexp_text_new ("other", pkg_name);
+  g_hash_table_foreach_remove (available_updates,
+			       available_update_is_stale, NULL);
 
-	  xexp_cons (x_updates, x_pkg);
-	}
+  if (last_available_updates
+      && available_updates_equal (last_available_updates, x_updates))
+    {
+      xexp_free (x_updates);
+      return;
+    }
+
+  if (!flag_sandbox
+      && !xexp_write_file_binary (AVAILABLE_UPDATES_FILE, x_updates))
+    {
+      xexp_free (x_updates);
+      return;
     }
 
-  xexp_write_file (AVAILABLE_UPDATES_FILE, x_updates);
+  if (last_available_updates)
+    xexp_free (last_available_updates);
+  last_available_updates = x_updates;
+}
+
+/* Catalogues are matched by their uri, dist and components.  A
+   missing dist or components only matches another missing one.
+*/
+static char *
+catalogue_match_key (xexp *cat)
+{
+  const char *uri = xexp_aref_text (cat, "uri");
+  const char *dist = xexp_aref_text (cat, "dist");
+  const char *comp = xexp_aref_text (cat, "components");
 
-  if (x_updates)
-    xexp_free (x_updates);
+  return g_strdup_printf ("%s\n%c%s\n%c%s",
+			  uri ? uri : "",
+			  dist ? '=' : '-', dist ? dist : "",
+			  comp ? '=' : '-', comp ? comp : "");
 }
 
 static xexp *
@@ -6497,54 +9322,51 @@ merge_catalogues_with_errors (xexp *catalogues)
   /* Add errors (if present) for each catalogue */
   if (failed_catalogues != NULL)
     {
-      const char *uri = NULL, *f_uri = NULL;
-      const char *dist = NULL, *f_dist = NULL;
-      const char *comp = NULL, *f_comp = NULL;
+      /* Index the errors by catalogue, so that we don't have to scan
+	 all failed catalogues for every configured one.
+      */
+      GHashTable *errors_by_key =
+	g_hash_table_new_full (g_str_hash, g_str_equal,
+			       g_free, (GDestroyNotify) g_slist_free);
 
-      for (xexp *cat = xexp_first (catalogues); cat; cat = xexp_rest (cat))
+      for (xexp *f_cat = xexp_first (failed_catalogues); f_cat;
+	   f_cat = xexp_rest (f_cat))
 	{
-	  uri = xexp_aref_text (cat, "uri");
-	  dist = xexp_aref_text (cat, "dist");
-	  comp = xexp_aref_text (cat, "components");
+	  xexp *errors_item = xexp_aref (f_cat, "errors");
+	  if (errors_item == NULL)
+	    continue;
 
-	  /* Look for errors for this catalogue */
-	  for (xexp *f_cat = xexp_first (failed_catalogues); f_cat; f_cat = xexp_rest (f_cat))
+	  char *key = catalogue_match_key (f_cat);
+	  GSList *errors = (GSList *) g_hash_table_lookup (errors_by_key, key);
+	  if (errors)
 	    {
-	      f_uri = xexp_aref_text (f_cat, "uri");
-	      f_dist = xexp_aref_text (f_cat, "dist");
-	      f_comp = xexp_aref_text (f_cat, "components");
-
-	      /* If matches the uri (mandatory field), check the other ones */
-	      if (!strcmp (uri, f_uri))
-		{
-		  xexp *errors_item = NULL;
-
-		  /* 'dist' fields must be the same, or NULL, to continue */
-		  if ((dist == NULL || f_dist == NULL || strcmp (dist, f_dist)) &&
-		      !(dist == NULL && f_dist == NULL))
-		    continue;
+	      g_slist_append (errors, errors_item);
+	      g_free (key);
+	    }
+	  else
+	    g_hash_table_insert (errors_by_key, key,
+				 g_slist_prepend (NULL, errors_item));
+	}
 
-		  /* 'dist' fields must be the same, or NULL, to continue */
-		  if ((comp == NULL || f_comp == NULL || strcmp (comp, f_comp)) &&
-		      !(comp == NULL && f_comp == NULL))
-		    continue;
+      for (xexp *cat = xexp_first (catalogues); cat; cat = xexp_rest (cat))
+	{
+	  char *key = catalogue_match_key (cat);
+	  GSList *errors = (GSList *) g_hash_table_lookup (errors_by_key, key);
 
-		  /* If reached, errors would be about the same
-		     catalogue found in the configuration file */
-		  errors_item = xexp_aref (f_cat, "errors");
-		  if (errors_item != NULL)
-		    {
-		      /* Append a copy of errors to the catalogues xexp */
-		      xexp_append_1 (cat, xexp_copy (errors_item));
+	  /* Append a copy of the errors to the catalogues xexp */
+	  for (GSList *e = errors; e; e = e->next)
+	    xexp_append_1 (cat, xexp_copy ((xexp *) e->data));
 
-		      /* Delete the xexp from errors file, in order
-			 not to check it again in later checks */
-		      xexp_del (failed_catalogues, f_cat);
-		    }
-		}
-	    }
+	  /* Each error is only reported once, even if a catalogue is
+	     configured twice.
+	  */
+	  if (errors)
+	    g_hash_table_remove (errors_by_key, key);
+	  g_free (key);
 	}
 
+      g_hash_table_destroy (errors_by_key);
+
       /* Free the catalogues errors xexp */
       xexp_free (failed_catalogues);
     }
@@ -6874,7 +9696,7 @@ do_rescue (const char *package, const char *download_root,
 
   fs_setup (tmpfs);
 
-  misc_init ();
+  misc_init (true);
 
   // @todo Is this really necessary?
   AptWorkerCache::GetCurrent ()->init_cache_after_request = false;
@@ -26,6 +26,9 @@
    This utility is called on every boot.  It's purpose is to announce
    the successful updating of the operating system, if that was the
    reason for the boot.
+
+   It also starts apt-worker ahead of time, so that the Application
+   Manager finds it with its cache already loaded.
 */
 
 #include <unistd.h>
@@ -48,6 +51,26 @@
 /* This path is an implicit contract with apt-worker */
 #define RESCUE_RESULT_FILE "/var/lib/hildon-application-manager/rescue-result"
 
+#define APT_WORKER_CMD "/usr/libexec/apt-worker"
+
+/* See "DAEMON MODE" in apt-worker.cc.  This returns right away, the
+   daemon loads its cache in the background.
+*/
+static void
+prestart_apt_worker ()
+{
+  const char *args[] = { "/usr/bin/sudo", APT_WORKER_CMD, "prestart", NULL };
+  GError *error = NULL;
+
+  if (!g_spawn_async (NULL, (gchar **) args, NULL,
+		      G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+		      NULL, NULL, NULL, &error))
+    {
+      fprintf (stderr, "%s: %s\n", APT_WORKER_CMD, error->message);
+      g_error_free (error);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
@@ -56,6 +79,8 @@ main (int argc, char **argv)
   xexp *rescue_xexp = NULL;
   int rescue_success = 1;
 
+  prestart_apt_worker ();
+
   /* Check UFILE_BOOT flag file */
   f = user_file_open_for_read (UFILE_BOOT);
   if (f == NULL)
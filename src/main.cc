@@ -30,6 +30,7 @@
 #include <libintl.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib/gstdio.h>
 #include <gtk/gtk.h>
@@ -57,6 +58,8 @@
 #include "confutils.h"
 #include "update-notifier-conf.h"
 #include "hildon-fancy-button.h"
+#include "trace.h"
+#include "watchdog.h"
 
 #define MAX_PACKAGES_NO_CATEGORIES 7
 
@@ -178,6 +181,7 @@ view search_results_view = {
 static GtkWindow *main_window = NULL;
 
 static GList *install_sections = NULL;
+static GHashTable *install_section_index = NULL;
 static GList *upgradeable_packages = NULL;
 static GList *installed_packages = NULL;
 static GList *search_result_packages = NULL;
@@ -186,12 +190,16 @@ static GList *search_result_packages = NULL;
 enum package_list_state {
   pkg_list_unknown,
   pkg_list_retrieving,
+  pkg_list_cached,
   pkg_list_ready,
 };
 
 static package_list_state pkg_list_state = pkg_list_unknown;
 
-#define package_list_ready (pkg_list_state == pkg_list_ready)
+/* A cached list is shown like a ready one, see UFILE_PACKAGE_LIST.
+ */
+#define package_list_ready (pkg_list_state == pkg_list_ready \
+			    || pkg_list_state == pkg_list_cached)
 
 
 static int cur_section_rank;
@@ -275,7 +283,7 @@ suavarc_refresh_package_cache (gpointer data)
 
   if (cur_view_struct == &upgrade_applications_view)
     {
-      if (package_list_ready)
+      if (pkg_list_state == pkg_list_ready)
         refresh_package_cache_without_user_flow ();
       else
         return TRUE;
@@ -425,6 +433,11 @@ package_info::package_info ()
   dependencies = NULL;
 
   model = NULL;
+
+  installed_name_key = NULL;
+  available_name_key = NULL;
+  installed_version_key = NULL;
+  available_version_key = NULL;
 }
 
 package_info::~package_info ()
@@ -453,6 +466,10 @@ package_info::~package_info ()
       g_list_free (summary_packages[i]);
     }
   g_free (dependencies);
+  g_free (installed_name_key);
+  g_free (available_name_key);
+  g_free (installed_version_key);
+  g_free (available_version_key);
 }
 
 const char *
@@ -484,6 +501,32 @@ package_info::get_display_version (bool installed)
   return v;
 }
 
+const char *
+package_info::get_name_sort_key (bool installed)
+{
+  char **key = installed ? &installed_name_key : &available_name_key;
+
+  // Lowercasing once gives the same order as g_ascii_strcasecmp on
+  // every comparison.
+  if (*key == NULL)
+    *key = g_ascii_strdown (get_display_name (installed), -1);
+
+  return *key;
+}
+
+const char *
+package_info::get_version_sort_key (bool installed)
+{
+  char **key = installed ? &installed_version_key : &available_version_key;
+
+  if (*key == NULL)
+    *key = deb_version_sort_key (installed
+                                 ? installed_version
+                                 : available_version);
+
+  return *key;
+}
+
 void
 package_info::ref ()
 {
@@ -554,6 +597,12 @@ free_all_packages ()
       install_sections = NULL;
     }
 
+  if (install_section_index)
+    {
+      g_hash_table_destroy (install_section_index);
+      install_section_index = NULL;
+    }
+
   if (upgradeable_packages)
     {
       free_packages (upgradeable_packages);
@@ -573,6 +622,32 @@ free_all_packages ()
     }
 }
 
+/* Describe the current view and the sizes of the package lists for
+   the log of the main loop watchdog.
+*/
+static void
+describe_ui_state (GString *str)
+{
+  guint n_installable = 0;
+
+  for (GList *s = install_sections; s; s = s->next)
+    {
+      section_info *si = (section_info *) s->data;
+      if (si->rank != SECTION_RANK_ALL)
+	n_installable += g_list_length (si->packages);
+    }
+
+  g_string_append_printf (str,
+			  "view %d, %u sections, %u installable, "
+			  "%u upgradeable, %u installed, %u found",
+			  get_current_view_id (),
+			  g_list_length (install_sections),
+			  n_installable,
+			  g_list_length (upgradeable_packages),
+			  g_list_length (installed_packages),
+			  g_list_length (search_result_packages));
+}
+
 static const char *
 canonicalize_section_name (const char *name)
 {
@@ -626,10 +701,56 @@ nicify_section_name (const char *name)
   return name;
 }
 
+/* INSTALL_SECTION_INDEX maps "RANK/NAME" keys to the section_info
+   structs in INSTALL_SECTIONS, so that looking up a section while
+   building the list of available packages doesn't need to walk that
+   list.  It is maintained by create_section_info and
+   reindex_install_sections.
+*/
+
+static char *
+section_index_key (int rank, const char *name)
+{
+  return g_strdup_printf ("%d/%s", rank, name);
+}
+
+static void
+index_install_section (section_info *si)
+{
+  if (install_section_index == NULL)
+    install_section_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+
+  g_hash_table_replace (install_section_index,
+                        section_index_key (si->rank, si->name), si);
+}
+
+static void
+reindex_install_sections ()
+{
+  if (install_section_index)
+    g_hash_table_remove_all (install_section_index);
+
+  for (GList *ptr = install_sections; ptr; ptr = ptr->next)
+    index_install_section ((section_info *)ptr->data);
+}
+
 static section_info *
 find_section_info (GList **list_ptr,
 		   int rank, const char *name)
 {
+  if (list_ptr == &install_sections)
+    {
+      if (install_section_index == NULL)
+        return NULL;
+
+      char *key = section_index_key (rank, name);
+      section_info *si =
+        (section_info *) g_hash_table_lookup (install_section_index, key);
+      g_free (key);
+      return si;
+    }
+
   if (list_ptr)
     {
       for (GList *ptr = *list_ptr; ptr; ptr = ptr->next)
@@ -687,6 +808,33 @@ create_section_info (GList **list_ptr,
       si->packages = NULL;
       if (list_ptr)
 	*list_ptr = g_list_prepend (*list_ptr, si);
+      if (list_ptr == &install_sections)
+        index_install_section (si);
+    }
+
+  return si;
+}
+
+/* Like create_section_info for INSTALL_SECTIONS, but remembers the
+   result for each distinct raw SECTION string in SECTIONS_BY_RAW_NAME
+   so that the name is canonicalized and translated only once.
+   The keys are not copied, SECTION must outlive the table.
+*/
+static section_info *
+create_install_section_info (GHashTable *sections_by_raw_name,
+                             const char *section)
+{
+  if (section == NULL)
+    return create_section_info (&install_sections, SECTION_RANK_NORMAL, NULL);
+
+  section_info *si =
+    (section_info *) g_hash_table_lookup (sections_by_raw_name, section);
+
+  if (si == NULL)
+    {
+      si = create_section_info (&install_sections, SECTION_RANK_NORMAL,
+                                section);
+      g_hash_table_insert (sections_by_raw_name, (gpointer) section, si);
     }
 
   return si;
@@ -731,8 +879,8 @@ compare_package_installed_names (gconstpointer a, gconstpointer b)
   package_info *pi_b = (package_info *)b;
 
   return package_sort_sign *
-    g_ascii_strcasecmp (pi_a->get_display_name (true),
-			pi_b->get_display_name (true));
+    strcmp (pi_a->get_name_sort_key (true),
+            pi_b->get_name_sort_key (true));
 }
 
 static gint
@@ -747,17 +895,17 @@ compare_package_available_names (gconstpointer a, gconstpointer b)
   if (!result)
     {
       result = package_sort_sign *
-	g_ascii_strcasecmp (pi_a->get_display_name (false),
-			    pi_b->get_display_name (false));
+	strcmp (pi_a->get_name_sort_key (false),
+		pi_b->get_name_sort_key (false));
     }
 
   return result;
 }
 
 static gint
-compare_versions (const gchar *a, const gchar *b)
+compare_version_keys (const char *a, const char *b)
 {
-  return package_sort_sign * compare_deb_versions (a, b);
+  return package_sort_sign * strcmp (a, b);
 }
 
 static gint
@@ -766,7 +914,8 @@ compare_package_installed_versions (gconstpointer a, gconstpointer b)
   package_info *pi_a = (package_info *)a;
   package_info *pi_b = (package_info *)b;
 
-  return compare_versions (pi_a->installed_version, pi_b->installed_version);
+  return compare_version_keys (pi_a->get_version_sort_key (true),
+                               pi_b->get_version_sort_key (true));
 }
 
 static gint
@@ -781,20 +930,27 @@ compare_package_available_versions (gconstpointer a, gconstpointer b)
   if (!result)
     {
       result =
-	compare_versions (pi_a->available_version, pi_b->available_version);
+	compare_version_keys (pi_a->get_version_sort_key (false),
+			      pi_b->get_version_sort_key (false));
     }
 
   return result;
 }
 
+static gint
+compare_sizes (int64_t a, int64_t b)
+{
+  // Don't subtract, the difference might not fit into a gint.
+  return package_sort_sign * ((a > b) - (a < b));
+}
+
 static gint
 compare_package_installed_sizes (gconstpointer a, gconstpointer b)
 {
   package_info *pi_a = (package_info *)a;
   package_info *pi_b = (package_info *)b;
 
-  return (package_sort_sign *
-	  (pi_a->installed_size - pi_b->installed_size));
+  return compare_sizes (pi_a->installed_size, pi_b->installed_size);
 }
 
 static gint
@@ -811,8 +967,8 @@ compare_package_download_sizes (gconstpointer a, gconstpointer b)
   if (!result)
   {
     if (pi_a->have_info && pi_b->have_info)
-      result = (package_sort_sign *
-                (pi_a->info.download_size - pi_b->info.download_size));
+      result = compare_sizes (pi_a->info.download_size,
+                              pi_b->info.download_size);
     else if (pi_a->have_info)
       result = package_sort_sign;
     else if (pi_b->have_info)
@@ -827,6 +983,8 @@ compare_package_download_sizes (gconstpointer a, gconstpointer b)
 void
 sort_all_packages (bool refresh_view)
 {
+  WATCHDOG_SECTION;
+
   // If the first section is the "All" section, exclude it from the
   // sort.
   
@@ -884,8 +1042,61 @@ struct gpl_closure {
   void *data;
 };
 
+/* The last package list that has been received from apt-worker is
+   kept in UFILE_PACKAGE_LIST.  When we start, it is shown right away
+   while apt-worker is still building its cache, and it is replaced
+   when the fresh list arrives.  The file has a "package-list" xexp
+   with a "pkg" child for each package, and remembers for which
+   settings the list has been requested.
+
+   The file also holds a checksum of the rest of its contents.  It is
+   only written again when a fresh list has a different checksum, and
+   that is done from an idle callback so that showing the list comes
+   first.
+*/
+
+static char *package_list_checksum = NULL;
+static xexp *package_list_to_write = NULL;
+
+static bool
+package_list_only_user ()
+{
+  return !(red_pill_mode && red_pill_show_all);
+}
+
+static bool
+package_list_show_magic_sys ()
+{
+  return red_pill_mode && red_pill_show_magic_sys;
+}
+
+static void
+cache_text (xexp *x, const char *tag, const char *text)
+{
+  if (text)
+    xexp_cons (x, xexp_text_new (tag, text));
+}
+
+static void
+set_package_icons (package_info *info,
+		   const char *installed_icon, const char *available_icon)
+{
+  info->installed_icon = pixbuf_from_base64 (installed_icon);
+  if (available_icon)
+    info->available_icon = pixbuf_from_base64 (available_icon);
+  else
+    {
+      info->available_icon = info->installed_icon;
+      if (info->available_icon)
+	g_object_ref (info->available_icon);
+    }
+}
+
+/* Decode the next package from DEC.  When CACHE is not NULL, the
+   package is also added to it.
+*/
 static package_info *
-get_package_list_entry (apt_proto_decoder *dec)
+get_package_list_entry (apt_proto_decoder *dec, xexp *cache)
 {
   const char *installed_icon, *available_icon;
   package_info *info = new package_info;
@@ -905,19 +1116,67 @@ get_package_list_entry (apt_proto_decoder *dec)
   available_icon = dec->decode_string_in_place ();
   info->flags = dec->decode_int ();
   
-  info->installed_icon = pixbuf_from_base64 (installed_icon);
-  if (available_icon)
-    info->available_icon = pixbuf_from_base64 (available_icon);
-  else
-    {
-      info->available_icon = info->installed_icon;
-      if (info->available_icon)
-	g_object_ref (info->available_icon);
+  set_package_icons (info, installed_icon, available_icon);
+
+  if (cache)
+    {
+      xexp *x = xexp_list_new ("pkg");
+      char *size = g_strdup_printf ("%lld", (long long) info->installed_size);
+
+      cache_text (x, "name", info->name);
+      xexp_aset_bool (x, "broken", info->broken);
+      cache_text (x, "installed-version", info->installed_version);
+      cache_text (x, "installed-size", size);
+      cache_text (x, "installed-section", info->installed_section);
+      cache_text (x, "installed-pretty-name", info->installed_pretty_name);
+      cache_text (x, "installed-short-description",
+		  info->installed_short_description);
+      cache_text (x, "installed-icon", installed_icon);
+      cache_text (x, "available-version", info->available_version);
+      cache_text (x, "available-section", info->available_section);
+      cache_text (x, "available-pretty-name", info->available_pretty_name);
+      cache_text (x, "available-short-description",
+		  info->available_short_description);
+      cache_text (x, "available-icon", available_icon);
+      xexp_aset_int (x, "flags", info->flags);
+      xexp_cons (cache, x);
+
+      g_free (size);
     }
 
   return info;
 }
 
+static package_info *
+get_cached_package_list_entry (xexp *x)
+{
+  package_info *info = new package_info;
+  const char *size = xexp_aref_text (x, "installed-size");
+
+  info->name = g_strdup (xexp_aref_text (x, "name"));
+  info->broken = xexp_aref_bool (x, "broken");
+  info->installed_version = g_strdup (xexp_aref_text (x, "installed-version"));
+  info->installed_size = size ? g_ascii_strtoll (size, NULL, 10) : 0;
+  info->installed_section = g_strdup (xexp_aref_text (x, "installed-section"));
+  info->installed_pretty_name =
+    g_strdup (xexp_aref_text (x, "installed-pretty-name"));
+  info->installed_short_description =
+    g_strdup (xexp_aref_text (x, "installed-short-description"));
+  info->available_version = g_strdup (xexp_aref_text (x, "available-version"));
+  info->available_section = g_strdup (xexp_aref_text (x, "available-section"));
+  info->available_pretty_name =
+    g_strdup (xexp_aref_text (x, "available-pretty-name"));
+  info->available_short_description =
+    g_strdup (xexp_aref_text (x, "available-short-description"));
+  info->flags = xexp_aref_int (x, "flags", 0);
+
+  set_package_icons (info,
+		     xexp_aref_text (x, "installed-icon"),
+		     xexp_aref_text (x, "available-icon"));
+
+  return info;
+}
+
 static bool
 is_user_section (const char *section)
 {
@@ -949,70 +1208,327 @@ package_visible (package_info *pi, bool installed)
   return is_user_section (sect) && !is_debug_section(sect);
 }
 
+static void
+add_package_to_lists (package_info *info, section_info *all_si,
+		      GHashTable *sections_by_raw_name)
+{
+  if (info->available_version
+      && package_visible (info, false))
+    {
+      if (info->installed_version)
+	{
+	  info->ref ();
+	  upgradeable_packages = g_list_prepend (upgradeable_packages,
+						 info);
+	}
+      else
+	{
+	  section_info *sec =
+	    create_install_section_info (sections_by_raw_name,
+					 info->available_section);
+	  info->ref ();
+	  sec->packages = g_list_prepend (sec->packages, info);
+
+	  info->ref ();
+	  all_si->packages = g_list_prepend (all_si->packages, info);
+	}
+    }
+
+  if (info->installed_version
+      && package_visible (info, true))
+    {
+      info->ref ();
+      installed_packages = g_list_prepend (installed_packages,
+					   info);
+    }
+}
+
+static void
+finish_install_sections (section_info *all_si)
+{
+  if (g_list_length (all_si->packages) <= MAX_PACKAGES_NO_CATEGORIES)
+    {
+      free_sections (install_sections);
+      install_sections = g_list_prepend (NULL, all_si);
+    }
+  else  if (g_list_length (install_sections) >= 2)
+    install_sections = g_list_prepend (install_sections, all_si);
+  else
+    all_si->unref ();
+
+  reindex_install_sections ();
+}
+
+static void
+show_cached_package_list ()
+{
+  WATCHDOG_SECTION;
+
+  xexp *cache = user_file_read_xexp (UFILE_PACKAGE_LIST);
+  if (cache == NULL)
+    return;
+
+  if (!xexp_is_list (cache)
+      || xexp_aref_bool (cache, "only-user") != package_list_only_user ()
+      || (xexp_aref_bool (cache, "magic-sys")
+	  != package_list_show_magic_sys ()))
+    {
+      xexp_free (cache);
+      return;
+    }
+
+  section_info *all_si = create_section_info (NULL, SECTION_RANK_ALL, NULL);
+  GHashTable *sections_by_raw_name = g_hash_table_new (g_str_hash,
+						       g_str_equal);
+
+  for (xexp *x = xexp_first (cache); x; x = xexp_rest (x))
+    if (xexp_is (x, "pkg") && xexp_aref_text (x, "name"))
+      {
+	package_info *info = get_cached_package_list_entry (x);
+	add_package_to_lists (info, all_si, sections_by_raw_name);
+	info->unref ();
+      }
+
+  g_hash_table_destroy (sections_by_raw_name);
+  finish_install_sections (all_si);
+
+  g_free (package_list_checksum);
+  package_list_checksum = g_strdup (xexp_aref_text (cache, "checksum"));
+  xexp_free (cache);
+
+  pkg_list_state = pkg_list_cached;
+  sort_all_packages (cur_view_struct != &main_view);
+}
+
+static void
+unref_package_info (gpointer data)
+{
+  ((package_info *) data)->unref ();
+}
+
+/* Drop the packages of the cached list, but keep them by name so that
+   they can be used again when they haven't changed.  Then the details
+   that have already been retrieved for them don't need to be
+   retrieved again.
+*/
+static GHashTable *
+forget_cached_package_list ()
+{
+  GHashTable *packages =
+    g_hash_table_new_full (g_str_hash, g_str_equal, NULL, unref_package_info);
+  GList *lists = g_list_concat (g_list_copy (installed_packages),
+				g_list_copy (upgradeable_packages));
+
+  for (GList *s = install_sections; s; s = s->next)
+    lists = g_list_concat (lists,
+			   g_list_copy (((section_info *)s->data)->packages));
+
+  for (GList *p = lists; p; p = p->next)
+    {
+      package_info *pi = (package_info *)p->data;
+      if (!g_hash_table_lookup (packages, pi->name))
+	{
+	  pi->ref ();
+	  g_hash_table_insert (packages, pi->name, pi);
+	}
+    }
+  g_list_free (lists);
+
+  clear_global_package_list ();
+  clear_global_section_list ();
+  get_package_infos_in_background (NULL);
+  free_all_packages ();
+
+  return packages;
+}
+
+/* Drop the cached list when the fresh one could not be retrieved, so
+   that it isn't taken for the real thing.
+*/
+static void
+drop_cached_package_list ()
+{
+  if (pkg_list_state == pkg_list_cached)
+    g_hash_table_destroy (forget_cached_package_list ());
+}
+
+static bool
+same_string (const char *a, const char *b)
+{
+  return a == b || (a && b && !strcmp (a, b));
+}
+
+static void
+take_string (char *&to, char *&from)
+{
+  g_free (to);
+  to = from;
+  from = NULL;
+}
+
+static void
+take_icon (GdkPixbuf *&to, GdkPixbuf *&from)
+{
+  if (to)
+    g_object_unref (to);
+  to = from;
+  from = NULL;
+}
+
+/* Return the package from CACHED_PACKAGES instead of INFO if it has
+   the same versions, so that the details retrieved for it are kept.
+   The names, descriptions, size and icons can change without a new
+   version, so they are taken from INFO, and the name sort keys are
+   computed again.
+*/
+static package_info *
+reuse_cached_package (GHashTable *cached_packages, package_info *info)
+{
+  package_info *old =
+    (package_info *) g_hash_table_lookup (cached_packages, info->name);
+
+  if (old
+      && old->broken == info->broken
+      && old->flags == info->flags
+      && same_string (old->installed_version, info->installed_version)
+      && same_string (old->installed_section, info->installed_section)
+      && same_string (old->available_version, info->available_version)
+      && same_string (old->available_section, info->available_section))
+    {
+      old->installed_size = info->installed_size;
+      take_string (old->installed_pretty_name, info->installed_pretty_name);
+      take_string (old->available_pretty_name, info->available_pretty_name);
+      take_string (old->installed_short_description,
+		   info->installed_short_description);
+      take_string (old->available_short_description,
+		   info->available_short_description);
+      take_icon (old->installed_icon, info->installed_icon);
+      take_icon (old->available_icon, info->available_icon);
+
+      g_free (old->installed_name_key);
+      g_free (old->available_name_key);
+      old->installed_name_key = NULL;
+      old->available_name_key = NULL;
+
+      info->unref ();
+      old->ref ();
+      return old;
+    }
+
+  return info;
+}
+
+static void
+checksum_string (GChecksum *sum, const char *str)
+{
+  g_checksum_update (sum, (const guchar *) str, strlen (str) + 1);
+}
+
+static void
+checksum_xexp (GChecksum *sum, xexp *x)
+{
+  checksum_string (sum, xexp_tag (x));
+  if (xexp_is_text (x))
+    {
+      checksum_string (sum, "text");
+      checksum_string (sum, xexp_text (x));
+    }
+  else
+    {
+      checksum_string (sum, "list");
+      for (xexp *y = xexp_first (x); y; y = xexp_rest (y))
+	checksum_xexp (sum, y);
+      checksum_string (sum, "end");
+    }
+}
+
+static gboolean
+write_package_list_idle (gpointer data)
+{
+  user_file_write_xexp_binary (UFILE_PACKAGE_LIST, package_list_to_write);
+  xexp_free (package_list_to_write);
+  package_list_to_write = NULL;
+  return FALSE;
+}
+
+/* Arrange for CACHE to be written to UFILE_PACKAGE_LIST unless the
+   file has the same contents already.  CACHE is taken over.
+*/
+static void
+save_package_list (xexp *cache)
+{
+  GChecksum *sum = g_checksum_new (G_CHECKSUM_MD5);
+  checksum_xexp (sum, cache);
+  char *checksum = g_strdup (g_checksum_get_string (sum));
+  g_checksum_free (sum);
+
+  if (same_string (checksum, package_list_checksum))
+    {
+      g_free (checksum);
+      xexp_free (cache);
+      return;
+    }
+
+  g_free (package_list_checksum);
+  package_list_checksum = checksum;
+  xexp_aset_text (cache, "checksum", checksum);
+
+  if (package_list_to_write)
+    xexp_free (package_list_to_write);
+  else
+    g_idle_add (write_package_list_idle, NULL);
+  package_list_to_write = cache;
+}
+
 static void
 get_package_list_reply (int cmd, apt_proto_decoder *dec, void *data)
 {
   gpl_closure *c = (gpl_closure *)data;
+  WATCHDOG_SECTION;
 
   hide_updating ();
 
   if (dec == NULL)
-    ;
+    drop_cached_package_list ();
   else if (dec->decode_int () == 0)
-    what_the_fock_p ();
+    {
+      drop_cached_package_list ();
+      what_the_fock_p ();
+    }
   else
     {
+      GHashTable *cached_packages = NULL;
+      xexp *cache = xexp_list_new ("package-list");
+
+      if (pkg_list_state == pkg_list_cached)
+	cached_packages = forget_cached_package_list ();
+
       section_info *all_si = create_section_info (NULL, SECTION_RANK_ALL, NULL);
+      GHashTable *sections_by_raw_name = g_hash_table_new (g_str_hash,
+                                                           g_str_equal);
 
       while (!dec->at_end ())
 	{
 	  package_info *info = NULL;
 
-	  info = get_package_list_entry (dec);
-
-	  if (info->available_version
-	      && package_visible (info, false))
-	    {
-	      if (info->installed_version)
-		{
-		  info->ref ();
-		  upgradeable_packages = g_list_prepend (upgradeable_packages,
-							 info);
-		}
-	      else
-		{
-		  section_info *sec =
-		    create_section_info (&install_sections,
-					 SECTION_RANK_NORMAL,
-					 info->available_section);
-		  info->ref ();
-		  sec->packages = g_list_prepend (sec->packages, info);
-
-		  info->ref ();
-		  all_si->packages = g_list_prepend (all_si->packages, info);
-		}
-	    }
-
-	  if (info->installed_version
-	      && package_visible (info, true))
-	    {
-	      info->ref ();
-	      installed_packages = g_list_prepend (installed_packages,
-						   info);
-	    }
+	  info = get_package_list_entry (dec, cache);
+	  if (cached_packages)
+	    info = reuse_cached_package (cached_packages, info);
 
+	  add_package_to_lists (info, all_si, sections_by_raw_name);
 	  info->unref ();
 	}
 
-      if (g_list_length (all_si->packages) <= MAX_PACKAGES_NO_CATEGORIES)
-	{
-	  free_sections (install_sections);
-	  install_sections = g_list_prepend (NULL, all_si);
-	}
-      else  if (g_list_length (install_sections) >= 2)
-	install_sections = g_list_prepend (install_sections, all_si);
-      else
-	all_si->unref ();
+      g_hash_table_destroy (sections_by_raw_name);
+      if (cached_packages)
+	g_hash_table_destroy (cached_packages);
+
+      finish_install_sections (all_si);
+
+      xexp_reverse (cache);
+      xexp_aset_bool (cache, "only-user", package_list_only_user ());
+      xexp_aset_bool (cache, "magic-sys", package_list_show_magic_sys ());
+      save_package_list (cache);
     }
 
   pkg_list_state = pkg_list_ready;
@@ -1048,22 +1564,26 @@ get_package_list_with_cont (void (*cont) (void *data), void *data)
   c->cont = cont;
   c->data = data;
 
-  clear_global_package_list ();
-  clear_global_section_list ();
-
-  /* Mark package list as not ready and cancel the package info
+  /* A cached list is shown until the fresh one arrives.  Otherwise,
+     mark package list as not ready and cancel the package info
      getting in the background before freeing the list
   */
-  pkg_list_state = pkg_list_retrieving;
-  get_package_infos_in_background (NULL);
-  free_all_packages ();
+  if (pkg_list_state != pkg_list_cached)
+    {
+      clear_global_package_list ();
+      clear_global_section_list ();
+
+      pkg_list_state = pkg_list_retrieving;
+      get_package_infos_in_background (NULL);
+      free_all_packages ();
+    }
 
   show_updating ();
-  apt_worker_get_package_list (!(red_pill_mode && red_pill_show_all),
+  apt_worker_get_package_list (package_list_only_user (),
 			       false, 
 			       false, 
 			       NULL,
-			       red_pill_mode && red_pill_show_magic_sys,
+			       package_list_show_magic_sys (),
 			       get_package_list_reply, c);
 }
 
@@ -1179,13 +1699,44 @@ gpis_loop (package_info *pi, void *data, bool unused)
 }
 
 /* GET_PACKAGE_INFOS_IN_BACKGROUND
+
+   The packages are handed to apt-worker in batches so that it can
+   simulate them in parallel when the device allows it.  A batch that
+   is already in flight when the list is replaced is still completed.
+
+   An interactive request has to wait for the current batch, so a
+   batch is only as big as apt-worker can spread over the processors,
+   GPIIB_BATCH_PER_CPU for each, which is MIN_SIMULATIONS_PER_PROCESS
+   in apt-worker.cc.  With a single processor, the packages are
+   handed over one by one.
  */
 
+#define GPIIB_BATCH_PER_CPU    8
+#define GPIIB_MAX_BATCH_SIZE  32
+
 static void gpiib_trigger ();
-static void gpiib_done (package_info *pi, void *unused, bool changed);
+static void gpiib_reply (int cmd, apt_proto_decoder *dec, void *data);
 
 static GList *gpiib_next;
 
+static guint
+gpiib_batch_size ()
+{
+  static guint size = 0;
+
+  if (size == 0)
+    {
+      long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+      if (n_cpus <= 1)
+	size = 1;
+      else
+	size = MIN (GPIIB_BATCH_PER_CPU * n_cpus, GPIIB_MAX_BATCH_SIZE);
+    }
+
+  return size;
+}
+
 static void
 get_package_infos_in_background (GList *packages)
 {
@@ -1196,19 +1747,54 @@ get_package_infos_in_background (GList *packages)
 static void
 gpiib_trigger ()
 {
-  GList *n = gpiib_next;
-  if (n)
+  GPtrArray *batch = g_ptr_array_new ();
+  const char *names[GPIIB_MAX_BATCH_SIZE + 1];
+  guint batch_size = gpiib_batch_size ();
+
+  while (gpiib_next && batch->len < batch_size)
     {
-      package_info *pi = (package_info *)n->data;
-      gpiib_next = n->next;
-      get_package_info (pi, true,
-			gpiib_done, NULL);
+      package_info *pi = (package_info *)gpiib_next->data;
+      gpiib_next = gpiib_next->next;
+      if (!pi->have_info)
+	{
+	  names[batch->len] = pi->name;
+	  g_ptr_array_add (batch, pi);
+	  pi->ref ();
+	}
     }
+  names[batch->len] = NULL;
+
+  if (batch->len > 0)
+    apt_worker_get_package_infos (names, true, gpiib_reply, batch);
+  else
+    g_ptr_array_free (batch, TRUE);
 }
 
 static void 
-gpiib_done (package_info *pi, void *data, bool changed)
+gpiib_reply (int cmd, apt_proto_decoder *dec, void *data)
 {
+  GPtrArray *batch = (GPtrArray *)data;
+  bool changed = false;
+
+  for (guint i = 0; i < batch->len; i++)
+    {
+      package_info *pi = (package_info *)g_ptr_array_index (batch, i);
+
+      pi->have_info = false;
+      if (dec)
+	{
+	  dec->decode_mem (&(pi->info), sizeof (pi->info));
+	  if (!dec->corrupted ())
+	    {
+	      pi->have_info = true;
+	      global_package_info_changed (pi);
+	      changed = true;
+	    }
+	}
+      pi->unref ();
+    }
+  g_ptr_array_free (batch, TRUE);
+
   gpiib_trigger ();
 
   /* Resort & refresh view
@@ -1816,12 +2402,12 @@ update_seen_updates_file (void)
     }
 
   /* Write it to disk */
-  user_file_write_xexp (UFILE_SEEN_UPDATES, seen_updates);
+  user_file_write_xexp_binary (UFILE_SEEN_UPDATES, seen_updates);
   xexp_free (seen_updates);
 
   /* Clean the tapped updates */
   xexp *tapped_updates = xexp_list_new ("updates");
-  user_file_write_xexp (UFILE_TAPPED_UPDATES, tapped_updates);
+  user_file_write_xexp_binary (UFILE_TAPPED_UPDATES, tapped_updates);
   xexp_free (tapped_updates);
 }
 
@@ -2022,7 +2608,7 @@ search_packages_reply (int cmd, apt_proto_decoder *dec, void *data)
       const char *name = NULL;
       package_info *info = NULL;
 
-      info = get_package_list_entry (dec);
+      info = get_package_list_entry (dec, NULL);
       name = info->name;
 
       if (parent == &install_applications_view)
@@ -2835,6 +3421,7 @@ void maybe_init_packages_list (void)
   if (initial_packages_available || (pkg_list_state != pkg_list_unknown))
     return;
 
+  show_cached_package_list ();
   get_package_list_with_cont (notice_initial_packages_available, NULL);
   save_backup_data ();
 }
@@ -2863,6 +3450,8 @@ main (int argc, char **argv)
       argv++;
     }
 
+  trace_init ();
+
   setlocale (LC_ALL, "");
   bind_textdomain_codeset ("hildon-application-manager", "UTF-8");
   textdomain ("hildon-application-manager");
@@ -2899,6 +3488,9 @@ main (int argc, char **argv)
 
   clear_log ();
 
+  watchdog_set_describe_func (describe_ui_state);
+  watchdog_init ();
+
   g_signal_connect (G_OBJECT (main_window), "destroy",
                     G_CALLBACK (window_destroy), NULL);
 
@@ -90,8 +90,17 @@ struct package_info {
   GtkTreeModel *model;
   GtkTreeIter iter;
 
+  // Collation keys for sorting, computed on first use.  They can be
+  // compared with strcmp.
+  char *installed_name_key;
+  char *available_name_key;
+  char *installed_version_key;
+  char *available_version_key;
+
   const char *get_display_name (bool installed);
   const char *get_display_version (bool installed);
+  const char *get_name_sort_key (bool installed);
+  const char *get_version_sort_key (bool installed);
 };
 
 view_id get_current_view_id ();
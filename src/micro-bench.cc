@@ -0,0 +1,661 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* micro-bench -- measure the primitives on the hot paths
+
+   Usage: micro-bench [-t SECONDS] [-s SCALE] [FILTER...]
+
+   This program runs a set of small benchmarks of xexp.c,
+   apt-worker-proto.cc and confutils.cc on synthetic data that looks
+   like what is found on devices:
+
+   - a catalogue file with a few hundred catalogues and an available
+     updates file with thousands of entries, read and written in the
+     XML and the binary format
+
+   - the response to APTCMD_GET_PACKAGE_LIST for a couple of thousand
+     packages, encoded and decoded with apt_proto_encoder and
+     apt_proto_decoder, and a catalogue list sent as a xexp
+
+   - catalogue_equal and find_catalogue over hundreds of catalogues,
+     for both hits and misses
+
+   Each benchmark runs for at least SECONDS (0.5 by default) and
+   reports its time per operation, operations per second, throughput
+   for those that work on a file or a buffer, and the number and size
+   of memory allocations per operation.  SCALE multiplies the size of
+   the synthetic data.  Only benchmarks whose name contains one of the
+   FILTERs are run, if any are given.  The results are written to
+   stdout as JSON.
+
+   Allocations are counted by wrapping malloc and friends, so
+   everything is included: GLib, libstdc++ and the raw realloc calls of
+   the protocol encoder.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+extern "C" {
+#include "xexp.h"
+}
+
+#include "apt-worker-proto.h"
+#include "confutils.h"
+
+#define DEFAULT_SECONDS    0.5
+#define DEFAULT_SCALE      1
+
+#define N_CATALOGUES       300
+#define N_UPDATES          5000
+#define N_PACKAGES         2000
+#define N_PROBES           64
+
+/** ALLOCATION COUNTING
+
+    These replace the allocator of the C library for the whole
+    program.  Only glibc exports the __libc_* entry points that they
+    forward to.
+*/
+
+extern "C" {
+  void *__libc_malloc (size_t);
+  void *__libc_calloc (size_t, size_t);
+  void *__libc_realloc (void *, size_t);
+  void __libc_free (void *);
+}
+
+static unsigned long n_allocs;
+static unsigned long n_alloc_bytes;
+
+extern "C" void *
+malloc (size_t size)
+{
+  n_allocs++;
+  n_alloc_bytes += size;
+  return __libc_malloc (size);
+}
+
+extern "C" void *
+calloc (size_t n, size_t size)
+{
+  n_allocs++;
+  n_alloc_bytes += n * size;
+  return __libc_calloc (n, size);
+}
+
+extern "C" void *
+realloc (void *ptr, size_t size)
+{
+  n_allocs++;
+  n_alloc_bytes += size;
+  return __libc_realloc (ptr, size);
+}
+
+extern "C" void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+
+/** HARNESS
+ */
+
+static double min_seconds = DEFAULT_SECONDS;
+static int scale = DEFAULT_SCALE;
+static char **filters;
+static bool first_result = true;
+
+static double
+now_seconds ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static bool
+selected (const char *name)
+{
+  if (filters == NULL || filters[0] == NULL)
+    return true;
+
+  for (char **f = filters; *f; f++)
+    if (strstr (name, *f))
+      return true;
+
+  return false;
+}
+
+/* Run FUNC with DATA until MIN_SECONDS have passed and report the
+   result as NAME.  BYTES is the amount of data that one call of FUNC
+   processes, or zero when throughput makes no sense.
+*/
+static void
+run (const char *name, void (*func) (void *data), void *data, size_t bytes)
+{
+  if (!selected (name))
+    return;
+
+  /* Warm up, and don't count what happens only the first time, such
+     as interning tags.
+  */
+  func (data);
+
+  unsigned long ops = 0;
+  unsigned long allocs_start = n_allocs;
+  unsigned long bytes_start = n_alloc_bytes;
+  double start = now_seconds (), elapsed;
+
+  do
+    {
+      /* Check the time only every few calls for the fast ones.
+       */
+      for (int i = 0; i < 16; i++)
+	func (data);
+      ops += 16;
+      elapsed = now_seconds () - start;
+    }
+  while (elapsed < min_seconds);
+
+  double allocs = (n_allocs - allocs_start) / (double) ops;
+  double alloc_bytes = (n_alloc_bytes - bytes_start) / (double) ops;
+
+  printf ("%s\n    \"%s\": { \"ops\": %lu, \"ns_per_op\": %.1f,"
+	  " \"ops_per_sec\": %.1f",
+	  first_result ? "" : ",", name, ops,
+	  elapsed * 1e9 / ops, ops / elapsed);
+  if (bytes > 0)
+    printf (", \"bytes_per_op\": %lu, \"mb_per_sec\": %.2f",
+	    (unsigned long) bytes, bytes * ops / elapsed / (1024 * 1024));
+  printf (", \"allocs_per_op\": %.1f, \"alloc_bytes_per_op\": %.1f }",
+	  allocs, alloc_bytes);
+  fflush (stdout);
+  first_result = false;
+}
+
+static size_t
+file_size (const char *filename)
+{
+  FILE *f = fopen (filename, "r");
+  long size = 0;
+
+  if (f)
+    {
+      fseek (f, 0, SEEK_END);
+      size = ftell (f);
+      fclose (f);
+    }
+  return size;
+}
+
+/** SYNTHETIC DATA
+ */
+
+static xexp *
+make_catalogue (int i)
+{
+  xexp *cat = xexp_list_new ("catalogue");
+  char buf[256];
+
+  /* Every tenth catalogue has a localized name, like the ones that
+     come with the system.
+  */
+  if (i % 10 == 0)
+    {
+      xexp *name = xexp_list_new ("name");
+      snprintf (buf, sizeof (buf), "Catalogue %d", i);
+      xexp_append_1 (name, xexp_text_new ("en_GB", buf));
+      snprintf (buf, sizeof (buf), "Katalog %d", i);
+      xexp_append_1 (name, xexp_text_new ("de_DE", buf));
+      snprintf (buf, sizeof (buf), "Catalogue numéro %d", i);
+      xexp_append_1 (name, xexp_text_new ("fr_FR", buf));
+      xexp_append_1 (cat, name);
+    }
+  else
+    {
+      snprintf (buf, sizeof (buf), "Catalogue %d", i);
+      xexp_append_1 (cat, xexp_text_new ("name", buf));
+    }
+
+  snprintf (buf, sizeof (buf),
+	    "http://repository.example.com/extras-%d/", i / 3);
+  xexp_append_1 (cat, xexp_text_new ("uri", buf));
+  snprintf (buf, sizeof (buf), "fremantle-%d", i % 3);
+  xexp_append_1 (cat, xexp_text_new ("dist", buf));
+  xexp_append_1 (cat, xexp_text_new ("components",
+				     (i % 2) ? "free non-free" : "free"));
+
+  if (i % 4 == 0)
+    {
+      snprintf (buf, sizeof (buf), "com.example.catalogue.%d", i);
+      xexp_append_1 (cat, xexp_text_new ("id", buf));
+      xexp_append_1 (cat, xexp_text_new ("file", "example.xexp"));
+    }
+  if (i % 5 == 0)
+    xexp_append_1 (cat, xexp_list_new ("disabled"));
+
+  return cat;
+}
+
+static xexp *
+make_catalogues (int n)
+{
+  xexp *cats = xexp_list_new ("catalogues");
+  for (int i = 0; i < n; i++)
+    xexp_append_1 (cats, make_catalogue (i));
+  return cats;
+}
+
+static xexp *
+make_updates (int n)
+{
+  static const char *kinds[] = { "os", "certified", "other" };
+  xexp *updates = xexp_list_new ("updates");
+  char buf[64];
+
+  for (int i = 0; i < n; i++)
+    {
+      snprintf (buf, sizeof (buf), "package-%05d", i);
+      xexp_append_1 (updates, xexp_text_new (kinds[i % 3], buf));
+    }
+  return updates;
+}
+
+/* An icon takes about 1.5k in base64, and only some packages have
+   one.
+*/
+static char *
+make_icon ()
+{
+  char *icon = (char *) g_malloc (1537);
+  for (int i = 0; i < 1536; i++)
+    icon[i] = 'A' + (i * 7) % 26;
+  icon[1536] = '\0';
+  return icon;
+}
+
+/** XEXP FILES
+ */
+
+struct file_bench {
+  xexp *x;
+  char *filename;
+  bool binary;
+};
+
+static void
+bench_write_file (void *data)
+{
+  file_bench *b = (file_bench *) data;
+
+  if (b->binary)
+    xexp_write_file_binary (b->filename, b->x);
+  else
+    xexp_write_file (b->filename, b->x);
+}
+
+static void
+bench_read_file (void *data)
+{
+  file_bench *b = (file_bench *) data;
+  xexp_free (xexp_read_file (b->filename));
+}
+
+static int
+count_visitor (xexp *child, void *data)
+{
+  (*(int *) data)++;
+  return 0;
+}
+
+static void
+bench_visit_file (void *data)
+{
+  file_bench *b = (file_bench *) data;
+  int count = 0;
+  xexp_visit_file (b->filename, count_visitor, &count);
+}
+
+static void
+bench_files (const char *what, xexp *x)
+{
+  char *base = g_strdup_printf ("/tmp/micro-bench-%d-%s", (int) getpid (),
+				what);
+  char name[128];
+
+  for (int binary = 0; binary < 2; binary++)
+    {
+      const char *format = binary ? "binary" : "text";
+      file_bench b = { x, g_strdup_printf ("%s.%s", base, format),
+		       (bool) binary };
+
+      bench_write_file (&b);
+      size_t size = file_size (b.filename);
+
+      snprintf (name, sizeof (name), "xexp_write_%s_%s", what, format);
+      run (name, bench_write_file, &b, size);
+      snprintf (name, sizeof (name), "xexp_read_%s_%s", what, format);
+      run (name, bench_read_file, &b, size);
+      snprintf (name, sizeof (name), "xexp_visit_%s_%s", what, format);
+      run (name, bench_visit_file, &b, size);
+
+      unlink (b.filename);
+      g_free (b.filename);
+    }
+
+  g_free (base);
+}
+
+/** PROTOCOL CODEC
+ */
+
+struct package {
+  char *name;
+  int broken;
+  char *installed_version;
+  int64_t installed_size;
+  char *section;
+  char *pretty_name;
+  char *description;
+  const char *icon;
+  char *available_version;
+  int flags;
+};
+
+struct codec_bench {
+  package *packages;
+  int n_packages;
+  apt_proto_encoder enc;
+  xexp *catalogues;
+};
+
+static void
+encode_package_list (codec_bench *b)
+{
+  apt_proto_encoder *enc = &b->enc;
+
+  /* Same layout as cmd_get_package_list in apt-worker.cc.
+   */
+  enc->reset ();
+  enc->encode_int (1);
+  for (int i = 0; i < b->n_packages; i++)
+    {
+      package *p = &b->packages[i];
+      enc->encode_string (p->name);
+      enc->encode_int (p->broken);
+      enc->encode_string (p->installed_version);
+      enc->encode_int64 (p->installed_size);
+      enc->encode_string (p->section);
+      enc->encode_string (p->pretty_name);
+      enc->encode_string (p->description);
+      enc->encode_string (p->installed_version ? p->icon : NULL);
+      enc->encode_string (p->available_version);
+      enc->encode_string (p->section);
+      enc->encode_string (p->pretty_name);
+      enc->encode_string (p->description);
+      enc->encode_string (p->available_version ? p->icon : NULL);
+      enc->encode_int (p->flags);
+    }
+}
+
+static void
+bench_encode_package_list (void *data)
+{
+  encode_package_list ((codec_bench *) data);
+}
+
+static void
+bench_decode_package_list (void *data)
+{
+  codec_bench *b = (codec_bench *) data;
+  apt_proto_decoder dec (b->enc.get_buf (), b->enc.get_len ());
+  int n = 0;
+
+  /* Same as get_package_list_reply in main.cc: the strings are
+     copied into the package_info structs.
+  */
+  dec.decode_int ();
+  while (!dec.at_end () && !dec.corrupted ())
+    {
+      g_free (dec.decode_string_dup ());
+      dec.decode_int ();
+      g_free (dec.decode_string_dup ());
+      dec.decode_int64 ();
+      for (int i = 0; i < 4; i++)
+	g_free (dec.decode_string_dup ());
+      for (int i = 0; i < 5; i++)
+	g_free (dec.decode_string_dup ());
+      dec.decode_int ();
+      n++;
+    }
+
+  if (n != b->n_packages)
+    {
+      fprintf (stderr, "micro-bench: decoded %d packages, expected %d\n",
+	       n, b->n_packages);
+      exit (1);
+    }
+}
+
+static void
+bench_roundtrip_package_list (void *data)
+{
+  bench_encode_package_list (data);
+  bench_decode_package_list (data);
+}
+
+static void
+bench_encode_xexp (void *data)
+{
+  codec_bench *b = (codec_bench *) data;
+  b->enc.reset ();
+  b->enc.encode_xexp (b->catalogues);
+}
+
+static void
+bench_decode_xexp (void *data)
+{
+  codec_bench *b = (codec_bench *) data;
+  apt_proto_decoder dec (b->enc.get_buf (), b->enc.get_len ());
+  xexp_free (dec.decode_xexp ());
+}
+
+static void
+bench_codec (xexp *catalogues)
+{
+  codec_bench b;
+  char *icon = make_icon ();
+
+  b.n_packages = N_PACKAGES * scale;
+  b.packages = g_new0 (package, b.n_packages);
+  b.catalogues = catalogues;
+
+  for (int i = 0; i < b.n_packages; i++)
+    {
+      package *p = &b.packages[i];
+      bool installed = (i % 3 == 0), available = (i % 3 != 1);
+
+      p->name = g_strdup_printf ("package-%05d", i);
+      p->broken = (i % 97 == 0);
+      p->installed_version = installed ? g_strdup ("1.0-1") : NULL;
+      p->installed_size = installed ? 1024 * (i % 500) : 0;
+      p->section = g_strdup ((i % 4) ? "user/utilities" : "user/games");
+      p->pretty_name = g_strdup_printf ("Package %d", i);
+      p->description = g_strdup_printf ("This is the short description "
+					"of package number %d", i);
+      p->icon = (i % 2) ? icon : NULL;
+      p->available_version = available ? g_strdup ("1.1-1") : NULL;
+      p->flags = i % 8;
+    }
+
+  encode_package_list (&b);
+  size_t size = b.enc.get_len ();
+  run ("proto_encode_package_list", bench_encode_package_list, &b, size);
+  run ("proto_decode_package_list", bench_decode_package_list, &b, size);
+  run ("proto_roundtrip_package_list", bench_roundtrip_package_list,
+       &b, size);
+
+  bench_encode_xexp (&b);
+  size = b.enc.get_len ();
+  run ("proto_encode_xexp_catalogues", bench_encode_xexp, &b, size);
+  run ("proto_decode_xexp_catalogues", bench_decode_xexp, &b, size);
+
+  for (int i = 0; i < b.n_packages; i++)
+    {
+      package *p = &b.packages[i];
+      g_free (p->name);
+      g_free (p->installed_version);
+      g_free (p->section);
+      g_free (p->pretty_name);
+      g_free (p->description);
+      g_free (p->available_version);
+    }
+  g_free (b.packages);
+  g_free (icon);
+}
+
+/** CATALOGUES
+ */
+
+struct catalogue_bench {
+  xexp *catalogues;
+  xexp *probes[N_PROBES];
+  int n_probes;
+};
+
+static void
+bench_catalogue_equal (void *data)
+{
+  catalogue_bench *b = (catalogue_bench *) data;
+
+  /* Compare every probe with one catalogue, as the merging code does
+     for each pair it looks at.
+  */
+  xexp *c = xexp_first (b->catalogues);
+  for (int i = 0; i < b->n_probes && c; i++, c = xexp_rest (c))
+    catalogue_equal (c, b->probes[i]);
+}
+
+static void
+bench_find_catalogue (void *data)
+{
+  catalogue_bench *b = (catalogue_bench *) data;
+
+  for (int i = 0; i < b->n_probes; i++)
+    find_catalogue (b->catalogues, b->probes[i]);
+}
+
+static void
+bench_catalogues (xexp *catalogues)
+{
+  catalogue_bench hits, misses;
+  int n = xexp_length (catalogues);
+
+  hits.catalogues = misses.catalogues = catalogues;
+  hits.n_probes = misses.n_probes = N_PROBES;
+
+  /* The hits are spread over the whole list and are spelled a bit
+     differently, with the trailing slash of the URI removed, so that
+     the normalization in catalogue_equal has to do its work.
+  */
+  for (int i = 0; i < N_PROBES; i++)
+    {
+      int k = (int) ((long) i * n / N_PROBES);
+      xexp *p = make_catalogue (k);
+      char *uri = g_strdup (xexp_aref_text (p, "uri"));
+      uri[strlen (uri) - 1] = '\0';
+      xexp_aset_text (p, "uri", uri);
+      g_free (uri);
+      hits.probes[i] = p;
+
+      misses.probes[i] = make_catalogue (n + i);
+    }
+
+  run ("catalogue_equal", bench_catalogue_equal, &hits, 0);
+  run ("find_catalogue_hit", bench_find_catalogue, &hits, 0);
+  run ("find_catalogue_miss", bench_find_catalogue, &misses, 0);
+
+  for (int i = 0; i < N_PROBES; i++)
+    {
+      xexp_free (hits.probes[i]);
+      xexp_free (misses.probes[i]);
+    }
+}
+
+static void
+usage ()
+{
+  fprintf (stderr, "usage: micro-bench [-t SECONDS] [-s SCALE] [FILTER...]\n");
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt (argc, argv, "t:s:")) != -1)
+    {
+      switch (opt)
+	{
+	case 't':
+	  min_seconds = atof (optarg);
+	  break;
+	case 's':
+	  scale = atoi (optarg);
+	  break;
+	default:
+	  usage ();
+	}
+    }
+
+  if (min_seconds <= 0 || scale < 1)
+    usage ();
+  filters = argv + optind;
+
+  /* Make GSlice go through malloc so that its allocations are
+     counted.
+  */
+  setenv ("G_SLICE", "always-malloc", 1);
+
+  xexp *catalogues = make_catalogues (N_CATALOGUES * scale);
+  xexp *updates = make_updates (N_UPDATES * scale);
+
+  printf ("{\n  \"scale\": %d,\n  \"results\": {", scale);
+
+  bench_files ("catalogues", catalogues);
+  bench_files ("updates", updates);
+  bench_codec (catalogues);
+  bench_catalogues (catalogues);
+
+  printf ("\n  }\n}\n");
+
+  xexp_free (catalogues);
+  xexp_free (updates);
+  return 0;
+}
@@ -43,6 +43,7 @@
 #include "details.h"
 #include "dbus.h"
 #include "user_files.h"
+#include "trace.h"
 
 #define _(x) gettext (x)
 
@@ -375,6 +376,8 @@ install_packages (GList *packages,
   c->refresh_needed = false;
   c->mode = DEVICE_MODE_UNKNOWN; /* Not known yet (SSU only) */
 
+  trace_begin ("operation", "install_packages", c);
+
   get_package_infos (packages,
 		     true,
 		     ip_install_with_info,
@@ -395,6 +398,8 @@ ip_install_with_info (void *data)
 {
   ip_clos *c = (ip_clos *)data;
 
+  TRACE_STEP (c);
+
   // Filter and sort packages, stopping after the first when this is a
   // standard install.
 
@@ -521,6 +526,8 @@ ip_select_package_response (gboolean res, GList *selected_packages,
 {
   ip_clos *c = (ip_clos *)data;
 
+  TRACE_STEP (c);
+
   if (!res)
     {
 #ifdef INSTALL_TYPE_MEMORY_CARD
@@ -549,6 +556,8 @@ ip_confirm_install_response (bool res, void *data)
 {
   ip_clos *c = (ip_clos *)data;
 
+  TRACE_STEP (c);
+
   if (res)
     ip_ensure_network (c);
   else
@@ -558,6 +567,8 @@ ip_confirm_install_response (bool res, void *data)
 static void
 ip_ensure_network (ip_clos *c)
 {
+  TRACE_STEP (c);
+
   /* Start entertaining the user here.  We stop in ip_end, at the
      last.
    */
@@ -594,6 +605,8 @@ ip_check_cert_start (ip_clos *c)
 static void
 ip_check_cert_loop (ip_clos *c)
 {
+  TRACE_STEP (c);
+
   if (c->cur)
     {
       package_info *pi = (package_info *)c->cur->data;
@@ -675,6 +688,8 @@ ip_legalese_response (bool res, void *data)
 {
   ip_clos *c = (ip_clos *)data;
 
+  TRACE_STEP (c);
+
   if (res)
     {
       /* User agrees to take the risk.  Let's start the show!
@@ -710,6 +725,8 @@ force_icons_theme_reload (void)
 static void
 ip_install_loop (ip_clos *c)
 {
+  TRACE_STEP (c);
+
   /* ensure device mode is restored in case it was modified by the
      previous installation of another package */
   ip_maybe_restore_device_mode (c);
@@ -847,6 +864,8 @@ ip_get_info_for_install (void *data)
   ip_clos *c = (ip_clos *)data;
   package_info *pi = (package_info *)(c->cur->data);
 
+  TRACE_STEP (c);
+
   /* Reget info.  It might have been changed by previous
      installations.
   */
@@ -921,6 +940,8 @@ ip_warn_about_reboot (ip_clos *c)
 {
   GtkWidget *dialog = NULL;
 
+  TRACE_STEP (c);
+
   dialog = gtk_dialog_new_with_buttons
     (_("ai_ti_operating_system_update"),
      NULL,
@@ -1076,6 +1097,8 @@ ip_install_one (void *data)
   ip_clos *c = (ip_clos *)data;
   package_info *pi = (package_info *)(c->cur->data);
 
+  TRACE_STEP (c);
+
   add_log ("-----\n");
   if (pi->installed_version)
     add_log ("Upgrading %s %s to %s\n", pi->name,
@@ -1206,6 +1229,8 @@ ip_check_upgrade (void *data)
   ip_clos *c = (ip_clos *)data;
   package_info *pi = (package_info *)(c->cur->data);
 
+  TRACE_STEP (c);
+
   apt_worker_install_check (pi->name, ip_check_upgrade_reply, c);
 }
 
@@ -1309,6 +1334,8 @@ ip_download_cur (void *data)
   ip_clos *c = (ip_clos *)data;
   package_info *pi = (package_info *)(c->cur->data);
 
+  TRACE_STEP (c);
+
   char *title = NULL;
   if (pi->installed_version != NULL)
     {
@@ -1501,6 +1528,8 @@ ip_install_cur (void *data)
   ip_clos *c = (ip_clos *)data;
   package_info *pi = (package_info *)(c->cur->data);
 
+  TRACE_STEP (c);
+
   /* entertain the user while the packages are checked */
   set_entertainment_cancel (NULL, NULL);
   set_entertainment_fun (NULL, -1, -1, 0);
@@ -1709,6 +1738,8 @@ ip_abort_cur (ip_clos *c, const char *msg, bool with_details)
   GtkWidget *dialog;
   gchar *final_msg = NULL;
 
+  TRACE_STEP (c);
+
   stop_entertaining_user ();
   c->entertaining = false;
 
@@ -1801,6 +1832,8 @@ ip_end (void *data)
 {
   ip_clos *c = (ip_clos *)data;
 
+  TRACE_STEP (c);
+
   /* restore the device mode if needed */
   ip_maybe_restore_device_mode (c);
 
@@ -1819,6 +1852,9 @@ ip_end (void *data)
   if (c->packages != NULL)
     g_list_free (c->packages);
 
+  trace_step_end (c);
+  trace_end ("operation", "install_packages", c);
+
   c->cont (c->n_successful, c->data);
 
   g_free (c->title);
@@ -1928,7 +1964,10 @@ uninstall_package (package_info *pi,
   c->pi = pi;
   c->cont = cont;
   c->data = data;
-  
+
+  trace_begin ("operation", "uninstall_package", c, pi->name);
+  TRACE_STEP (c);
+
   size_string_general (size_buf, 20, c->pi->installed_size);
   g_string_printf (text, _("ai_nc_uninstall"),
 		   c->pi->get_display_name (true),
@@ -1945,6 +1984,8 @@ up_checkrm_start (bool res, void *data)
 {
   up_clos *c = (up_clos *)data;
 
+  TRACE_STEP (c);
+
   if (res)
     apt_worker_remove_check (c->pi->name,
 			     up_checkrm_reply, c);
@@ -1978,6 +2019,8 @@ up_checkrm_reply (int cmd, apt_proto_decoder *dec, void *data)
 static void
 up_checkrm_loop (up_clos *c)
 {
+  TRACE_STEP (c);
+
   if (c->remove_names)
     {
       char *name = (char *)pop (c->remove_names);
@@ -2011,6 +2054,8 @@ up_checkrm_cmd_done (int status, void *data)
 static void
 up_remove (up_clos *c)
 {
+  TRACE_STEP (c);
+
   get_package_info (c->pi, false, up_remove_with_info, c);
 }
 
@@ -2019,6 +2064,8 @@ up_remove_with_info (package_info *pi, void *data, bool changed)
 {
   up_clos *c = (up_clos *)data;
 
+  TRACE_STEP (c);
+
   if (c->pi->info.removable_status == status_able)
     {
       add_log ("-----\n");
@@ -2059,6 +2106,8 @@ up_remove_reply (int cmd, apt_proto_decoder *dec, void *data)
 {
   up_clos *c = (up_clos *)data;
 
+  TRACE_STEP (c);
+
   if (dec == NULL)
     {
       stop_entertaining_user ();
@@ -2106,7 +2155,13 @@ up_end (void *data)
 {
   up_clos *c = (up_clos *)data;
 
+  TRACE_STEP (c);
+
   force_show_catalogue_errors ();
+
+  trace_step_end (c);
+  trace_end ("operation", "uninstall_package", c);
+
   c->cont (c->data);
   delete c;
 }
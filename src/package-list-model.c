@@ -0,0 +1,353 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2005, 2006, 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * Contact: Marius Vollmer <marius.vollmer@nokia.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#include <gtk/gtk.h>
+
+#include "package-list-model.h"
+
+static void package_list_model_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (PackageListModel, package_list_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+                                                package_list_model_tree_model_init));
+
+#define VALID_ITER(model, iter)                                 \
+  ((iter) != NULL                                               \
+   && (iter)->stamp == (model)->stamp                           \
+   && GPOINTER_TO_UINT ((iter)->user_data) < (model)->rows->len)
+
+static void
+set_iter (PackageListModel *model, GtkTreeIter *iter, guint index)
+{
+  iter->stamp = model->stamp;
+  iter->user_data = GUINT_TO_POINTER (index);
+  iter->user_data2 = NULL;
+  iter->user_data3 = NULL;
+}
+
+/* GtkTreeModel implementation */
+
+static GtkTreeModelFlags
+plm_get_flags (GtkTreeModel *tree_model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+plm_get_n_columns (GtkTreeModel *tree_model)
+{
+  return 1;
+}
+
+static GType
+plm_get_column_type (GtkTreeModel *tree_model, gint index)
+{
+  g_return_val_if_fail (index == 0, G_TYPE_INVALID);
+  return G_TYPE_POINTER;
+}
+
+static gboolean
+plm_get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+  gint index;
+
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+
+  index = gtk_tree_path_get_indices (path)[0];
+  if (index < 0 || (guint) index >= model->rows->len)
+    return FALSE;
+
+  set_iter (model, iter, index);
+  return TRUE;
+}
+
+static GtkTreePath *
+plm_get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+  GtkTreePath *path;
+
+  g_return_val_if_fail (VALID_ITER (model, iter), NULL);
+
+  path = gtk_tree_path_new ();
+  gtk_tree_path_append_index (path, GPOINTER_TO_UINT (iter->user_data));
+  return path;
+}
+
+static void
+plm_get_value (GtkTreeModel *tree_model, GtkTreeIter *iter,
+               gint column, GValue *value)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+
+  g_return_if_fail (column == 0);
+  g_return_if_fail (VALID_ITER (model, iter));
+
+  g_value_init (value, G_TYPE_POINTER);
+  g_value_set_pointer (value,
+                       g_ptr_array_index (model->rows,
+                                          GPOINTER_TO_UINT (iter->user_data)));
+}
+
+static gboolean
+plm_iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+  guint next;
+
+  g_return_val_if_fail (VALID_ITER (model, iter), FALSE);
+
+  next = GPOINTER_TO_UINT (iter->user_data) + 1;
+  if (next >= model->rows->len)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  iter->user_data = GUINT_TO_POINTER (next);
+  return TRUE;
+}
+
+static gboolean
+plm_iter_nth_child (GtkTreeModel *tree_model, GtkTreeIter *iter,
+                    GtkTreeIter *parent, gint n)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+
+  if (parent != NULL || n < 0 || (guint) n >= model->rows->len)
+    return FALSE;
+
+  set_iter (model, iter, n);
+  return TRUE;
+}
+
+static gboolean
+plm_iter_children (GtkTreeModel *tree_model, GtkTreeIter *iter,
+                   GtkTreeIter *parent)
+{
+  return plm_iter_nth_child (tree_model, iter, parent, 0);
+}
+
+static gboolean
+plm_iter_has_child (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+plm_iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (tree_model);
+
+  if (iter != NULL)
+    return 0;
+
+  return model->rows->len;
+}
+
+static gboolean
+plm_iter_parent (GtkTreeModel *tree_model, GtkTreeIter *iter,
+                 GtkTreeIter *child)
+{
+  return FALSE;
+}
+
+static void
+package_list_model_tree_model_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = plm_get_flags;
+  iface->get_n_columns = plm_get_n_columns;
+  iface->get_column_type = plm_get_column_type;
+  iface->get_iter = plm_get_iter;
+  iface->get_path = plm_get_path;
+  iface->get_value = plm_get_value;
+  iface->iter_next = plm_iter_next;
+  iface->iter_children = plm_iter_children;
+  iface->iter_has_child = plm_iter_has_child;
+  iface->iter_n_children = plm_iter_n_children;
+  iface->iter_nth_child = plm_iter_nth_child;
+  iface->iter_parent = plm_iter_parent;
+}
+
+/* GObject implementation */
+
+static void
+package_list_model_init (PackageListModel *model)
+{
+  model->rows = g_ptr_array_new ();
+  model->stamp = g_random_int ();
+}
+
+static void
+package_list_model_finalize (GObject *object)
+{
+  PackageListModel *model = PACKAGE_LIST_MODEL (object);
+
+  g_ptr_array_free (model->rows, TRUE);
+
+  G_OBJECT_CLASS (package_list_model_parent_class)->finalize (object);
+}
+
+static void
+package_list_model_class_init (PackageListModelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = package_list_model_finalize;
+}
+
+PackageListModel *
+package_list_model_new (void)
+{
+  return PACKAGE_LIST_MODEL (g_object_new (TYPE_PACKAGE_LIST_MODEL, NULL));
+}
+
+static gboolean
+has_listeners (PackageListModel *model, const char *signal)
+{
+  guint signal_id = g_signal_lookup (signal, GTK_TYPE_TREE_MODEL);
+  return g_signal_has_handler_pending (model, signal_id, 0, FALSE);
+}
+
+/* If NEW_ROWS is a permutation of the current rows, swap it in and
+   emit "rows-reordered".  Otherwise, return FALSE without touching
+   the model.
+*/
+static gboolean
+maybe_reorder (PackageListModel *model, GPtrArray *new_rows)
+{
+  GHashTable *old_index;
+  gint *new_order;
+  gboolean is_permutation = TRUE;
+  guint i;
+
+  if (new_rows->len != model->rows->len || new_rows->len == 0)
+    return FALSE;
+
+  /* Old indices are stored off by one so that 0 means "not there".
+   */
+  old_index = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < model->rows->len; i++)
+    g_hash_table_insert (old_index, g_ptr_array_index (model->rows, i),
+                         GUINT_TO_POINTER (i + 1));
+
+  new_order = g_new (gint, new_rows->len);
+  for (i = 0; i < new_rows->len && is_permutation; i++)
+    {
+      gpointer row = g_ptr_array_index (new_rows, i);
+      guint old = GPOINTER_TO_UINT (g_hash_table_lookup (old_index, row));
+
+      if (old == 0)
+        is_permutation = FALSE;
+      else
+        {
+          new_order[i] = old - 1;
+          /* Catch rows that appear twice in NEW_ROWS. */
+          g_hash_table_insert (old_index, row, GUINT_TO_POINTER (0));
+        }
+    }
+
+  if (is_permutation)
+    {
+      GtkTreePath *path = gtk_tree_path_new ();
+
+      g_ptr_array_free (model->rows, TRUE);
+      model->rows = new_rows;
+      model->stamp++;
+
+      gtk_tree_model_rows_reordered (GTK_TREE_MODEL (model), path,
+                                     NULL, new_order);
+      gtk_tree_path_free (path);
+    }
+
+  g_free (new_order);
+  g_hash_table_destroy (old_index);
+
+  return is_permutation;
+}
+
+void
+package_list_model_set_rows (PackageListModel *model,
+                             GList *rows,
+                             PackageListModelVisibleFunc visible,
+                             gpointer data)
+{
+  GPtrArray *new_rows;
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  guint i;
+
+  g_return_if_fail (IS_PACKAGE_LIST_MODEL (model));
+
+  new_rows = g_ptr_array_new ();
+  for (; rows; rows = rows->next)
+    if (visible == NULL || visible (rows->data, data))
+      g_ptr_array_add (new_rows, rows->data);
+
+  if (maybe_reorder (model, new_rows))
+    return;
+
+  /* Remove the old rows from the back so that the paths of the
+     remaining ones stay valid while the signals are emitted.
+  */
+  if (has_listeners (model, "row-deleted"))
+    while (model->rows->len > 0)
+      {
+        g_ptr_array_remove_index (model->rows, model->rows->len - 1);
+        model->stamp++;
+
+        path = gtk_tree_path_new ();
+        gtk_tree_path_append_index (path, model->rows->len);
+        gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+        gtk_tree_path_free (path);
+      }
+
+  g_ptr_array_free (model->rows, TRUE);
+  model->stamp++;
+
+  if (!has_listeners (model, "row-inserted"))
+    {
+      /* Nobody is looking, just take the new array.
+       */
+      model->rows = new_rows;
+      return;
+    }
+
+  model->rows = g_ptr_array_sized_new (new_rows->len);
+  for (i = 0; i < new_rows->len; i++)
+    {
+      g_ptr_array_add (model->rows, g_ptr_array_index (new_rows, i));
+      model->stamp++;
+
+      set_iter (model, &iter, i);
+      path = gtk_tree_path_new ();
+      gtk_tree_path_append_index (path, i);
+      gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+      gtk_tree_path_free (path);
+    }
+
+  g_ptr_array_free (new_rows, TRUE);
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2005, 2006, 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * Contact: Marius Vollmer <marius.vollmer@nokia.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#ifndef PACKAGE_LIST_MODEL_H
+#define PACKAGE_LIST_MODEL_H
+
+#include <glib-object.h>
+#include <gtk/gtktreemodel.h>
+
+G_BEGIN_DECLS
+
+/* A PackageListModel is a flat GtkTreeModel with a single G_TYPE_POINTER
+   column that exposes an array of rows directly.  It is what the
+   global package list in util.cc is built on.
+
+   PACKAGE_LIST_MODEL_SET_ROWS replaces the rows of the model with the
+   elements of ROWS for which VISIBLE returns TRUE (all of them when
+   VISIBLE is NULL).  When the new rows are just a permutation of the
+   old ones, a single "rows-reordered" signal is emitted.  Otherwise
+   the old rows are removed and the new ones inserted, but the
+   per-row signals are only emitted when somebody is actually
+   listening to the model.
+
+   Iterators are invalidated by every call to
+   package_list_model_set_rows.
+*/
+
+#define TYPE_PACKAGE_LIST_MODEL             (package_list_model_get_type ())
+#define PACKAGE_LIST_MODEL(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_PACKAGE_LIST_MODEL, PackageListModel))
+#define PACKAGE_LIST_MODEL_CLASS(vtable)    (G_TYPE_CHECK_CLASS_CAST ((vtable), TYPE_PACKAGE_LIST_MODEL, PackageListModelClass))
+#define IS_PACKAGE_LIST_MODEL(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), TYPE_PACKAGE_LIST_MODEL))
+#define IS_PACKAGE_LIST_MODEL_CLASS(vtable) (G_TYPE_CHECK_CLASS_TYPE ((vtable), TYPE_PACKAGE_LIST_MODEL))
+#define PACKAGE_LIST_MODEL_GET_CLASS(inst)  (G_TYPE_INSTANCE_GET_CLASS ((inst), TYPE_PACKAGE_LIST_MODEL, PackageListModelClass))
+
+typedef struct _PackageListModel PackageListModel;
+typedef struct _PackageListModelClass PackageListModelClass;
+
+struct _PackageListModel
+{
+  GObject parent;
+
+  GPtrArray *rows;
+  gint stamp;
+};
+
+struct _PackageListModelClass
+{
+  GObjectClass parent_class;
+};
+
+typedef gboolean (*PackageListModelVisibleFunc) (gpointer row, gpointer data);
+
+GType package_list_model_get_type (void);
+
+PackageListModel *package_list_model_new (void);
+
+void package_list_model_set_rows (PackageListModel *model,
+                                  GList *rows,
+                                  PackageListModelVisibleFunc visible,
+                                  gpointer data);
+
+G_END_DECLS
+
+#endif
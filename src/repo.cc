@@ -42,6 +42,7 @@
 #include "log.h"
 #include "confutils.h"
 #include "apt-utils.h"
+#include "watchdog.h"
 
 #define _(x)       gettext (x)
 
@@ -145,6 +146,7 @@ pill_response (GtkDialog *dialog, gint response, gpointer unused)
       set_settings_menu_visible (red_pill_mode);
       set_install_from_file_menu_visible (red_pill_mode);
       update_backend_options ();
+      watchdog_update ();
       if (red_pill_show_all || red_pill_show_magic_sys)
         get_package_list ();
     }
@@ -34,6 +34,7 @@
 #include "apt-worker-client.h"
 #include "menu.h"
 #include "user_files.h"
+#include "watchdog.h"
 
 #define _(x) gettext (x)
 
@@ -53,6 +54,7 @@ bool red_pill_include_details_in_log = false;
 bool red_pill_check_always = false;
 bool red_pill_ignore_wrong_domains = true;
 bool red_pill_ignore_thirdparty_policy = false;
+bool red_pill_log_stalls = false;
 bool red_pill_permanent = false;
 
 #define SETTINGS_FILE ".osso/hildon-application-manager"
@@ -120,6 +122,8 @@ load_settings ()
 	    red_pill_ignore_thirdparty_policy = val;
 	  else if (sscanf (line, "red-pill-permanent %d", &val) == 1)
 	    red_pill_permanent = val;
+	  else if (sscanf (line, "red-pill-log-stalls %d", &val) == 1)
+	    red_pill_log_stalls = val;
 	  else
 	    add_log ("Unrecognized configuration line: '%s'\n", line);
 	}
@@ -161,6 +165,7 @@ save_settings ()
       fprintf (f, "red-pill-ignore-thirdparty-policy %d\n",
 	       red_pill_ignore_thirdparty_policy);
       fprintf (f, "red-pill-permanent %d\n", red_pill_permanent);
+      fprintf (f, "red-pill-log-stalls %d\n", red_pill_log_stalls);
       fprintf (f, "assume-connection %d\n", assume_connection);
       fflush (f);
       fsync (fileno (f));
@@ -183,6 +188,7 @@ enum boolean_options {
   OPT_USE_APT_ALGORITHMS,
   OPT_SHOW_SSU_PROBLEMS,
   OPT_PERMANENT,
+  OPT_LOG_STALLS,
   NUM_BOOLEAN_OPTIONS
 };
 
@@ -258,6 +264,9 @@ make_settings_tab (settings_closure *c)
   make_boolean_option (c, vbox, group, OPT_PERMANENT,
  		       "Red pill is permanent",
  		       &red_pill_permanent);
+  make_boolean_option (c, vbox, group, OPT_LOG_STALLS,
+		       "Log main loop stalls",
+		       &red_pill_log_stalls);
   g_object_unref (group);
 
   hildon_pannable_area_add_with_viewport (HILDON_PANNABLE_AREA (scrolled_window),
@@ -289,6 +298,7 @@ settings_dialog_response (GtkDialog *dialog, gint response, gpointer clos)
 
       save_settings ();
       update_backend_options ();
+      watchdog_update ();
 
       if (needs_refresh)
 	get_package_list ();
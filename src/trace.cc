@@ -0,0 +1,175 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include "trace.h"
+
+bool trace_enabled = false;
+
+static FILE *trace_file;
+static int trace_pid;
+
+/* The current step of each flow, see trace_step.
+ */
+static GHashTable *trace_steps;
+
+static long long
+trace_now ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void
+trace_write_string (const char *str)
+{
+  fputc ('"', trace_file);
+  for (const char *p = str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+	fprintf (trace_file, "\\%c", *p);
+      else if ((unsigned char) *p < 0x20)
+	fprintf (trace_file, "\\u%04x", *p);
+      else
+	fputc (*p, trace_file);
+    }
+  fputc ('"', trace_file);
+}
+
+static void
+trace_event (char phase, const char *cat, const char *name,
+	     const void *id, const char *detail)
+{
+  fprintf (trace_file, ",\n{\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+	   "\"cat\":", phase, trace_now (), trace_pid, trace_pid);
+  trace_write_string (cat);
+  fprintf (trace_file, ",\"name\":");
+  trace_write_string (name);
+  if (phase == 'b' || phase == 'e')
+    fprintf (trace_file, ",\"id\":\"0x%lx\"", (unsigned long) id);
+  if (detail)
+    {
+      fprintf (trace_file, ",\"args\":{\"detail\":");
+      trace_write_string (detail);
+      fprintf (trace_file, "}");
+    }
+  fprintf (trace_file, "}");
+}
+
+static void
+trace_finish ()
+{
+  fprintf (trace_file, "\n]\n");
+  fclose (trace_file);
+  trace_file = NULL;
+  trace_enabled = false;
+}
+
+void
+trace_init ()
+{
+  const char *filename = getenv ("HAM_TRACE");
+
+  if (filename == NULL || *filename == '\0')
+    return;
+
+  trace_file = fopen (filename, "w");
+  if (trace_file == NULL)
+    {
+      perror (filename);
+      return;
+    }
+
+  trace_pid = getpid ();
+  trace_steps = g_hash_table_new (NULL, NULL);
+  trace_enabled = true;
+
+  /* The first element names the process, so that all other events
+     can start with a comma.
+  */
+  fprintf (trace_file, "[\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+	   "\"name\":\"process_name\","
+	   "\"args\":{\"name\":\"hildon-application-manager\"}}",
+	   trace_pid, trace_pid);
+  atexit (trace_finish);
+}
+
+void
+trace_begin (const char *cat, const char *name, const void *id,
+	     const char *detail)
+{
+  if (trace_enabled)
+    trace_event ('b', cat, name, id, detail);
+}
+
+void
+trace_end (const char *cat, const char *name, const void *id,
+	   const char *detail)
+{
+  if (trace_enabled)
+    trace_event ('e', cat, name, id, detail);
+}
+
+void
+trace_enter (const char *name)
+{
+  if (trace_enabled)
+    trace_event ('B', "main", name, NULL, NULL);
+}
+
+void
+trace_leave (const char *name)
+{
+  if (trace_enabled)
+    trace_event ('E', "main", name, NULL, NULL);
+}
+
+void
+trace_step (const void *flow, const char *name)
+{
+  if (!trace_enabled)
+    return;
+
+  trace_step_end (flow);
+  trace_event ('b', "operation", name, flow, NULL);
+  g_hash_table_insert (trace_steps, (gpointer) flow, (gpointer) name);
+}
+
+void
+trace_step_end (const void *flow)
+{
+  if (!trace_enabled)
+    return;
+
+  const char *cur = (const char *) g_hash_table_lookup (trace_steps, flow);
+  if (cur)
+    {
+      trace_event ('e', "operation", cur, flow, NULL);
+      g_hash_table_remove (trace_steps, flow);
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdlib.h>
+
+/** Tracing
+
+  When the environment variable HAM_TRACE names a file, a timeline of
+  what the Application Manager does is written to it, in the JSON
+  format of the Chrome trace viewer (chrome://tracing, Perfetto).
+  Otherwise, tracing costs one test of TRACE_ENABLED per call.
+
+  TRACE_BEGIN and TRACE_END bracket an asynchronous span, such as an
+  interaction flow or a request to apt-worker, that is identified by
+  CAT, NAME and ID.  Spans with the same CAT and ID nest.  DETAIL is
+  shown as an argument of the event and may be NULL.
+
+  TRACE_ENTER and TRACE_LEAVE bracket a synchronous span on the main
+  loop, such as the running of a callback.  They must be properly
+  nested.
+
+  TRACE_STEP is for the long chains of continuations in
+  operations.cc: it ends the current step of FLOW, if any, and starts
+  a new one called NAME.  The steps are nested in the span that has
+  been started with TRACE_BEGIN ("operation", ..., FLOW), and
+  TRACE_STEP_END ends the last one.  Thus, a step covers everything
+  from the call of its function to the call of the next one,
+  including the time that the user looks at a dialog or that
+  apt-worker is busy.  The TRACE_STEP macro uses the name of the
+  calling function.
+*/
+
+extern bool trace_enabled;
+
+void trace_init ();
+
+void trace_begin (const char *cat, const char *name, const void *id,
+		  const char *detail = NULL);
+void trace_end (const char *cat, const char *name, const void *id,
+		const char *detail = NULL);
+
+void trace_enter (const char *name);
+void trace_leave (const char *name);
+
+void trace_step (const void *flow, const char *name);
+void trace_step_end (const void *flow);
+
+#define TRACE_STEP(flow)                        \
+  do {                                          \
+    if (trace_enabled)                          \
+      trace_step ((flow), __FUNCTION__);        \
+  } while (0)
+
+#endif /* !TRACE_H */
@@ -173,8 +173,24 @@ user_file_read_xexp (const gchar *name)
   return x;
 }
 
-void
-user_file_write_xexp (const gchar *name, xexp *x)
+int
+user_file_visit_xexp (const gchar *name, xexp_visitor *visitor, void *data)
+{
+  FILE *f = NULL;
+  int success = FALSE;
+
+  f = user_file_open_for_read (name);
+  if (f != NULL)
+    {
+      success = xexp_visit (f, visitor, data, NULL);
+      fclose (f);
+    }
+  return success;
+}
+
+static void
+user_file_write_xexp_1 (const gchar *name, xexp *x,
+                        void (*write) (FILE *f, xexp *x))
 {
   FILE *f = NULL;
 
@@ -183,9 +199,21 @@ user_file_write_xexp (const gchar *name, xexp *x)
       f = user_file_open_for_write (name);
       if (f != NULL)
         {
-          xexp_write (f, x);
+          write (f, x);
           if (fflush (f) || fsync (fileno (f)) || fclose (f))
             return;
         }
     }
 }
+
+void
+user_file_write_xexp (const gchar *name, xexp *x)
+{
+  user_file_write_xexp_1 (name, x, xexp_write);
+}
+
+void
+user_file_write_xexp_binary (const gchar *name, xexp *x)
+{
+  user_file_write_xexp_1 (name, x, xexp_write_binary);
+}
@@ -38,8 +38,11 @@ extern "C" {
 #define UFILE_TAPPED_NOTIFICATIONS "tapped-notifications"
 #define UFILE_AVAILABLE_NOTIFICATIONS "available-notifications"
 #define UFILE_AVAILABLE_NOTIFICATIONS_TMP   UFILE_AVAILABLE_NOTIFICATIONS ".tmp"
+#define UFILE_AVAILABLE_NOTIFICATIONS_VALIDATORS \
+  UFILE_AVAILABLE_NOTIFICATIONS ".validators"
 #define UFILE_BOOT "boot"
 #define UFILE_LAST_UPDATE "last-update"
+#define UFILE_PACKAGE_LIST "package-list"
 
 gchar *user_file_get_state_dir_path ();
 FILE *user_file_open_for_read (const gchar *name);
@@ -47,7 +50,10 @@ FILE *user_file_open_for_write (const gchar *name);
 int user_file_remove (const gchar *name);
 
 xexp *user_file_read_xexp (const gchar *name);
+int user_file_visit_xexp (const gchar *name,
+                          xexp_visitor *visitor, void *data);
 void user_file_write_xexp (const gchar *name, xexp *x);
+void user_file_write_xexp_binary (const gchar *name, xexp *x);
 
 #ifdef __cplusplus
 }
@@ -50,7 +50,10 @@
 #include "user_files.h"
 #include "update-notifier-conf.h"
 #include "package-info-cell-renderer.h"
+#include "package-list-model.h"
 #include "confutils.h"
+#include "trace.h"
+#include "watchdog.h"
 
 #define _(x) gettext (x)
 #define _FM(x) dgettext ("hildon-fm", x)
@@ -198,6 +201,9 @@ push_dialog (GtkWidget *dialog)
 
   g_debug ("pushing dialog %p", dialog);
   dialog_stack = g_slist_prepend (dialog_stack, dialog);
+
+  trace_begin ("dialog", "dialog", dialog,
+	       gtk_window_get_title (GTK_WINDOW (dialog)));
 }
 
 void
@@ -207,6 +213,12 @@ pop_dialog (GtkWidget *dialog)
   g_debug ("child = %p ~ parent = %p", dialog, dialog_stack->data);
   g_assert (dialog_stack->data == dialog);
 
+  /* The main window is pushed by start_interaction_flow, without
+     push_dialog.
+  */
+  if (dialog != GTK_WIDGET (get_main_window ()))
+    trace_end ("dialog", "dialog", dialog);
+
   {
     GSList *old = dialog_stack;
     dialog_stack = dialog_stack->next;
@@ -220,6 +232,10 @@ pop_dialog (GtkWidget *dialog)
 
 static bool interaction_flow_active = false;
 
+/* Identifies the current interaction flow in traces.
+ */
+static int interaction_flow_serial = 0;
+
 bool
 is_idle ()
 {
@@ -251,6 +267,9 @@ start_interaction_flow ()
   g_assert (dialog_stack == NULL);
 
   interaction_flow_active = true;
+  interaction_flow_serial++;
+  trace_begin ("flow", "interaction flow",
+	       GINT_TO_POINTER (interaction_flow_serial));
   parent_xid = None;
   dialog_stack = g_slist_prepend (dialog_stack, get_main_window ());
 
@@ -273,6 +292,9 @@ start_foreign_interaction_flow (Window parent)
   g_assert (dialog_stack == NULL);
 
   interaction_flow_active = true;
+  interaction_flow_serial++;
+  trace_begin ("flow", "interaction flow",
+	       GINT_TO_POINTER (interaction_flow_serial), "foreign");
   parent_xid = parent;
   return true;
 }
@@ -352,6 +374,8 @@ end_interaction_flow ()
 
   interaction_flow_active = false;
   parent_xid = None;
+  trace_end ("flow", "interaction flow",
+	     GINT_TO_POINTER (interaction_flow_serial));
 
   reset_idle_timer ();
 
@@ -1599,7 +1623,7 @@ make_small_label (const char *text)
 }
 
 static GtkTreeModelFilter *global_tree_model_filter = NULL;
-static GtkListStore *global_list_store = NULL;
+static PackageListModel *global_package_model = NULL;
 static bool global_installed;
 
 static bool global_icons_initialized = false;
@@ -2013,16 +2037,17 @@ make_global_package_list (GtkWidget *window,
       return label;
     }
 
-  /* Just create a new model for the first time */
-  if (global_list_store == NULL)
-    global_list_store = gtk_list_store_new (1, G_TYPE_POINTER);
+  /* Fill the model before any new view is attached to it, so that
+     the new tree view doesn't have to process a signal per row.
+  */
+  set_global_package_list (packages, installed, selected, activated);
 
   if (global_tree_model_filter != NULL)
     g_object_unref (global_tree_model_filter);
 
   /* Create a tree model filter with the actual model inside */
   global_tree_model_filter =
-    GTK_TREE_MODEL_FILTER (gtk_tree_model_filter_new (GTK_TREE_MODEL (global_list_store), NULL));
+    GTK_TREE_MODEL_FILTER (gtk_tree_model_filter_new (GTK_TREE_MODEL (global_package_model), NULL));
 
   /* Insert the filter into the treeview */
   tree = gtk_tree_view_new_with_model (GTK_TREE_MODEL (global_tree_model_filter));
@@ -2101,8 +2126,6 @@ make_global_package_list (GtkWidget *window,
   gtk_widget_show_all (menu);
 #endif /* TAP_AND_HOLD && MAEMO_CHANGES */
 
-  set_global_package_list (packages, installed, selected, activated);
-
   grab_focus_on_map (tree);
 
   /* Scroll to desired cell, if needed */
@@ -2241,26 +2264,41 @@ package_is_hidden (package_info *pi)
   return strlen (section) == len && !strncmp (section, hidden, len);
 }
 
+static gboolean
+package_row_visible (gpointer row, gpointer unused)
+{
+  package_info *pi = (package_info *)row;
+
+  /* don't show the package if it isn't installed
+   * and it's in the section "user/hidden"
+   */
+  return pi->installed_version || !package_is_hidden (pi);
+}
+
+static gboolean
+remember_package_iter (GtkTreeModel *model, GtkTreePath *path,
+                       GtkTreeIter *iter, gpointer unused)
+{
+  package_info *pi;
+
+  gtk_tree_model_get (model, iter, 0, &pi, -1);
+  pi->model = model;
+  pi->iter = *iter;
+
+  return FALSE;
+}
+
 static void
 set_global_package_list (GList *packages,
 			 bool installed,
 			 package_info_callback *selected,
 			 package_info_callback *activated)
 {
-  if (global_list_store)
-    {
-      /* @FIXME:
-         Gotta set entries to NULL first, because some bug in maemo-gtk/hildon
-         is causing calls to cat_icon_func/cat_text_func with garbage data
-      */
-      GtkTreeIter itr;
-      if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (global_list_store), &itr))
-        do
-          {
-            gtk_list_store_set(global_list_store, &itr, 0, NULL, -1);
-          } while (gtk_tree_model_iter_next (GTK_TREE_MODEL (global_list_store), &itr));
-      gtk_list_store_clear (global_list_store);
-    }
+  WATCHDOG_SECTION;
+
+  /* Just create a new model for the first time */
+  if (global_package_model == NULL)
+    global_package_model = package_list_model_new ();
 
   for (GList *p = global_packages; p; p = p->next)
     {
@@ -2273,24 +2311,17 @@ set_global_package_list (GList *packages,
   global_activation_callback = activated;
   global_packages = packages;
 
-  int pos = 0;
-  for (GList *p = global_packages; p; p = p->next)
-    {
-      package_info *pi = (package_info *)p->data;
-
-      /* don't insert the package if it isn't installed
-       * and it's in the section "user/hidden"
-       */
-      if (!pi->installed_version && package_is_hidden (pi))
-        continue;
+  /* This only emits a single "rows-reordered" signal when just the
+     sort order has changed.
+  */
+  package_list_model_set_rows (global_package_model, global_packages,
+                               package_row_visible, NULL);
 
-      pi->model = GTK_TREE_MODEL (global_list_store);
-      gtk_list_store_insert_with_values (global_list_store, &pi->iter,
-                                         pos,
-                                         0, pi,
-                                         -1);
-      pos++;
-    }
+  /* Iterators are cheap to compute for our model, but
+     global_package_info_changed wants them ready.
+  */
+  gtk_tree_model_foreach (GTK_TREE_MODEL (global_package_model),
+                          remember_package_iter, NULL);
 }
 
 void
@@ -2513,6 +2544,8 @@ reload_section_icons (GtkWidget *widget, GtkStyle *prev_style, gpointer user_dat
 GtkWidget *
 make_global_section_list (GList *sections, section_activated *act)
 {
+  WATCHDOG_SECTION;
+
   global_section_activated = act;
 
   if (sections == NULL)
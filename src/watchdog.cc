@@ -0,0 +1,242 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include "watchdog.h"
+#include "settings.h"
+#include "log.h"
+
+/* The sections that are open or have been completed during the
+   current iteration of the main loop.  Deeper nesting and more
+   sections than this are not remembered.
+*/
+#define MAX_DEPTH    8
+#define MAX_SECTIONS 16
+
+struct section_record {
+  const char *name;
+  long long start;
+  long long usec;
+};
+
+bool watchdog_enabled = false;
+
+static int env_threshold_ms = 0;
+static long long threshold_usec;
+
+static GPollFunc orig_poll_func;
+static long long dispatch_start;
+
+static void (*describe_func) (GString *str);
+
+static const char *open_names[MAX_DEPTH];
+static long long open_start[MAX_DEPTH];
+static int depth;
+
+static section_record sections[MAX_SECTIONS];
+static int n_sections;
+
+/* Over the whole run, for the summary in the log.
+ */
+static unsigned long n_iterations;
+static unsigned long n_stalls;
+static long long max_usec;
+
+static long long
+now_usec ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static int
+compare_section_starts (const void *a, const void *b)
+{
+  long long sa = ((const section_record *) a)->start;
+  long long sb = ((const section_record *) b)->start;
+  return (sa > sb) - (sa < sb);
+}
+
+static void
+report_stall (long long usec)
+{
+  GString *str = g_string_new (NULL);
+
+  g_string_append_printf (str, "Main loop blocked for %lld ms",
+			  usec / 1000);
+
+  if (n_sections == 0 && depth == 0)
+    g_string_append (str, " outside of known sections");
+  else
+    {
+      /* Sections are recorded when they are left, i.e., inner ones
+	 before outer ones.  Show them in the order they were entered.
+      */
+      qsort (sections, n_sections, sizeof (section_record),
+	     compare_section_starts);
+
+      g_string_append (str, " in");
+      for (int i = 0; i < depth && i < MAX_DEPTH; i++)
+	g_string_append_printf (str, "%s %s (not finished)",
+				i > 0 ? "," : "", open_names[i]);
+      for (int i = 0; i < n_sections; i++)
+	g_string_append_printf (str, "%s %s %lld ms",
+				(i > 0 || depth > 0) ? "," : "",
+				sections[i].name,
+				sections[i].usec / 1000);
+    }
+
+  if (describe_func)
+    {
+      g_string_append (str, "; ");
+      describe_func (str);
+    }
+
+  add_log ("%s\n", str->str);
+  g_string_free (str, TRUE);
+}
+
+/* This wraps the poll function of the default main context.  The
+   time between returning from one call and entering the next one is
+   the time spent dispatching events in one iteration.
+*/
+static gint
+watchdog_poll (GPollFD *fds, guint nfds, gint timeout)
+{
+  if (watchdog_enabled && dispatch_start > 0)
+    {
+      long long usec = now_usec () - dispatch_start;
+
+      n_iterations++;
+      if (usec > max_usec)
+	max_usec = usec;
+      if (usec >= threshold_usec)
+	{
+	  n_stalls++;
+	  report_stall (usec);
+	}
+    }
+
+  n_sections = 0;
+
+  gint res = orig_poll_func (fds, nfds, timeout);
+
+  dispatch_start = now_usec ();
+  return res;
+}
+
+static void
+watchdog_summary ()
+{
+  if (n_iterations > 0)
+    add_log ("Main loop: %lu iterations, %lu stalls, longest %lld ms\n",
+	     n_iterations, n_stalls, max_usec / 1000);
+}
+
+void
+watchdog_update ()
+{
+  bool enabled;
+  int threshold_ms;
+
+  if (env_threshold_ms > 0)
+    {
+      enabled = true;
+      threshold_ms = env_threshold_ms;
+    }
+  else
+    {
+      enabled = red_pill_mode && red_pill_log_stalls;
+      threshold_ms = WATCHDOG_DEFAULT_THRESHOLD_MS;
+    }
+
+  if (enabled == watchdog_enabled)
+    return;
+
+  if (enabled)
+    {
+      threshold_usec = threshold_ms * 1000LL;
+      dispatch_start = 0;
+      depth = 0;
+      n_sections = 0;
+      add_log ("Logging main loop stalls of %d ms or more\n",
+	       threshold_ms);
+    }
+  else
+    watchdog_summary ();
+
+  watchdog_enabled = enabled;
+}
+
+void
+watchdog_init ()
+{
+  const char *env = getenv ("HAM_STALL_MS");
+  if (env)
+    env_threshold_ms = atoi (env);
+
+  orig_poll_func = g_main_context_get_poll_func (NULL);
+  g_main_context_set_poll_func (NULL, watchdog_poll);
+
+  watchdog_update ();
+}
+
+void
+watchdog_set_describe_func (void (*func) (GString *str))
+{
+  describe_func = func;
+}
+
+void
+watchdog_enter (const char *name)
+{
+  if (depth < MAX_DEPTH)
+    {
+      open_names[depth] = name;
+      open_start[depth] = now_usec ();
+    }
+  depth++;
+}
+
+void
+watchdog_leave (const char *name)
+{
+  /* The watchdog might have been enabled in the middle of a
+     section.
+  */
+  if (depth == 0)
+    return;
+
+  depth--;
+  if (depth < MAX_DEPTH && n_sections < MAX_SECTIONS)
+    {
+      section_record *s = &sections[n_sections++];
+      s->name = open_names[depth];
+      s->start = open_start[depth];
+      s->usec = now_usec () - s->start;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the hildon-application-manager.
+ *
+ * Copyright (C) 2007, 2008 Nokia Corporation.  All Rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <glib.h>
+
+/** Main loop watchdog
+
+  The watchdog measures how long each iteration of the main loop
+  spends dispatching events, i.e., how long the UI does not respond.
+  When that is longer than a threshold, it adds a line to the log
+  with the duration, the instrumented sections that ran in that
+  iteration, and a description of the state of the UI.
+
+  The watchdog is active when the environment variable HAM_STALL_MS
+  is set to the threshold in milliseconds, or in red-pill mode when
+  "Log main loop stalls" is checked in the settings.  In that case,
+  the threshold is WATCHDOG_DEFAULT_THRESHOLD_MS.
+
+  WATCHDOG_INIT installs the watchdog and should be called after the
+  settings have been loaded.  WATCHDOG_UPDATE activates or
+  deactivates it according to the settings, and must be called when
+  they change.
+
+  WATCHDOG_SET_DESCRIBE_FUNC sets the function that is called to
+  describe the state of the UI, such as the current view and the
+  sizes of the package lists.  It should append a short text to STR.
+
+  WATCHDOG_ENTER and WATCHDOG_LEAVE bracket a section of code that is
+  known to take long, such as sorting all packages, and must be
+  properly nested.  The WATCHDOG_SECTION macro does this for the rest
+  of the enclosing block, naming the section after the calling
+  function.
+*/
+
+#define WATCHDOG_DEFAULT_THRESHOLD_MS 200
+
+extern bool watchdog_enabled;
+
+void watchdog_init ();
+void watchdog_update ();
+
+void watchdog_set_describe_func (void (*func) (GString *str));
+
+void watchdog_enter (const char *name);
+void watchdog_leave (const char *name);
+
+struct watchdog_section {
+  const char *name;
+
+  watchdog_section (const char *n)
+    : name (n)
+  {
+    if (watchdog_enabled)
+      watchdog_enter (name);
+  }
+
+  ~watchdog_section ()
+  {
+    if (watchdog_enabled)
+      watchdog_leave (name);
+  }
+};
+
+#define WATCHDOG_SECTION \
+  watchdog_section watchdog_section_here (__FUNCTION__)
+
+#endif /* !WATCHDOG_H */
@@ -35,8 +35,223 @@ struct xexp {
   xexp *rest;
   xexp *first;
   char *text;
+
+  /* For lists, LAST points to the last child so that appending does
+     not need to walk the list.  INDEX maps tags to the first child
+     with that tag.  It is only built when xexp_aref has to scan a
+     long list, and is dropped again by changes to the list that it
+     can not easily follow.
+  */
+  xexp *last;
+  GHashTable *index;
+
+  /* The pool that this xexp and its text have been allocated from, or
+     NULL when they have been allocated individually.  The tag is
+     allocated the same way.
+  */
+  xexp_pool *pool;
+};
+
+/** Pools
+
+    A pool hands out memory for the nodes and texts of a tree by
+    bumping a pointer through a few big chunks.  Individual nodes are
+    never returned to the pool; instead, the pool counts the nodes
+    that are still alive, plus one reference for its creator, and
+    frees all chunks at once when that count drops to zero.
+
+    Each distinct tag is stored only once per pool.  TAGS maps the
+    tags to their copies in the chunks.
+
+    Thus, xexps from pools behave exactly like other xexps: they can
+    be moved into other trees, freed individually, and mixed freely
+    with individually allocated xexps.
+*/
+
+struct xexp_pool {
+  int ref_count;
+  GSList *chunks;
+  char *free;
+  gsize n_free;
+  gsize chunk_size;
+  GHashTable *tags;
 };
 
+#define XEXP_POOL_MIN_CHUNK_SIZE  256
+#define XEXP_POOL_MAX_CHUNK_SIZE  16384
+
+static xexp_pool *
+xexp_pool_new_1 (gsize chunk_size)
+{
+  xexp_pool *pool = g_new0 (xexp_pool, 1);
+  pool->ref_count = 1;
+  pool->chunk_size = MAX (chunk_size, XEXP_POOL_MIN_CHUNK_SIZE);
+  return pool;
+}
+
+xexp_pool *
+xexp_pool_new (void)
+{
+  return xexp_pool_new_1 (XEXP_POOL_MIN_CHUNK_SIZE);
+}
+
+void
+xexp_pool_unref (xexp_pool *pool)
+{
+  GSList *c;
+
+  if (pool == NULL || --pool->ref_count > 0)
+    return;
+
+  if (pool->tags)
+    g_hash_table_destroy (pool->tags);
+  for (c = pool->chunks; c; c = c->next)
+    g_free (c->data);
+  g_slist_free (pool->chunks);
+  g_free (pool);
+}
+
+static gpointer
+xexp_pool_alloc (xexp_pool *pool, gsize size, gsize align)
+{
+  gsize pad = (align - ((gsize) pool->free & (align - 1))) & (align - 1);
+  gpointer mem;
+
+  if (pool->free == NULL || pad + size > pool->n_free)
+    {
+      /* Big texts get a chunk of their own, so that they don't waste
+	 the rest of the current one.
+      */
+      if (size > pool->chunk_size / 4)
+	{
+	  mem = g_malloc (size);
+	  pool->chunks = g_slist_prepend (pool->chunks, mem);
+	  return mem;
+	}
+
+      pool->free = (char *) g_malloc (pool->chunk_size);
+      pool->n_free = pool->chunk_size;
+      pool->chunks = g_slist_prepend (pool->chunks, pool->free);
+      if (pool->chunk_size < XEXP_POOL_MAX_CHUNK_SIZE)
+	pool->chunk_size *= 2;
+      pad = 0;
+    }
+
+  mem = pool->free + pad;
+  pool->free += pad + size;
+  pool->n_free -= pad + size;
+  return mem;
+}
+
+static char *
+xexp_strndup (xexp_pool *pool, const char *text, gsize len)
+{
+  char *str;
+
+  if (pool == NULL)
+    return g_strndup (text, len);
+
+  str = (char *) xexp_pool_alloc (pool, len + 1, 1);
+  memcpy (str, text, len);
+  str[len] = '\0';
+  return str;
+}
+
+static char *
+xexp_pool_tag (xexp_pool *pool, const char *tag)
+{
+  char *str;
+
+  if (pool->tags == NULL)
+    pool->tags = g_hash_table_new (g_str_hash, g_str_equal);
+  else if ((str = (char *) g_hash_table_lookup (pool->tags, tag)) != NULL)
+    return str;
+
+  str = xexp_strndup (pool, tag, strlen (tag));
+  g_hash_table_insert (pool->tags, str, str);
+  return str;
+}
+
+static xexp *
+xexp_node_new (xexp_pool *pool, const char *tag)
+{
+  xexp *x;
+
+  if (pool)
+    {
+      x = (xexp *) xexp_pool_alloc (pool, sizeof (xexp), sizeof (gpointer));
+      memset (x, 0, sizeof (xexp));
+      x->pool = pool;
+      x->tag = xexp_pool_tag (pool, tag);
+      pool->ref_count++;
+    }
+  else
+    {
+      x = g_new0 (xexp, 1);
+      x->tag = g_strdup (tag);
+    }
+
+  return x;
+}
+
+xexp *
+xexp_pool_list_new (xexp_pool *pool, const char *tag)
+{
+  g_assert (pool);
+  g_assert (tag);
+
+  return xexp_node_new (pool, tag);
+}
+
+xexp *
+xexp_pool_text_new (xexp_pool *pool, const char *tag, const char *text)
+{
+  g_assert (pool);
+  g_assert (tag);
+  g_assert (text);
+
+  xexp *x = xexp_node_new (pool, tag);
+  if (*text)
+    x->text = xexp_strndup (pool, text, strlen (text));
+  return x;
+}
+
+/* Lists with at least this many children get an index once xexp_aref
+   has to scan them.
+*/
+#define XEXP_INDEX_THRESHOLD 16
+
+static void
+xexp_index_drop (xexp *x)
+{
+  if (x->index)
+    {
+      g_hash_table_destroy (x->index);
+      x->index = NULL;
+    }
+}
+
+static void
+xexp_index_build (xexp *x)
+{
+  xexp *y;
+
+  x->index = g_hash_table_new (g_str_hash, g_str_equal);
+  for (y = x->first; y; y = y->rest)
+    if (g_hash_table_lookup (x->index, y->tag) == NULL)
+      g_hash_table_replace (x->index, y->tag, y);
+}
+
+/* Drop the index of X when Y, which is about to leave X, is the child
+   that it finds for Y's tag.
+*/
+static void
+xexp_index_forget (xexp *x, xexp *y)
+{
+  if (x->index && g_hash_table_lookup (x->index, y->tag) == y)
+    xexp_index_drop (x);
+}
+
 xexp *
 xexp_rest (xexp *x)
 {
@@ -61,28 +276,61 @@ xexp_free (xexp *x)
       xexp_free (c);
       c = r;
     }
-  g_free (x->tag);
-  g_free (x->text);
-  g_free (x);
+  xexp_index_drop (x);
+  if (x->pool)
+    xexp_pool_unref (x->pool);
+  else
+    {
+      g_free (x->tag);
+      g_free (x->text);
+      g_free (x);
+    }
 }
 
-xexp *
-xexp_copy (xexp *x)
+static gsize
+xexp_copy_size (xexp *x)
 {
-  xexp *y, *z, **zptr;
+  gsize size = sizeof (xexp) + sizeof (gpointer) + strlen (x->tag) + 1;
+  xexp *y;
 
-  if (x == NULL)
-    return NULL;
+  if (x->text)
+    size += strlen (x->text) + 1;
+  for (y = x->first; y; y = y->rest)
+    size += xexp_copy_size (y);
+  return size;
+}
+
+static xexp *
+xexp_copy_1 (xexp_pool *pool, xexp *x)
+{
+  xexp *y, *z, **zptr;
 
-  y = g_new0 (xexp, 1);
-  y->tag = g_strdup (x->tag);
-  y->text = g_strdup (x->text);
+  y = xexp_node_new (pool, x->tag);
+  if (x->text)
+    y->text = xexp_strndup (pool, x->text, strlen (x->text));
   
   for (z = x->first, zptr = &y->first;
        z;
        z = z->rest, zptr = &(*zptr)->rest)
-    *zptr = xexp_copy (z);
+    *zptr = y->last = xexp_copy_1 (pool, z);
+
+  return y;
+}
+
+xexp *
+xexp_copy (xexp *x)
+{
+  xexp_pool *pool;
+  xexp *y;
 
+  if (x == NULL)
+    return NULL;
+
+  /* The size of the copy is known, so it fits into a single chunk.
+   */
+  pool = xexp_pool_new_1 (xexp_copy_size (x));
+  y = xexp_copy_1 (pool, x);
+  xexp_pool_unref (pool);
   return y;
 }
 
@@ -95,7 +343,7 @@ xexp_tag (xexp *x)
 int
 xexp_is (xexp *x, const char *tag)
 {
-  return strcmp (x->tag, tag) == 0;
+  return x->tag == tag || strcmp (x->tag, tag) == 0;
 }
 
 int
@@ -109,9 +357,7 @@ xexp_list_new (const char *tag)
 {
   g_assert (tag);
 
-  xexp *x = g_new0 (xexp, 1);
-  x->tag = g_strdup (tag);
-  return x;
+  return xexp_node_new (NULL, tag);
 }
 
 xexp *
@@ -159,6 +405,8 @@ xexp_list_sort (xexp *x,
 
       /* Finish the list */
       x_item1->rest = NULL;
+      x->last = x_item1;
+      xexp_index_drop (x);
 
       g_slist_free (x_slist);
     }
@@ -201,6 +449,7 @@ xexp_list_filter (xexp *x, int (*xexp_filter_func) (xexp *x))
   /* Finish the list */
   if (last_inserted_item)
     last_inserted_item->rest = NULL;
+  filtered_xexp->last = last_inserted_item;
 
   return filtered_xexp;
 }
@@ -239,6 +488,7 @@ xexp_list_map (xexp *x, xexp * (*xexp_map_func) (xexp *x))
   /* Finish the list */
   if (last_inserted_item)
     last_inserted_item->rest = NULL;
+  mapped_xexp->last = last_inserted_item;
 
   return mapped_xexp;
 }
@@ -277,34 +527,45 @@ xexp_cons (xexp *x, xexp *y)
   g_return_if_fail (xexp_rest (y) == NULL);
   y->rest = x->first;
   x->first = y;
+  if (x->last == NULL)
+    x->last = y;
+  if (x->index)
+    g_hash_table_replace (x->index, y->tag, y);
 }
 
 void
 xexp_append_1 (xexp *x, xexp *y)
 {
-  xexp **yptr;
-
   g_return_if_fail (xexp_is_list (x));
+  g_return_if_fail (y != NULL);
   g_return_if_fail (xexp_rest (y) == NULL);
 
-  for (yptr = &x->first; *yptr; yptr = &(*yptr)->rest)
-    ;
-  *yptr = y;
+  if (x->last)
+    x->last->rest = y;
+  else
+    x->first = y;
+  x->last = y;
+  if (x->index && g_hash_table_lookup (x->index, y->tag) == NULL)
+    g_hash_table_replace (x->index, y->tag, y);
 }
 
 void
 xexp_append (xexp *x, xexp *y)
 {
-  xexp **yptr;
-
   g_return_if_fail (xexp_is_list (x));
   g_return_if_fail (xexp_is_list (y));
   g_return_if_fail (xexp_rest (y) == NULL);
 
-  for (yptr = &x->first; *yptr; yptr = &(*yptr)->rest)
-    ;
-  *yptr = y->first;
-  y->first = NULL;
+  if (y->first)
+    {
+      if (x->last)
+	x->last->rest = y->first;
+      else
+	x->first = y->first;
+      x->last = y->last;
+      xexp_index_drop (x);
+    }
+  y->first = y->last = NULL;
   xexp_free (y);
 }
 
@@ -317,6 +578,7 @@ xexp_reverse (xexp *x)
 
   y = x->first;
   f = NULL;
+  x->last = y;
   while (y)
     {
       xexp *r = y->rest;
@@ -325,12 +587,13 @@ xexp_reverse (xexp *x)
       y = r;
     }
   x->first = f;
+  xexp_index_drop (x);
 }
 
 void
 xexp_del (xexp *x, xexp *z)
 {
-  xexp **yptr;
+  xexp **yptr, *prev = NULL;
 
   g_return_if_fail (xexp_is_list (x));
   yptr = &x->first;
@@ -339,11 +602,15 @@ xexp_del (xexp *x, xexp *z)
       xexp *y = *yptr;
       if (y == z)
 	{
+	  xexp_index_forget (x, y);
+	  if (x->last == y)
+	    x->last = prev;
 	  *yptr = y->rest;
 	  y->rest = NULL;
 	  xexp_free (y);
 	  return;
 	}
+      prev = y;
       yptr = &(*yptr)->rest;
     }
   g_return_if_reached ();
@@ -359,7 +626,10 @@ xexp_pop (xexp *x)
   y = x->first;
   if (y)
     {
+      xexp_index_forget (x, y);
       x->first = y->rest;
+      if (x->first == NULL)
+	x->last = NULL;
       y->rest = NULL;
     }
   return y;
@@ -371,8 +641,7 @@ xexp_text_new (const char *tag, const char *text)
   g_assert (tag);
   g_assert (text);
 
-  xexp *x = g_new0 (xexp, 1);
-  x->tag = g_strdup (tag);
+  xexp *x = xexp_node_new (NULL, tag);
   if (*text)
     x->text = g_strdup (text);
   return x;
@@ -384,8 +653,7 @@ xexp_text_newn (const char *tag, const char *text, int len)
   g_assert (tag);
   g_assert (text);
 
-  xexp *x = g_new0 (xexp, 1);
-  x->tag = g_strdup (tag);
+  xexp *x = xexp_node_new (NULL, tag);
   if (*text)
     x->text = g_strndup (text, len);
   return x;
@@ -423,13 +691,26 @@ xexp_aref (xexp *x, const char *tag)
 {
   if (xexp_is_list (x))
     {
-      xexp *y = xexp_first (x);
+      int n = 0;
+      xexp *y;
+
+      if (x->index)
+	return (xexp *) g_hash_table_lookup (x->index, tag);
+
+      y = xexp_first (x);
       while (y)
 	{
 	  if (xexp_is (y, tag))
 	    return y;
 	  y = xexp_rest (y);
+	  n++;
 	}
+
+      /* Looking for something that isn't there is the most expensive
+	 case, make it cheaper next time.
+      */
+      if (n >= XEXP_INDEX_THRESHOLD)
+	xexp_index_build (x);
     }
   return NULL;
 }
@@ -509,9 +790,20 @@ xexp_aset_int (xexp *x, const char *tag, int val)
 void
 xexp_adel (xexp *x, const char *tag)
 {
-  xexp **yptr;
+  xexp **yptr, *prev = NULL;
 
   g_return_if_fail (xexp_is_list (x));
+
+  /* All children with TAG go away, and the others stay where they
+     are, so the index only needs to forget TAG.
+  */
+  if (x->index)
+    {
+      if (g_hash_table_lookup (x->index, tag) == NULL)
+	return;
+      g_hash_table_remove (x->index, tag);
+    }
+
   yptr = &x->first;
   while (*yptr)
     {
@@ -523,14 +815,19 @@ xexp_adel (xexp *x, const char *tag)
 	  xexp_free (y);
 	}
       else
-	yptr = &(*yptr)->rest;
+	{
+	  prev = y;
+	  yptr = &(*yptr)->rest;
+	}
     }
+  x->last = prev;
 }
 
 static void
 transmogrify_text_to_empty (xexp *x)
 {
-  g_free (x->text);
+  if (x->pool == NULL)
+    g_free (x->text);
   x->text = NULL;
 }
 
@@ -538,7 +835,7 @@ static void
 transmogrify_empty_to_text (xexp *x, const char *text)
 {
   g_assert (text && *text);
-  x->text = g_strdup (text);
+  x->text = xexp_strndup (x->pool, text, strlen (text));
 }
 
 /** Parsing */
@@ -546,6 +843,7 @@ transmogrify_empty_to_text (xexp *x, const char *text)
 typedef struct {
   xexp *result;
   GSList *stack;
+  xexp_pool *pool;
 } xexp_parse_context;
 
 static void
@@ -572,7 +870,7 @@ xexp_parser_start_element (GMarkupParseContext *context,
 {
   xexp_parse_context *xp = (xexp_parse_context *)user_data;
 
-  xexp *x = xexp_list_new (element_name);
+  xexp *x = xexp_node_new (xp->pool, element_name);
   if (xp->stack)
     {
       /* If the current node is a text, it must be all whitespace and
@@ -642,6 +940,269 @@ static GMarkupParser xexp_markup_parser = {
   NULL
 };
 
+/** Binary format
+
+    A binary xexp starts with XEXP_BINARY_MAGIC, followed by a table
+    of the tags used in it and then the root node.  Numbers are
+    unsigned and written seven bits at a time, least significant bits
+    first, with the high bit of each byte set when more bytes follow.
+    Strings are a number giving their length, followed by that many
+    bytes.
+
+      FILE = MAGIC NUMBER-OF-TAGS STRING...  NODE
+      NODE = HEADER                          (empty)
+           | HEADER STRING                   (text)
+           | HEADER NUMBER-OF-CHILDREN NODE...  (list)
+
+    HEADER is the index of the tag in the table, shifted left by two
+    bits, with the kind of the node in the lowest two bits.
+
+    The magic starts with a NUL byte, which can not start a XML
+    document.  That is how xexp_read and xexp_visit tell the two
+    formats apart.
+*/
+
+#define XEXP_BINARY_MAGIC     "\0XB1"
+#define XEXP_BINARY_MAGIC_LEN 4
+
+enum {
+  XEXP_BINARY_EMPTY = 0,
+  XEXP_BINARY_TEXT  = 1,
+  XEXP_BINARY_LIST  = 2
+};
+
+/* Bounds that keep a corrupted file from making us allocate or
+   recurse without end.
+*/
+#define XEXP_BINARY_MAX_STRING (16*1024*1024)
+#define XEXP_BINARY_MAX_TAGS   65536
+#define XEXP_BINARY_MAX_DEPTH  256
+
+typedef struct {
+  FILE *f;
+  char **tags;
+  guint n_tags;
+  xexp_pool *pool;
+  int failed;
+  GError **error;
+} xexp_binary_reader;
+
+static int
+binary_fail (xexp_binary_reader *r, const char *msg)
+{
+  if (!r->failed)
+    g_set_error (r->error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+		 "%s", msg);
+  r->failed = TRUE;
+  return FALSE;
+}
+
+static int
+binary_read_number (xexp_binary_reader *r, guint *val)
+{
+  guint v = 0;
+  int shift = 0;
+  int c;
+
+  do
+    {
+      if (shift > 28)
+	return binary_fail (r, "Binary xexp has an overlong number");
+      c = getc (r->f);
+      if (c == EOF)
+	return binary_fail (r, "Binary xexp ended unexpectedly");
+      v |= ((guint) (c & 0x7f)) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+
+  *val = v;
+  return TRUE;
+}
+
+/* Returns a NUL-terminated string allocated from POOL, or with
+   g_malloc when POOL is NULL.  Returns NULL on errors.
+*/
+static char *
+binary_read_string (xexp_binary_reader *r, xexp_pool *pool, guint *len)
+{
+  char *str;
+
+  if (!binary_read_number (r, len))
+    return NULL;
+  if (*len > XEXP_BINARY_MAX_STRING)
+    {
+      binary_fail (r, "Binary xexp has an overlong string");
+      return NULL;
+    }
+
+  if (pool)
+    str = (char *) xexp_pool_alloc (pool, *len + 1, 1);
+  else
+    str = (char *) g_malloc (*len + 1);
+  if (fread (str, 1, *len, r->f) != *len)
+    {
+      if (pool == NULL)
+	g_free (str);
+      binary_fail (r, "Binary xexp ended unexpectedly");
+      return NULL;
+    }
+  str[*len] = '\0';
+  return str;
+}
+
+static int
+binary_read_header (xexp_binary_reader *r, const char **tag, int *kind)
+{
+  guint header;
+
+  if (!binary_read_number (r, &header))
+    return FALSE;
+  if ((header >> 2) >= r->n_tags || (header & 3) > XEXP_BINARY_LIST)
+    return binary_fail (r, "Binary xexp has an invalid node");
+
+  *tag = r->tags[header >> 2];
+  *kind = header & 3;
+  return TRUE;
+}
+
+static xexp *binary_read_node (xexp_binary_reader *r, int depth);
+
+static xexp *
+binary_read_body (xexp_binary_reader *r, const char *tag, int kind,
+		  int depth)
+{
+  xexp *x, **xptr;
+  char *text;
+  guint n;
+
+  if (kind == XEXP_BINARY_TEXT)
+    {
+      if ((text = binary_read_string (r, r->pool, &n)) == NULL)
+	return NULL;
+      x = xexp_node_new (r->pool, tag);
+      if (n > 0)
+	x->text = text;
+      return x;
+    }
+
+  x = xexp_node_new (r->pool, tag);
+  if (kind == XEXP_BINARY_EMPTY)
+    return x;
+
+  if (!binary_read_number (r, &n))
+    {
+      xexp_free (x);
+      return NULL;
+    }
+
+  xptr = &x->first;
+  while (n-- > 0)
+    {
+      xexp *y = binary_read_node (r, depth + 1);
+      if (y == NULL)
+	{
+	  xexp_free (x);
+	  return NULL;
+	}
+      *xptr = x->last = y;
+      xptr = &y->rest;
+    }
+
+  return x;
+}
+
+static xexp *
+binary_read_node (xexp_binary_reader *r, int depth)
+{
+  const char *tag;
+  int kind;
+
+  if (depth > XEXP_BINARY_MAX_DEPTH)
+    {
+      binary_fail (r, "Binary xexp is nested too deeply");
+      return NULL;
+    }
+
+  if (!binary_read_header (r, &tag, &kind))
+    return NULL;
+  return binary_read_body (r, tag, kind, depth);
+}
+
+/* Reads the rest of the magic, after the initial NUL byte, and the
+   tag table.
+*/
+static int
+binary_reader_init (xexp_binary_reader *r, FILE *f, GError **error)
+{
+  char magic[XEXP_BINARY_MAGIC_LEN - 1];
+  guint n, len;
+
+  r->f = f;
+  r->tags = NULL;
+  r->n_tags = 0;
+  r->pool = NULL;
+  r->failed = FALSE;
+  r->error = error;
+
+  if (fread (magic, 1, sizeof (magic), f) != sizeof (magic)
+      || memcmp (magic, XEXP_BINARY_MAGIC + 1, sizeof (magic)))
+    return binary_fail (r, "Unknown binary xexp format");
+
+  if (!binary_read_number (r, &n))
+    return FALSE;
+  if (n > XEXP_BINARY_MAX_TAGS)
+    return binary_fail (r, "Binary xexp has too many tags");
+
+  r->tags = g_new0 (char *, n);
+  for (; r->n_tags < n; r->n_tags++)
+    if ((r->tags[r->n_tags] = binary_read_string (r, NULL, &len)) == NULL)
+      return FALSE;
+
+  return TRUE;
+}
+
+static void
+binary_reader_finish (xexp_binary_reader *r)
+{
+  guint i;
+
+  for (i = 0; i < r->n_tags; i++)
+    g_free (r->tags[i]);
+  g_free (r->tags);
+}
+
+/* Returns true when F starts with a binary xexp.  The initial NUL
+   byte is consumed in that case, otherwise F is left alone.
+*/
+static int
+binary_detect (FILE *f)
+{
+  int c = getc (f);
+
+  if (c == 0)
+    return TRUE;
+  if (c != EOF)
+    ungetc (c, f);
+  return FALSE;
+}
+
+static xexp *
+xexp_read_binary (FILE *f, GError **error)
+{
+  xexp_binary_reader r;
+  xexp *x = NULL;
+
+  if (binary_reader_init (&r, f, error))
+    {
+      r.pool = xexp_pool_new ();
+      x = binary_read_node (&r, 0);
+      xexp_pool_unref (r.pool);
+    }
+  binary_reader_finish (&r);
+  return x;
+}
+
 static xexp *
 xexp_read_1 (FILE *f, GError **error, int fuzzy)
 {
@@ -655,8 +1216,12 @@ xexp_read_1 (FILE *f, GError **error, int fuzzy)
   if (f == NULL)
     return NULL;
 
+  if (binary_detect (f))
+    return xexp_read_binary (f, error);
+
   xp.stack = NULL;
   xp.result = NULL;
+  xp.pool = xexp_pool_new ();
   ctxt = g_markup_parse_context_new (&xexp_markup_parser, 0, &xp, NULL);
 
   while (xp.result == NULL && (n = fread (buf, 1, buf_size, f)) > 0)
@@ -672,6 +1237,7 @@ xexp_read_1 (FILE *f, GError **error, int fuzzy)
     parse_failed = TRUE;
 
   g_markup_parse_context_free (ctxt);
+  xexp_pool_unref (xp.pool);
 
   if (!parse_failed)
     {
@@ -721,6 +1287,271 @@ xexp_read_file (const char *filename)
   return NULL;
 }
 
+/** Streaming
+
+    The visitor keeps the toplevel element to itself.  For each child,
+    it collects the tag and text into reusable buffers and only
+    starts building a real xexp, with the regular parser callbacks,
+    when the child turns out to be a list.
+*/
+
+typedef struct {
+  xexp_visitor *visitor;
+  void *data;
+  int depth;
+  int stopped;
+  GString *tag;
+  GString *text;
+  xexp_parse_context child;
+} xexp_visit_context;
+
+static void
+xexp_visit_start_element (GMarkupParseContext *context,
+			  const gchar         *element_name,
+			  const gchar        **attribute_names,
+			  const gchar        **attribute_values,
+			  gpointer             user_data,
+			  GError             **error)
+{
+  xexp_visit_context *xv = (xexp_visit_context *)user_data;
+
+  xv->depth++;
+
+  if (xv->depth == 2)
+    {
+      g_string_assign (xv->tag, element_name);
+      g_string_truncate (xv->text, 0);
+      xv->child.stack = NULL;
+      xv->child.result = NULL;
+    }
+  else if (xv->depth > 2)
+    {
+      if (xv->child.stack == NULL)
+	{
+	  /* The child is a list after all.
+	   */
+	  ignore_text (xv->text->str, error);
+	  xv->child.pool = xexp_pool_new ();
+	  xv->child.stack =
+	    g_slist_prepend (NULL, xexp_node_new (xv->child.pool,
+						  xv->tag->str));
+	}
+      xexp_parser_start_element (context, element_name,
+				 attribute_names, attribute_values,
+				 &xv->child, error);
+    }
+}
+
+static void
+xexp_visit_end_element (GMarkupParseContext *context,
+			const gchar         *element_name,
+			gpointer             user_data,
+			GError             **error)
+{
+  xexp_visit_context *xv = (xexp_visit_context *)user_data;
+
+  if (xv->depth > 2)
+    xexp_parser_end_element (context, element_name, &xv->child, error);
+  else if (xv->depth == 2)
+    {
+      if (xv->child.stack)
+	{
+	  xexp_parser_end_element (context, element_name, &xv->child, error);
+	  if (!xv->stopped)
+	    xv->stopped = xv->visitor (xv->child.result, xv->data);
+	  xexp_free (xv->child.result);
+	  xv->child.result = NULL;
+	  xexp_pool_unref (xv->child.pool);
+	  xv->child.pool = NULL;
+	}
+      else if (!xv->stopped)
+	{
+	  xexp child = { xv->tag->str, NULL, NULL,
+			 xv->text->len > 0 ? xv->text->str : NULL };
+	  xv->stopped = xv->visitor (&child, xv->data);
+	}
+    }
+
+  xv->depth--;
+}
+
+static void
+xexp_visit_text (GMarkupParseContext *context,
+		 const gchar         *text,
+		 gsize                text_len,
+		 gpointer             user_data,
+		 GError             **error)
+{
+  xexp_visit_context *xv = (xexp_visit_context *)user_data;
+
+  if (xv->depth > 2 || (xv->depth == 2 && xv->child.stack))
+    xexp_parser_text (context, text, text_len, &xv->child, error);
+  else if (xv->depth == 2)
+    g_string_append_len (xv->text, text, text_len);
+
+  /* Text directly in the toplevel element is either whitespace
+     between the children, or the toplevel element is a text and has
+     no children to visit.
+  */
+}
+
+static GMarkupParser xexp_visit_parser = {
+  xexp_visit_start_element,
+  xexp_visit_end_element,
+  xexp_visit_text,
+  NULL,
+  NULL
+};
+
+/* Visiting a binary xexp does not need any of the buffering above,
+   the children can simply be read one after the other.
+*/
+static int
+xexp_visit_binary (FILE *f, xexp_visitor *visitor, void *data,
+		   GError **error)
+{
+  xexp_binary_reader r;
+  const char *tag;
+  int kind;
+  guint n;
+
+  if (binary_reader_init (&r, f, error)
+      && binary_read_header (&r, &tag, &kind))
+    {
+      if (kind == XEXP_BINARY_TEXT)
+	g_free (binary_read_string (&r, NULL, &n));
+      else if (kind == XEXP_BINARY_LIST && binary_read_number (&r, &n))
+	{
+	  int stopped = FALSE;
+
+	  while (!stopped && n-- > 0)
+	    {
+	      if (!binary_read_header (&r, &tag, &kind))
+		break;
+
+	      if (kind == XEXP_BINARY_LIST)
+		{
+		  r.pool = xexp_pool_new ();
+		  xexp *y = binary_read_body (&r, tag, kind, 1);
+		  xexp_pool_unref (r.pool);
+		  r.pool = NULL;
+		  if (y == NULL)
+		    break;
+		  stopped = visitor (y, data);
+		  xexp_free (y);
+		}
+	      else
+		{
+		  guint len = 0;
+		  char *text = NULL;
+
+		  if (kind == XEXP_BINARY_TEXT
+		      && (text = binary_read_string (&r, NULL, &len)) == NULL)
+		    break;
+
+		  xexp child = { (char *) tag, NULL, NULL,
+				 len > 0 ? text : NULL };
+		  stopped = visitor (&child, data);
+		  g_free (text);
+		}
+	    }
+	}
+    }
+
+  binary_reader_finish (&r);
+  return !r.failed;
+}
+
+static int
+xexp_visit_1 (FILE *f, xexp_visitor *visitor, void *data,
+	      GError **error, int fuzzy)
+{
+  xexp_visit_context xv;
+  GMarkupParseContext *ctxt;
+  gchar buf[1024];
+  size_t buf_size = fuzzy? sizeof (buf) : 1;
+  size_t n;
+  gboolean parse_failed = FALSE;
+  gboolean started = FALSE;
+
+  if (f == NULL)
+    return FALSE;
+
+  if (binary_detect (f))
+    return xexp_visit_binary (f, visitor, data, error);
+
+  xv.visitor = visitor;
+  xv.data = data;
+  xv.depth = 0;
+  xv.stopped = FALSE;
+  xv.tag = g_string_new (NULL);
+  xv.text = g_string_new (NULL);
+  xv.child.stack = NULL;
+  xv.child.result = NULL;
+  xv.child.pool = NULL;
+  ctxt = g_markup_parse_context_new (&xexp_visit_parser, 0, &xv, NULL);
+
+  while (!xv.stopped
+	 && !(started && xv.depth == 0)
+	 && (n = fread (buf, 1, buf_size, f)) > 0)
+    {
+      if (!g_markup_parse_context_parse (ctxt, buf, n, error))
+	{
+	  parse_failed = TRUE;
+	  break;
+	}
+      if (xv.depth > 0)
+	started = TRUE;
+    }
+
+  if (!xv.stopped && !parse_failed
+      && !g_markup_parse_context_end_parse (ctxt, error))
+    parse_failed = TRUE;
+
+  g_markup_parse_context_free (ctxt);
+
+  /* A child that was being built when parsing stopped.
+   */
+  if (xv.child.stack)
+    {
+      xexp *top = (xexp *) g_slist_last (xv.child.stack)->data;
+      xexp_free (top);
+      g_slist_free (xv.child.stack);
+    }
+  xexp_pool_unref (xv.child.pool);
+
+  g_string_free (xv.tag, TRUE);
+  g_string_free (xv.text, TRUE);
+
+  return !parse_failed;
+}
+
+int
+xexp_visit (FILE *f, xexp_visitor *visitor, void *data, GError **error)
+{
+  return xexp_visit_1 (f, visitor, data, error, FALSE);
+}
+
+int
+xexp_visit_file (const char *filename, xexp_visitor *visitor, void *data)
+{
+  FILE *f = fopen (filename, "r");
+  if (f != NULL)
+    {
+      GError *error = NULL;
+      int success = xexp_visit_1 (f, visitor, data, &error, TRUE);
+      fclose (f);
+      if (error)
+	{
+	  fprintf (stderr, "%s: %s\n", filename, error->message);
+	  g_error_free (error);
+	}
+      return success;
+    }
+  fprintf (stderr, "%s: %s\n", filename, strerror (errno));
+  return FALSE;
+}
+
 /** Writing */
 
 static void
@@ -783,8 +1614,104 @@ xexp_write (FILE *f, xexp *x)
     xexp_write_1 (f, x, 0);
 }
 
-int
-xexp_write_file (const char *filename, xexp *x)
+typedef struct {
+  FILE *f;
+  GHashTable *tag_index;
+  GSList *tags;
+  guint n_tags;
+} xexp_binary_writer;
+
+static void
+binary_collect_tags (xexp_binary_writer *w, xexp *x)
+{
+  xexp *y;
+
+  if (g_hash_table_lookup (w->tag_index, x->tag) == NULL)
+    {
+      /* Indices are stored plus one so that they are never NULL.
+       */
+      w->n_tags++;
+      g_hash_table_insert (w->tag_index, x->tag, GUINT_TO_POINTER (w->n_tags));
+      w->tags = g_slist_prepend (w->tags, x->tag);
+    }
+
+  for (y = x->first; y; y = y->rest)
+    binary_collect_tags (w, y);
+}
+
+static void
+binary_write_number (FILE *f, guint val)
+{
+  while (val >= 0x80)
+    {
+      putc ((val & 0x7f) | 0x80, f);
+      val >>= 7;
+    }
+  putc (val, f);
+}
+
+static void
+binary_write_string (FILE *f, const char *str)
+{
+  size_t len = strlen (str);
+
+  binary_write_number (f, len);
+  fwrite (str, 1, len, f);
+}
+
+static void
+binary_write_node (xexp_binary_writer *w, xexp *x)
+{
+  guint index =
+    GPOINTER_TO_UINT (g_hash_table_lookup (w->tag_index, x->tag)) - 1;
+
+  if (xexp_is_empty (x))
+    binary_write_number (w->f, (index << 2) | XEXP_BINARY_EMPTY);
+  else if (xexp_is_list (x))
+    {
+      xexp *y;
+
+      binary_write_number (w->f, (index << 2) | XEXP_BINARY_LIST);
+      binary_write_number (w->f, xexp_length (x));
+      for (y = x->first; y; y = y->rest)
+	binary_write_node (w, y);
+    }
+  else
+    {
+      binary_write_number (w->f, (index << 2) | XEXP_BINARY_TEXT);
+      binary_write_string (w->f, x->text);
+    }
+}
+
+void
+xexp_write_binary (FILE *f, xexp *x)
+{
+  xexp_binary_writer w;
+  GSList *t;
+
+  if (f == NULL)
+    return;
+
+  w.f = f;
+  w.tag_index = g_hash_table_new (g_str_hash, g_str_equal);
+  w.tags = NULL;
+  w.n_tags = 0;
+  binary_collect_tags (&w, x);
+  w.tags = g_slist_reverse (w.tags);
+
+  fwrite (XEXP_BINARY_MAGIC, 1, XEXP_BINARY_MAGIC_LEN, f);
+  binary_write_number (f, w.n_tags);
+  for (t = w.tags; t; t = t->next)
+    binary_write_string (f, (const char *) t->data);
+  binary_write_node (&w, x);
+
+  g_slist_free (w.tags);
+  g_hash_table_destroy (w.tag_index);
+}
+
+static int
+xexp_write_file_1 (const char *filename, xexp *x,
+		   void (*write) (FILE *f, xexp *x))
 {
   char *tmp_filename = g_strdup_printf ("%s#%d", filename, getpid());
   FILE *f = fopen (tmp_filename, "w");
@@ -792,7 +1719,7 @@ xexp_write_file (const char *filename, xexp *x)
   if (f == NULL)
     goto error;
 
-  xexp_write (f, x);
+  write (f, x);
 
   if ((ferror (f) | fflush (f) | fsync (fileno (f)) | fclose (f))
       || (rename (tmp_filename, filename) < 0))
@@ -812,3 +1739,15 @@ xexp_write_file (const char *filename, xexp *x)
     g_free (tmp_filename);
   return 0;
 }
+
+int
+xexp_write_file (const char *filename, xexp *x)
+{
+  return xexp_write_file_1 (filename, x, xexp_write);
+}
+
+int
+xexp_write_file_binary (const char *filename, xexp *x)
+{
+  return xexp_write_file_1 (filename, x, xexp_write_binary);
+}
@@ -182,7 +182,8 @@
    - void xexp_append_1 (xexp *X, xexp *Y)
 
    Append Y to the end of the list of children of X.  X must be a list
-   xexp.  Y must be a free standing xexp.
+   xexp.  Y must be a free standing xexp.  This takes constant time,
+   lists remember their last child.
 
    - void xexp_append (xexp *X, xexp *Y)
 
@@ -236,6 +237,11 @@
    Return the first xexp that has tag TAG from the children of X.
    Return NULL if there is no such xexp.
 
+   Long lists get a index from tags to children the first time they
+   need to be scanned completely, and later lookups use it.  The
+   index is kept up to date by xexp_cons, xexp_append_1, xexp_aset and
+   xexp_adel, and dropped by other changes to the list.
+
    - xexp *xexp_aref_rest (xexp *X, const char *TAG)
 
    Return the first xexp that has tag TAG starting from the rest
@@ -283,6 +289,33 @@
    Remove all children of X that have tag TAG.
 
 
+   POOLS
+
+   The nodes and texts of a tree that is built in one go can be
+   allocated from a pool instead of one by one.  xexp_read,
+   xexp_read_file, xexp_copy and the streaming functions do this by
+   themselves.  A pool is released as a whole when the last xexp
+   allocated from it has been freed; until then, its memory is not
+   reused.  Xexps from pools can be used like any other xexp.
+
+   - xexp_pool *xexp_pool_new (void)
+
+   Create a new pool.  The caller holds a reference to it, which must
+   eventually be dropped with xexp_pool_unref.
+
+   - void xexp_pool_unref (xexp_pool *POOL)
+
+   Drop the reference of the caller to POOL.  Xexps allocated from
+   POOL remain valid.
+
+   - xexp *xexp_pool_list_new (xexp_pool *POOL, const char *TAG)
+   - xexp *xexp_pool_text_new (xexp_pool *POOL, const char *TAG,
+                               const char *TEXT)
+
+   Like xexp_list_new and xexp_text_new, but allocate the new xexp
+   from POOL.
+
+
    READING AND WRITING
 
    - xexp *xexp_read (FILE *F, GError **ERROR)
@@ -305,6 +338,42 @@
    Write X to the file named FILENAME.  When the file can not be
    written, the error is logged to stderr, the old version of it is
    left in place and false is returned.  Otherwise, true is returned.
+
+   - void xexp_write_binary (FILE *F, xexp *X)
+   - int xexp_write_file_binary (const char *FILENAME, xexp *X)
+
+   Like xexp_write and xexp_write_file, but use a compact binary
+   encoding instead of XML: a table of all tags, followed by the
+   nodes, with texts written as length-prefixed strings.  It is
+   quicker to read and write, but nobody can edit it by hand, so use
+   it only for files that are written and read by programs alone.
+   The XML format remains the right choice for configuration files.
+
+   All the readers, xexp_read, xexp_read_file and the streaming
+   functions below, recognize both formats by themselves.
+
+
+   STREAMING
+
+   - int xexp_visit (FILE *F, xexp_visitor *VISITOR, void *DATA,
+                     GError **ERROR)
+
+   Read exactly one xexp from F, but instead of building it, call
+   VISITOR for each of its children, in order.  Children that are
+   texts are passed as temporary xexps that do not need to be
+   allocated; list children are built as usual and freed again when
+   VISITOR returns.  Thus, VISITOR must not modify or keep the child
+   it is passed.  Use xexp_copy if you need to keep it.  When VISITOR
+   returns non-zero, reading stops.
+
+   Returns false and sets ERROR when F could not be parsed.  Children
+   that have been visited before the error was noticed stay visited.
+
+   - int xexp_visit_file (const char *FILENAME,
+                          xexp_visitor *VISITOR, void *DATA)
+
+   Like xexp_visit, for the file named FILENAME.  Errors are logged
+   to stderr, like xexp_read_file does.
 */
 
 #ifndef XEXP_H
@@ -316,6 +385,9 @@
 struct xexp;
 typedef struct xexp xexp;
 
+struct xexp_pool;
+typedef struct xexp_pool xexp_pool;
+
 /* General
  */
 const char *xexp_tag (xexp *x);
@@ -362,6 +434,13 @@ void xexp_aset_int (xexp *x, const char *tag, int val);
 void xexp_aset_bool (xexp *x, const char *tag, int val);
 void xexp_adel (xexp *x, const char *tag);
 
+/* Pools
+ */
+xexp_pool *xexp_pool_new (void);
+void xexp_pool_unref (xexp_pool *pool);
+xexp *xexp_pool_list_new (xexp_pool *pool, const char *tag);
+xexp *xexp_pool_text_new (xexp_pool *pool, const char *tag, const char *text);
+
 /* Reading and writing
  */
 xexp *xexp_read (FILE *f, GError **error);
@@ -370,4 +449,15 @@ void xexp_write (FILE *f, xexp *x);
 xexp *xexp_read_file (const char *filename);
 int xexp_write_file (const char *filename, xexp *x);
 
+void xexp_write_binary (FILE *f, xexp *x);
+int xexp_write_file_binary (const char *filename, xexp *x);
+
+/* Streaming
+ */
+typedef int xexp_visitor (xexp *child, void *data);
+
+int xexp_visit (FILE *f, xexp_visitor *visitor, void *data, GError **error);
+int xexp_visit_file (const char *filename,
+		     xexp_visitor *visitor, void *data);
+
 #endif
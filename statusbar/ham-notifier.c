@@ -426,36 +426,194 @@ get_uri ()
   return uri;
 }
 
+/* The ETag and Last-Modified headers of the last successful download
+   are kept in UFILE_AVAILABLE_NOTIFICATIONS_VALIDATORS, together with
+   the URI they belong to.  They are sent back as If-None-Match and
+   If-Modified-Since, and when the server answers with "304 Not
+   Modified", nothing is written, parsed or synced.
+*/
+
+typedef struct _DownloadState DownloadState;
+struct _DownloadState {
+  FILE *file;              /* opened when the body starts */
+  gchar *etag;
+  gchar *last_modified;
+};
+
+static gchar *
+header_value (const gchar *header, size_t len, const gchar *name)
+{
+  size_t n = strlen (name);
+
+  if (len > n
+      && g_ascii_strncasecmp (header, name, n) == 0
+      && header[n] == ':')
+    return g_strstrip (g_strndup (header + n + 1, len - n - 1));
+
+  return NULL;
+}
+
+static size_t
+download_header_cb (void *ptr, size_t size, size_t nmemb, void *data)
+{
+  DownloadState *state = (DownloadState *) data;
+  const gchar *header = (const gchar *) ptr;
+  size_t len = size * nmemb;
+  gchar *value;
+
+  if (len > 5 && strncmp (header, "HTTP/", 5) == 0)
+    {
+      /* A new response, after a redirect for example.  Forget the
+         headers of the previous one. */
+      g_free (state->etag);
+      g_free (state->last_modified);
+      state->etag = state->last_modified = NULL;
+    }
+  else if ((value = header_value (header, len, "ETag")) != NULL)
+    {
+      g_free (state->etag);
+      state->etag = value;
+    }
+  else if ((value = header_value (header, len, "Last-Modified")) != NULL)
+    {
+      g_free (state->last_modified);
+      state->last_modified = value;
+    }
+
+  return len;
+}
+
+static size_t
+download_write_cb (void *ptr, size_t size, size_t nmemb, void *data)
+{
+  DownloadState *state = (DownloadState *) data;
+
+  if (state->file == NULL)
+    {
+      state->file =
+        user_file_open_for_write (UFILE_AVAILABLE_NOTIFICATIONS_TMP);
+      LOG ("tmpfile %s", state->file != NULL ? "ok" : "failed!!!");
+      if (state->file == NULL)
+        return 0;
+    }
+
+  return fwrite (ptr, size, nmemb, state->file);
+}
+
+static xexp *
+read_validators (const gchar *uri)
+{
+  xexp *validators;
+  const gchar *validators_uri;
+  FILE *f;
+
+  /* The validators are useless without the data they validate. */
+  f = user_file_open_for_read (UFILE_AVAILABLE_NOTIFICATIONS);
+  if (f == NULL)
+    return NULL;
+  fclose (f);
+
+  validators = user_file_read_xexp (UFILE_AVAILABLE_NOTIFICATIONS_VALIDATORS);
+  if (validators == NULL)
+    return NULL;
+
+  validators_uri = xexp_aref_text (validators, "uri");
+  if (validators_uri == NULL || strcmp (validators_uri, uri) != 0)
+    {
+      xexp_free (validators);
+      return NULL;
+    }
+
+  return validators;
+}
+
+static void
+write_validators (const gchar *uri, DownloadState *state)
+{
+  xexp *validators;
+
+  if (state->etag == NULL && state->last_modified == NULL)
+    {
+      user_file_remove (UFILE_AVAILABLE_NOTIFICATIONS_VALIDATORS);
+      return;
+    }
+
+  validators = xexp_list_new ("validators");
+  xexp_aset_text (validators, "uri", uri);
+  if (state->etag != NULL)
+    xexp_aset_text (validators, "etag", state->etag);
+  if (state->last_modified != NULL)
+    xexp_aset_text (validators, "last-modified", state->last_modified);
+
+  user_file_write_xexp (UFILE_AVAILABLE_NOTIFICATIONS_VALIDATORS, validators);
+  xexp_free (validators);
+}
+
+static struct curl_slist *
+append_header (struct curl_slist *headers,
+               const gchar *name, const gchar *value)
+{
+  if (value != NULL)
+    {
+      gchar *header = g_strdup_printf ("%s: %s", name, value);
+      headers = curl_slist_append (headers, header);
+      g_free (header);
+    }
+
+  return headers;
+}
+
 static gboolean
 download_notifications (gchar *proxy)
 {
   gchar *uri;
-  FILE *tmpfile;
   CURL *handle;
+  struct curl_slist *headers;
+  DownloadState state;
   gboolean ok;
 
   handle = NULL;
+  headers = NULL;
+  state.file = NULL;
+  state.etag = NULL;
+  state.last_modified = NULL;
   ok = FALSE;
 
   uri = get_uri ();
   LOG ("notification uri = %s", uri);
 
-  tmpfile = user_file_open_for_write (UFILE_AVAILABLE_NOTIFICATIONS_TMP);
-  LOG ("tmpfile %s", tmpfile != NULL ? "ok" : "failed!!!");
-
-  if (uri != NULL && tmpfile != NULL)
+  if (uri != NULL)
   {
     CURLcode ret;
+    xexp *validators;
     xexp *data;
     glong response;
 
+    validators = read_validators (uri);
+    if (validators != NULL)
+      {
+        headers = append_header (headers, "If-None-Match",
+                                 xexp_aref_text (validators, "etag"));
+        headers = append_header (headers, "If-Modified-Since",
+                                 xexp_aref_text (validators,
+                                                 "last-modified"));
+        xexp_free (validators);
+      }
+
     handle = curl_easy_init ();
     if (handle == NULL)
       goto exit;
 
-    ret = curl_easy_setopt (handle, CURLOPT_WRITEDATA, tmpfile);
+    ret = curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION, download_write_cb);
+    ret |= curl_easy_setopt (handle, CURLOPT_WRITEDATA, &state);
+    ret |= curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
+                             download_header_cb);
+    ret |= curl_easy_setopt (handle, CURLOPT_WRITEHEADER, &state);
     ret |= curl_easy_setopt (handle, CURLOPT_URL, uri);
 
+    if (headers != NULL)
+      ret |= curl_easy_setopt (handle, CURLOPT_HTTPHEADER, headers);
+
     if (proxy != NULL)
       ret |= curl_easy_setopt (handle, CURLOPT_PROXY, proxy);
 
@@ -467,13 +625,23 @@ download_notifications (gchar *proxy)
     ret |= curl_easy_getinfo (handle, CURLINFO_RESPONSE_CODE, &response);
 
     LOG ("ret = %d, response = %ld", ret, response);
-    if (ret != CURLE_OK || response != 200)
+    if (ret != CURLE_OK)
       goto exit;
 
-    fflush (tmpfile);
-    fsync (fileno (tmpfile));
-    fclose (tmpfile);
-    tmpfile = NULL;
+    if (response == 304)
+      {
+        LOG ("notifications not modified");
+        ok = TRUE;
+        goto exit;
+      }
+
+    if (response != 200 || state.file == NULL)
+      goto exit;
+
+    fflush (state.file);
+    fsync (fileno (state.file));
+    fclose (state.file);
+    state.file = NULL;
 
     data = user_file_read_xexp (UFILE_AVAILABLE_NOTIFICATIONS_TMP);
 
@@ -483,24 +651,29 @@ download_notifications (gchar *proxy)
       {
         /* Copy data to the final file if validated */
         user_file_write_xexp (UFILE_AVAILABLE_NOTIFICATIONS, data);
-        xexp_free (data);
+        write_validators (uri, &state);
         ok = TRUE;
       }
+
+    if (data != NULL)
+      xexp_free (data);
   }
 
  exit:
   if (handle != NULL)
     curl_easy_cleanup (handle);
 
-  if (tmpfile != NULL)
-    {
-      fflush (tmpfile);
-      fsync (fileno (tmpfile));
-      fclose (tmpfile);
-    }
+  if (headers != NULL)
+    curl_slist_free_all (headers);
+
+  /* A partial download is thrown away, no need to sync it. */
+  if (state.file != NULL)
+    fclose (state.file);
 
   user_file_remove (UFILE_AVAILABLE_NOTIFICATIONS_TMP);
 
+  g_free (state.etag);
+  g_free (state.last_modified);
   g_free (uri);
 
   return ok;
@@ -351,6 +351,7 @@ ham_updates_status_menu_item_check_done_cb (gpointer self,
   if (ok)
     {
       LOG ("Check for updates done");
+      ham_updates_invalidate_files ();
       update_state (self);
     }
   else
@@ -519,7 +520,11 @@ ham_updates_status_menu_item_rpc_cb (const gchar* interface,
     }
   else if (strcmp (method, UPDATE_NOTIFIER_OP_CHECK_STATE) == 0)
     {
-      /* Update states of the satusbar item */
+      /* Update states of the satusbar item.  The Application
+         Manager sends this after changing the seen or tapped
+         updates.
+      */
+      ham_updates_invalidate_files ();
       update_state (self);
     }
   else
@@ -651,7 +656,13 @@ ham_updates_status_menu_item_inotify_cb (GIOChannel *source,
 
       if (is_file_modified (event, priv->wd[VAR], AVAILABLE_UPDATES_FILE_NAME)
           || is_file_modified (event, priv->wd[HOME], UFILE_SEEN_UPDATES)
-          || is_file_modified (event, priv->wd[HOME], UFILE_SEEN_NOTIFICATIONS))
+          || is_file_modified (event, priv->wd[HOME], UFILE_TAPPED_UPDATES))
+        {
+          ham_updates_invalidate_files ();
+          update_state (HAM_UPDATES_STATUS_MENU_ITEM (data));
+        }
+      else if (is_file_modified (event, priv->wd[HOME],
+                                 UFILE_SEEN_NOTIFICATIONS))
         {
           update_state (HAM_UPDATES_STATUS_MENU_ITEM (data));
         }
@@ -72,11 +72,99 @@ struct _HamUpdatesPrivate
   guint child_id;
 };
 
+/* The available updates and the seen and tapped updates are read
+   once and kept until ham_updates_invalidate_files is called, which
+   happens when one of the files is known to have changed.  The seen
+   and tapped updates are kept as sets of package names.
+*/
+typedef struct _UpdatesFiles UpdatesFiles;
+struct _UpdatesFiles {
+  gboolean loaded;
+  xexp *available;     /* NULL when there is no file */
+  GHashTable *seen;
+  GHashTable *tapped;  /* NULL when there is no file */
+};
+
+static UpdatesFiles updates_files = { FALSE, NULL, NULL, NULL };
+
 static void ham_updates_build_button (HamUpdates *self);
 
-static Updates *updates_fetch (const gchar *seen_ufile);
+static Updates *updates_fetch (void);
 static void updates_free (Updates* updates);
 
+static int
+updates_set_add (xexp *x, void *data)
+{
+  GHashTable *set = (GHashTable *) data;
+
+  if (xexp_is_text (x))
+    g_hash_table_insert (set, g_strdup (xexp_text (x)), GINT_TO_POINTER (1));
+
+  return 0;
+}
+
+/* Returns NULL when UFILE can not be read.
+ */
+static GHashTable *
+updates_set_read (const gchar *ufile)
+{
+  GHashTable *set;
+
+  set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!user_file_visit_xexp (ufile, updates_set_add, set))
+    {
+      g_hash_table_destroy (set);
+      return NULL;
+    }
+
+  return set;
+}
+
+static UpdatesFiles *
+updates_files_get (void)
+{
+  if (!updates_files.loaded)
+    {
+      updates_files.available = xexp_read_file (AVAILABLE_UPDATES_FILE);
+
+      updates_files.seen = updates_set_read (UFILE_SEEN_UPDATES);
+      if (updates_files.seen == NULL)
+        updates_files.seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+      updates_files.tapped = updates_set_read (UFILE_TAPPED_UPDATES);
+
+      updates_files.loaded = TRUE;
+    }
+
+  return &updates_files;
+}
+
+void
+ham_updates_invalidate_files ()
+{
+  if (!updates_files.loaded)
+    return;
+
+  if (updates_files.available != NULL)
+    xexp_free (updates_files.available);
+  g_hash_table_destroy (updates_files.seen);
+  if (updates_files.tapped != NULL)
+    g_hash_table_destroy (updates_files.tapped);
+
+  updates_files.available = NULL;
+  updates_files.seen = NULL;
+  updates_files.tapped = NULL;
+  updates_files.loaded = FALSE;
+}
+
+static gboolean
+updates_set_contains (GHashTable *set, xexp *x)
+{
+  return (set != NULL
+          && g_hash_table_lookup (set, xexp_text (x)) != NULL);
+}
+
 static void ham_updates_finalize (gpointer object)
 {
   HamUpdatesPrivate *priv;
@@ -85,6 +173,8 @@ static void ham_updates_finalize (gpointer object)
 
   if (priv->child_id > 0)
     g_source_remove (priv->child_id);
+
+  ham_updates_invalidate_files ();
 }
 
 static void
@@ -105,12 +195,12 @@ update_seen_file (const gchar *seen_ufile)
 
   g_return_if_fail (seen_ufile != NULL);
 
-  available_updates = xexp_read_file (AVAILABLE_UPDATES_FILE);
+  available_updates = updates_files_get ()->available;
 
   if (available_updates != NULL)
     {
-      user_file_write_xexp (seen_ufile, available_updates);
-      xexp_free (available_updates);
+      user_file_write_xexp_binary (seen_ufile, available_updates);
+      ham_updates_invalidate_files ();
     }
 }
 
@@ -123,55 +213,40 @@ clean_updates_ufile (const gchar *ufile)
 
   if (updates != NULL)
     {
-      user_file_write_xexp (ufile, updates);
+      user_file_write_xexp_binary (ufile, updates);
       xexp_free (updates);
+      ham_updates_invalidate_files ();
     }
 }
 
 void
 ham_updates_icon_tapped ()
 {
-  xexp *available_updates;
-  xexp *seen_updates;
+  UpdatesFiles *files;
   xexp *tapped_updates;
 
   g_warning ("icon tapped!!");
 
-  available_updates = xexp_read_file (AVAILABLE_UPDATES_FILE);
-  if (available_updates == NULL)
+  files = updates_files_get ();
+  if (files->available == NULL)
     {
       clean_updates_ufile (UFILE_TAPPED_UPDATES);
       return;
     }
 
-  seen_updates = user_file_read_xexp (UFILE_SEEN_UPDATES);
-
   tapped_updates = xexp_list_new ("updates");
 
   if (tapped_updates != NULL)
     {
       xexp *x;
-      xexp *y;
 
-      for (x = xexp_first (available_updates); x != NULL; x = xexp_rest (x))
+      for (x = xexp_first (files->available); x != NULL; x = xexp_rest (x))
         {
           if (!xexp_is_text (x))
             continue;
 
-          y = NULL;
-          if ((seen_updates != NULL) && xexp_is_list (seen_updates))
-            {
-              const gchar *pkg;
-
-              pkg = xexp_text (x);
-
-              for (y = xexp_first (seen_updates); y != NULL; y = xexp_rest (y))
-                if (xexp_is_text (y) && strcmp (pkg, xexp_text (y)) == 0)
-                  break;
-            }
-
           /* this available_update is not in the seen_udpates */
-          if (y == NULL)
+          if (!updates_set_contains (files->seen, x))
             {
               xexp *tapped = NULL;
               tapped = xexp_text_new (xexp_tag (x), xexp_text (x));
@@ -179,15 +254,10 @@ ham_updates_icon_tapped ()
             }
         }
 
-      user_file_write_xexp (UFILE_TAPPED_UPDATES, tapped_updates);
-
-      if (tapped_updates != NULL)
-        xexp_free (tapped_updates);
+      user_file_write_xexp_binary (UFILE_TAPPED_UPDATES, tapped_updates);
+      xexp_free (tapped_updates);
+      ham_updates_invalidate_files ();
     }
-
-  xexp_free (available_updates);
-  if (seen_updates != NULL)
-    xexp_free (seen_updates);
 }
 
 static void
@@ -260,7 +330,7 @@ build_dialog_content ()
   Updates *updates;
   gchar* retval;
 
-  updates = updates_fetch (UFILE_SEEN_UPDATES);
+  updates = updates_fetch ();
   retval = NULL;
 
   if (updates == NULL)
@@ -423,6 +493,7 @@ ham_updates_maybe_force_blinking (HamUpdates *self)
             {
               user_file_remove (UFILE_SEEN_UPDATES);
               user_file_remove (UFILE_TAPPED_UPDATES);
+              ham_updates_invalidate_files ();
             }
         }
 
@@ -663,71 +734,34 @@ ham_is_showing_check_for_updates_view (osso_context_t *context)
 }
 
 static gboolean
-is_there_unseen_updates (const gchar *seen_ufile, const gchar *tapped_ufile)
+is_there_unseen_updates (void)
 {
-  xexp *tapped_updates = NULL;
-  xexp *available_updates = NULL;
-  xexp *seen_updates = NULL;
-  gboolean ret = TRUE;
+  UpdatesFiles *files;
+  xexp *x;
 
-  /* not really necessary because it's an internal function */
-  g_return_val_if_fail (seen_ufile != NULL && tapped_ufile != NULL, FALSE);
+  files = updates_files_get ();
 
-  available_updates = xexp_read_file (AVAILABLE_UPDATES_FILE);
-  if (available_updates == NULL)
+  if (files->available == NULL)
     return FALSE;
 
-  tapped_updates = user_file_read_xexp (tapped_ufile);
-  if (tapped_updates == NULL)
-    goto bailout;
+  if (files->tapped == NULL)
+    return TRUE;
 
-  seen_updates = user_file_read_xexp (seen_ufile);
-
-  xexp *x;
-  xexp *y;
-  ret = FALSE;
-
-  for (x = xexp_first (available_updates); x != NULL; x = xexp_rest (x))
+  for (x = xexp_first (files->available); x != NULL; x = xexp_rest (x))
     {
-      const gchar *pkg;
-
       if (!xexp_is_text (x))
         continue;
 
-      pkg = xexp_text (x);
-
-      /* filter out seen updates */
-      if ((seen_updates != NULL) && xexp_is_list (seen_updates))
-        {
-          for (y = xexp_first (seen_updates); y != NULL; y = xexp_rest (y))
-            if (xexp_is_text (y) && strcmp (pkg, xexp_text (y)) == 0)
-              break;
-
-          if (y != NULL)
-            continue; /* we have seen this update, go for the next item */
-        }
-
-      /* filter out tapped updates */
-      for (y = xexp_first (tapped_updates); y != NULL; y = xexp_rest (y))
-        if (xexp_is_text (y) && strcmp (pkg, xexp_text (y)) == 0)
-          break;
-
-      if (y != NULL)
-        continue; /* we have tapped this update, go for the next item */
+      /* filter out seen and tapped updates */
+      if (updates_set_contains (files->seen, x)
+          || updates_set_contains (files->tapped, x))
+        continue;
 
       /* when we reach these lines we found a new package :-) */
-      ret = TRUE;
-      break;
+      return TRUE;
     }
 
- bailout:
-  xexp_free (available_updates);
-  if (tapped_updates != NULL)
-    xexp_free (tapped_updates);
-  if (seen_updates != NULL)
-    xexp_free (seen_updates);
-
-  return ret;
+  return FALSE;
 }
 
 UpdatesStatus
@@ -742,7 +776,7 @@ ham_updates_status (HamUpdates *self, osso_context_t *context)
 
   priv = HAM_UPDATES_GET_PRIVATE (self);
 
-  updates = updates_fetch (UFILE_SEEN_UPDATES);
+  updates = updates_fetch ();
 
   if (updates == NULL)
     {
@@ -760,8 +794,7 @@ ham_updates_status (HamUpdates *self, osso_context_t *context)
 	  hildon_button_set_value (HILDON_BUTTON (priv->button), value);
 	  g_free (value);
 
-          if (is_there_unseen_updates (UFILE_SEEN_UPDATES,
-                                       UFILE_TAPPED_UPDATES))
+          if (is_there_unseen_updates ())
             ret = UPDATES_NEW;
           else
             ret = UPDATES_TAPPED;
@@ -778,72 +811,45 @@ ham_updates_status (HamUpdates *self, osso_context_t *context)
 }
 
 static Updates *
-updates_fetch (const gchar *seen_ufile)
+updates_fetch (void)
 {
-  xexp *available_updates;
-  xexp *seen_updates;
+  UpdatesFiles *files;
   Updates *retval;
-
-  g_return_val_if_fail (seen_ufile != NULL, NULL);
+  xexp *x;
 
   retval = g_new0 (Updates, 1);
 
-  available_updates = xexp_read_file (AVAILABLE_UPDATES_FILE);
+  files = updates_files_get ();
 
-  if (available_updates == NULL)
+  if (files->available == NULL)
     goto exit;
 
-  seen_updates = user_file_read_xexp (seen_ufile);
-
-  if (seen_updates == NULL)
-    seen_updates = xexp_list_new ("updates");
-
-  /* preconditions ok */
-  {
-    xexp *x;
-    xexp *y;
-
-    y = NULL;
-
-    for (x = xexp_first (available_updates); x != NULL; x = xexp_rest (x))
-      {
-        if (!xexp_is_text (x))
-          continue;
-
-        if ((seen_updates != NULL) && xexp_is_list (seen_updates))
-          {
-            const gchar *pkg;
-
-            pkg = xexp_text (x);
-
-            for (y = xexp_first (seen_updates); y != NULL; y = xexp_rest (y))
-              if (xexp_is_text (y) && strcmp (pkg, xexp_text (y)) == 0)
-                break;
-          }
-
-        if (y == NULL)
-          {
-            retval->total++;
-
-            if (xexp_is (x, "os"))
-              retval->os = g_slist_append (retval->os,
-                                           g_strdup (xexp_text (x)));
-            else if (xexp_is (x, "certified"))
-              retval->certified = g_slist_append (retval->certified,
-                                                  g_strdup (xexp_text (x)));
-            else
-              retval->other = g_slist_append (retval->other,
-                                              g_strdup (xexp_text (x)));
-	  }
-      }
-
-      xexp_free (available_updates);
+  for (x = xexp_first (files->available); x != NULL; x = xexp_rest (x))
+    {
+      if (!xexp_is_text (x))
+        continue;
 
-      if (seen_updates != NULL)
-        xexp_free (seen_updates);
+      if (!updates_set_contains (files->seen, x))
+        {
+          retval->total++;
+
+          if (xexp_is (x, "os"))
+            retval->os = g_slist_prepend (retval->os,
+                                          g_strdup (xexp_text (x)));
+          else if (xexp_is (x, "certified"))
+            retval->certified = g_slist_prepend (retval->certified,
+                                                 g_strdup (xexp_text (x)));
+          else
+            retval->other = g_slist_prepend (retval->other,
+                                             g_strdup (xexp_text (x)));
+        }
     }
 
-  if (retval != NULL && retval->total > 0)
+  retval->os = g_slist_reverse (retval->os);
+  retval->certified = g_slist_reverse (retval->certified);
+  retval->other = g_slist_reverse (retval->other);
+
+  if (retval->total > 0)
     LOG ("new pkgs = %d, os = %d, cert = %d, other = %d", retval->total,
 	 g_slist_length (retval->os),
 	 g_slist_length (retval->certified),
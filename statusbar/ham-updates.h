@@ -59,6 +59,7 @@ time_t ham_updates_get_blink_after (HamUpdates *self);
 time_t ham_updates_get_interval (HamUpdates *self);
 UpdatesStatus ham_updates_status (HamUpdates *self, osso_context_t *context);
 void ham_updates_icon_tapped ();
+void ham_updates_invalidate_files ();
 
 HamUpdates *ham_updates_new (gpointer data);
 void ham_updates_free (HamUpdates *self);